@@ -0,0 +1,215 @@
+#include "cs229Cache.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define CS229_CACHE_MAGIC "SNDCACHE"
+
+/* bump whenever the layout of a cache file changes */
+#define CS229_CACHE_VERSION 2
+
+/**
+  Start of every cache file, followed directly by dataSize bytes of samples in
+  the same layout as the rawData of a CS229 sound. The fields are in the byte
+  order of the machine that wrote them, which is fine for a local cache: a
+  file from another machine has the wrong magic or version, or does not match
+  the input file.
+*/
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t sampleRate;
+  /* the input file the samples were parsed from */
+  uint64_t fileSize;
+  uint64_t fileInode;
+  uint64_t fileDevice;
+  int64_t mtimeSeconds;
+  int64_t mtimeNanoseconds;
+  uint64_t dataSize;
+  uint16_t numChannels;
+  uint16_t bitDepth;
+} cs229CacheHeader_t;
+
+/**
+  Fills in the magic, version, and input file fields of header from file.
+  Returns the allocated path of its cache file, or NULL if caching is off, file
+  is not a regular file, or there is no memory.
+*/
+char* getCacheFileName(FILE* file, cs229CacheHeader_t* header);
+
+/**
+  Returns nonzero if the cache file starting with header was written by this 
+  version for the input file described by expected.
+*/
+char isCacheFor(cs229CacheHeader_t* header, cs229CacheHeader_t* expected);
+
+char* getCacheFileName(FILE* file, cs229CacheHeader_t* header) {
+  struct stat fileStat;
+  char* name;
+  size_t nameLength;
+  char* directory = getenv("SOUNDUTILS_CACHE");
+  if(!directory || directory[0] == '\0') {
+    return NULL;
+  }
+  if(fstat(fileno(file), &fileStat) != 0 || !S_ISREG(fileStat.st_mode)) {
+    return NULL;
+  }
+  memset(header, 0, sizeof(cs229CacheHeader_t));
+  memcpy(header->magic, CS229_CACHE_MAGIC, sizeof(header->magic));
+  header->version = CS229_CACHE_VERSION;
+  header->fileSize = fileStat.st_size;
+  header->fileInode = fileStat.st_ino;
+  header->fileDevice = fileStat.st_dev;
+  header->mtimeSeconds = fileStat.st_mtim.tv_sec;
+  header->mtimeNanoseconds = fileStat.st_mtim.tv_nsec;
+
+  /* the device and inode name the file however it was opened */
+  nameLength = strlen(directory) + 64;
+  name = malloc(nameLength);
+  if(!name) {
+    return NULL;
+  }
+  snprintf(name, nameLength, "%s/%llx-%llx.cs229cache", directory,
+    (unsigned long long)header->fileDevice, (unsigned long long)header->fileInode);
+  return name;
+}
+
+char isCacheFor(cs229CacheHeader_t* header, cs229CacheHeader_t* expected) {
+  return memcmp(header->magic, expected->magic, sizeof(header->magic)) == 0
+    && header->version == expected->version
+    && header->fileSize == expected->fileSize
+    && header->fileInode == expected->fileInode
+    && header->fileDevice == expected->fileDevice
+    && header->mtimeSeconds == expected->mtimeSeconds
+    && header->mtimeNanoseconds == expected->mtimeNanoseconds;
+}
+
+int loadCachedSound(FILE* file, sound_t* sound) {
+  cs229CacheHeader_t expected, *header;
+  struct stat cacheStat;
+  void* mapping;
+  int fd;
+  char* name = getCacheFileName(file, &expected);
+  if(!name) {
+    return 0;
+  }
+  fd = open(name, O_RDONLY);
+  free(name);
+  if(fd < 0) {
+    return 0;
+  }
+  if(fstat(fd, &cacheStat) != 0 || cacheStat.st_size < sizeof(cs229CacheHeader_t)) {
+    close(fd);
+    return 0;
+  }
+  mapping = mmap(NULL, cacheStat.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(mapping == MAP_FAILED) {
+    return 0;
+  }
+  header = mapping;
+  /* the format is checked as cs229ReadHeader checks a file's, so a damaged
+    cache is only a miss */
+  if(!isCacheFor(header, &expected) 
+      || header->dataSize > cacheStat.st_size - sizeof(cs229CacheHeader_t)
+      || header->numChannels == 0
+      || (header->bitDepth != 8 && header->bitDepth != 16 
+        && header->bitDepth != 24 && header->bitDepth != 32)
+      || header->dataSize % (header->numChannels * header->bitDepth / 8) != 0) {
+    munmap(mapping, cacheStat.st_size);
+    return 0;
+  }
+
+  if(sound->mappedFile) {
+    munmap(sound->mappedFile, sound->mappedFileSize);
+  }
+  sound->mappedFile = mapping;
+  sound->mappedFileSize = cacheStat.st_size;
+  sound->rawData = header + 1;
+  sound->dataSize = header->dataSize;
+  sound->sampleRate = header->sampleRate;
+  sound->numChannels = header->numChannels;
+  sound->bitDepth = header->bitDepth;
+  return 1;
+}
+
+cs229CacheWriter_t* beginCachedSound(FILE* file, sound_t* sound) {
+  cs229CacheHeader_t header;
+  cs229CacheWriter_t* writer;
+  char* name = getCacheFileName(file, &header);
+  if(!name) {
+    return NULL;
+  }
+  header.sampleRate = sound->sampleRate;
+  header.dataSize = sound->dataSize;
+  header.numChannels = sound->numChannels;
+  header.bitDepth = sound->bitDepth;
+
+  writer = malloc(sizeof(cs229CacheWriter_t));
+  if(!writer) {
+    free(name);
+    return NULL;
+  }
+  writer->name = name;
+  /* runs sharing the cache each write their own file and rename it in place */
+  writer->tempName = malloc(strlen(name) + 24);
+  if(!writer->tempName) {
+    free(name);
+    free(writer);
+    return NULL;
+  }
+  sprintf(writer->tempName, "%s.%ld", name, (long)getpid());
+  writer->file = fopen(writer->tempName, "wb");
+  if(!writer->file) {
+    free(writer->tempName);
+    free(name);
+    free(writer);
+    return NULL;
+  }
+  writer->bytesLeft = sound->dataSize;
+  writer->failed = fwrite(&header, sizeof(header), 1, writer->file) != 1;
+  return writer;
+}
+
+void appendCachedSound(cs229CacheWriter_t* writer, sound_t* block) {
+  if(writer->failed) {
+    return;
+  }
+  if(block->dataSize > writer->bytesLeft
+      || fwrite(block->rawData, 1, block->dataSize, writer->file) != block->dataSize) {
+    writer->failed = 1;
+    return;
+  }
+  writer->bytesLeft -= block->dataSize;
+}
+
+void finishCachedSound(cs229CacheWriter_t* writer, char complete) {
+  if(fclose(writer->file) != 0) {
+    writer->failed = 1;
+  }
+  if(complete && !writer->failed && writer->bytesLeft == 0) {
+    if(rename(writer->tempName, writer->name) != 0) {
+      remove(writer->tempName);
+    }
+  }
+  else {
+    remove(writer->tempName);
+  }
+  free(writer->tempName);
+  free(writer->name);
+  free(writer);
+}
+
+void storeCachedSound(FILE* file, sound_t* sound) {
+  cs229CacheWriter_t* writer = beginCachedSound(file, sound);
+  if(!writer) {
+    return;
+  }
+  appendCachedSound(writer, sound);
+  finishCachedSound(writer, 1);
+}
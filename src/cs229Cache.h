@@ -0,0 +1,59 @@
+#ifndef CS229_CACHE_H
+#define CS229_CACHE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "fileTypes.h"
+
+/**
+  A cache file being written one block of samples at a time. Start one with
+  beginCachedSound and end it with finishCachedSound.
+*/
+typedef struct {
+  FILE* file;
+  /* the cache file is written here and renamed to name when finished */
+  char* tempName;
+  char* name;
+  /* bytes of samples the header promises that are not written yet */
+  uint64_t bytesLeft;
+  /* nonzero once a write has failed */
+  char failed;
+} cs229CacheWriter_t;
+
+/**
+  Looks in the directory named by the SOUNDUTILS_CACHE environment variable for
+  the parsed samples of the CS229 file open in file. A cache file only matches
+  if the device, inode, size, and modification time of file are the same as
+  when it was written. On a match, unmaps any mapping of the text in sound,
+  maps the cache file into sound->mappedFile, points rawData at the samples in
+  it, fills in the header fields, and returns 1. Returns 0 and leaves sound
+  alone if caching is off, there is no match, or the cache file's channels, 
+  bit depth, or data size are not ones a CS229 file could have.
+*/
+int loadCachedSound(FILE* file, sound_t* sound);
+
+/**
+  Starts a cache file for the CS229 file open in file, whose header fields and
+  total dataSize are in sound. Returns NULL if caching is off or the cache
+  file cannot be created.
+*/
+cs229CacheWriter_t* beginCachedSound(FILE* file, sound_t* sound);
+
+/**
+  Adds the samples of block, which must still be in CS229 format, to the cache
+  file.
+*/
+void appendCachedSound(cs229CacheWriter_t* writer, sound_t* block);
+
+/**
+  Closes the cache file and frees writer. The cache file is kept for the next
+  loadCachedSound only if complete is nonzero, and deleted otherwise.
+*/
+void finishCachedSound(cs229CacheWriter_t* writer, char complete);
+
+/**
+  Writes a cache file for the whole CS229 sound, read from file, at once.
+*/
+void storeCachedSound(FILE* file, sound_t* sound);
+
+#endif
@@ -4,9 +4,11 @@
 #include "writeError.h"
 #include "fileUtils.h"
 #include "writeError.h"
+#include "workerThreads.h"
 #include <string.h>
 #include <stdlib.h>
 #include <limits.h>
+#include <stdint.h>
 
 typedef enum {
   KEYWORD_SAMPLES,
@@ -26,26 +28,202 @@ typedef enum {
   CS229_ERROR_INVALID_DATA,
   CS229_ERROR_READING,
   CS229_ERROR_NOT_ENOUGH_DATA,
-  CS229_ERROR_TOO_MUCH_DATA
+  CS229_ERROR_TOO_MUCH_DATA,
+  CS229_ERROR_MEMORY,
+  /* only whitespace on the line, which is skipped */
+  CS229_BLANK_LINE
 } cs229ReadStatus_t;
 
+/* samples parsed at a time when counting samples we do not keep */
+#define CS229_COUNT_BLOCK_SAMPLES 4096
+
+/* bytes of sample lines formatted before each write */
+#define CS229_WRITE_BUFFER_SIZE 65536
+
+/* bytes of sample text each thread must get before parsing is split up */
+#define CS229_PARALLEL_MIN_BYTES 262144
+
+/* samples cs229Read makes room for first when the header has no Samples */
+#define CS229_INITIAL_SAMPLES 4096
+
+/* values each thread must get before parsing or formatting is split up */
+#define CS229_PARALLEL_MIN_VALUES 32768
+
+/* most bytes of sample lines each thread formats before they are written */
+#define CS229_PARALLEL_WRITE_SIZE 1048576
+
 typedef struct {
   void* data;
-  unsigned long numSamples;
+  uint64_t numSamples;
   unsigned short sampleRate;
   unsigned char numChannels;
   unsigned char bitres;
+  /* nonzero when the header gave the optional Samples keyword */
+  char hasNumSamples;
 } cs229Data_t;
+
+/**
+  A run of whole sample lines parsed by one thread, and how parsing it went.
+*/
+typedef struct {
+  char* text;
+  size_t length;
+  /* index of the first sample of the range in the whole sound */
+  uint64_t firstSample;
+  uint64_t numSamples;
+  /* samples parsed before status stopped the range */
+  uint64_t samplesRead;
+  cs229ReadStatus_t status;
+} cs229Range_t;
+
+/**
+  Shared by the workers that format one round of sample lines. Worker i 
+  formats samplesPerWorker samples from firstSample + i * samplesPerWorker, 
+  stopping at endSample, into buffers[i] and puts their length in lengths[i].
+  The samples are only read through samples, which is made before the 
+  workers start.
+*/
+typedef struct {
+  sampleBuffer_t samples;
+  unsigned short numChannels;
+  char** buffers;
+  size_t* lengths;
+  uint64_t firstSample;
+  uint64_t samplesPerWorker;
+  uint64_t endSample;
+} cs229FormatJob_t;
+
+/**
+  Shared by the workers that count or parse the ranges of cs229Range_t.
+*/
+typedef struct {
+  cs229Data_t* cd;
+  cs229Range_t* ranges;
+} cs229ParseJob_t;
    
 
+/**
+  Reads the header up to and including "StartData" into cd and checks that it
+  describes a sound we can read. Returns the readError_t describing any problem.
+  Precondition: reader directly after "CS229" header
+  Postcondition: reader directly before the first sample
+*/
+readError_t cs229ReadHeader(cs229Data_t* cd, fileReader_t* reader);
+
+/**
+  Counts the samples remaining in reader without keeping them, by parsing them
+  block by block into cd->data, which must hold CS229_COUNT_BLOCK_SAMPLES 
+  samples. Puts the count in cd->numSamples and returns the status of the last
+  read.
+  Precondition: reader directly before the first sample
+  Postcondition: reader at end of file or at the first bad sample
+*/
+cs229ReadStatus_t cs229CountSamples(cs229Data_t* cd, fileReader_t* reader);
+
 /**
   Reads the samples from the startdata up to sampleLimit samples. Reads samples
   into the given cs229Data_t. Appropriate cs229ReadStatus_t is returned and 
   samplesFilled is modified to tell how many samples we read.
-  Precondition: file pointer directly before a sample
-  Postcondition: file pointer directly after a sample
+  Precondition: reader directly before a sample
+  Postcondition: reader directly after a sample
+*/
+cs229ReadStatus_t readSamples(cs229Data_t* cd, uint64_t sampleLimit, uint64_t* samplesFilled, fileReader_t* reader); 
+
+/**
+  Reads the rest of reader after the number of samples given by the Samples
+  keyword. Returns CS229_DONE_READING if only blank lines are left and 
+  CS229_ERROR_TOO_MUCH_DATA if there is another sample.
+*/
+cs229ReadStatus_t readPastLastSample(fileReader_t* reader);
+
+/**
+  Returns CS229_ERROR_EOF if length bytes of sample text are too few to hold 
+  the cd->numSamples samples the header promised, and CS229_NO_ERROR 
+  otherwise. Every value takes at least a digit and the space or newline after
+  it, so this is checked before the samples are allocated.
+*/
+cs229ReadStatus_t checkSampleTextLength(cs229Data_t* cd, uint64_t length);
+
+/**
+  Parses the next line of reader as one sample into cd->data at index, skipping
+  lines that are blank. Returns CS229_DONE_READING at the end of the file.
+*/
+cs229ReadStatus_t readSample(cs229Data_t* cd, uint64_t index, fileReader_t* reader);
+
+/**
+  Decodes one sample line of length characters, which holds numChannels 
+  integers separated by spaces or tabs and may end in a carriage return, into
+  cd->data at index. Each value is checked against the range of cd->bitres as
+  it is parsed. Returns CS229_BLANK_LINE if the line holds only whitespace.
 */
-cs229ReadStatus_t readSamples(cs229Data_t* cd, int sampleLimit, int* samplesFilled, FILE* fp); 
+cs229ReadStatus_t decodeSampleLine(cs229Data_t* cd, uint64_t index, char* line, size_t length);
+
+/**
+  Returns nonzero if the line of length characters holds only spaces and tabs
+  and an optional final carriage return, which decodeSampleLine skips.
+*/
+char isBlankLine(char* line, size_t length);
+
+/**
+  Counts the lines of text that are not blank.
+*/
+uint64_t countSampleLines(char* text, size_t length);
+
+/**
+  Splits length characters of text into numRanges ranges of about the same 
+  size which each end after a newline, then counts the sample lines of every
+  range in parallel. Fills in each range but its samplesRead and status, and
+  returns the number of sample lines in all of them.
+*/
+uint64_t splitSampleText(char* text, size_t length, cs229Range_t* ranges, unsigned int numRanges);
+
+/**
+  Splits the first numSamples sample lines of text into numRanges ranges with
+  about the same number of lines. Fills in each range but its samplesRead and 
+  status, and returns the number of characters the lines take up, which is 
+  all of text if it has fewer than numSamples lines.
+*/
+size_t splitSampleLines(char* text, size_t length, uint64_t numSamples, cs229Range_t* ranges, unsigned int numRanges);
+
+/**
+  Parses every range into cd->data on its own thread, each from its 
+  firstSample on. Puts the number of samples read before the first error in 
+  samplesRead and returns the status of the first range that failed, so an 
+  error is reported for the lowest line it is on, or CS229_DONE_READING.
+*/
+cs229ReadStatus_t parseSampleRanges(cs229Data_t* cd, cs229Range_t* ranges, unsigned int numRanges, uint64_t* samplesRead);
+
+/**
+  Parses length characters of sample text on numWorkers threads into 
+  cd->data, which is allocated to fit once the lines are counted, or to fit
+  cd->numSamples when the header gave it. Lines past that many are an error 
+  rather than being parsed, and fewer lines are an early end of file. Puts the
+  number of samples read before the first error in samplesRead.
+*/
+cs229ReadStatus_t parseSampleText(cs229Data_t* cd, char* text, size_t length, unsigned int numWorkers, uint64_t* samplesRead);
+
+/**
+  Writes the sample lines of sound, whose samples are in samples, to fp like
+  writeCs229Samples, but formats them on numWorkers threads at a time in 
+  rounds, each thread into its own buffer, and writes the buffers in order 
+  after every round.
+*/
+writeError_t writeCs229SamplesInParallel(sound_t* sound, sampleBuffer_t* samples, FILE* fp, unsigned int numWorkers);
+
+/**
+  workerFunction_t that formats one worker's share of a cs229FormatJob_t.
+*/
+void formatRangeWorker(unsigned int index, unsigned int numWorkers, void* job);
+
+/**
+  workerFunction_t that counts the sample lines of one cs229Range_t.
+*/
+void countRangeWorker(unsigned int index, unsigned int numWorkers, void* job);
+
+/**
+  workerFunction_t that parses the sample lines of one cs229Range_t.
+*/
+void parseRangeWorker(unsigned int index, unsigned int numWorkers, void* job);
 
 /**
   Reads "keyword[whitespace]value" and places null-terminated keyword and value 
@@ -53,22 +231,22 @@ cs229ReadStatus_t readSamples(cs229Data_t* cd, int sampleLimit, int* samplesFill
   chars into keyword, and valueLen-1 chars into value. If we can't find a value 
   or keyword, or if they are longer than the given "Len"gth, first character is 
   a null terminator. Returns readError_t indicating any errors that occurred.
-  Precondition: file pointer is at the beginning of line
-  Postcondition: file pointer is at beginning of next line
+  Precondition: reader is at the beginning of line
+  Postcondition: reader is at beginning of next line
 */
-readError_t getKeywordValue(char* keyword, size_t keywordLen, char* value, size_t valueLen, FILE* fp);
+readError_t getKeywordValue(char* keyword, size_t keywordLen, char* value, size_t valueLen, fileReader_t* reader);
 
 /** 
-  Reads characters from file into str until we get to a whitespace character. One 
-  whitespace character is read from file and included in str after returning.
+  Reads characters from reader into str until we get to a whitespace character. 
+  One whitespace character is read and included in str after returning.
 */
-readError_t readUntilWhitespace(char* str, size_t n, FILE* file);
+readError_t readUntilWhitespace(char* str, size_t n, fileReader_t* reader);
 
 /**
   Read until we encounter a character that is not a tab or space. New lines are
   NOT whitespace and will cause this method to return.
 */
-readError_t readUntilNonWhitespace(char* nonWhite, FILE* fp);
+readError_t readUntilNonWhitespace(char* nonWhite, fileReader_t* reader);
 
 /**
   Stores the keyword/value pair of char* in the given cs229Data_t. Returns the 
@@ -84,10 +262,16 @@ keyword_t storeKeywordValue(char* keyword, char* value, cs229Data_t* cd);
 keyword_t strToKeyword(char* str);
 
 /**
-  Gets the keyword and value from fp and puts it into the given cs229Data_t, 
-  then returns the keyword that we filled in.
+  Gets the keyword and value from reader and puts it into the given 
+  cs229Data_t, then returns the keyword that we filled in.
+*/
+keyword_t readKeywordValue(cs229Data_t* cd, fileReader_t* reader);
+
+/**
+  Creates the reader cs229Read parses from. Scans the mapped file directly when
+  sound->mappedFile is set, otherwise reads fp through a buffer.
 */
-keyword_t readKeywordValue(cs229Data_t* cd, FILE* fp);
+fileReader_t* createCs229Reader(FILE* fp, sound_t* sound);
 
 /**
   Translates cd over to sound
@@ -102,13 +286,28 @@ readError_t cs229ReadStatusToReadError(cs229ReadStatus_t status);
 /**
   Calculates the data size from numsamples, numchannels, and bitdepth
 */
-unsigned int calculateDataSize(cs229Data_t* cd);
+uint64_t calculateDataSize(cs229Data_t* cd);
+
+/**
+  Returns the most characters a line of sample data from sound can take: the 
+  longest value for its bitDepth plus a space for each channel, and a newline.
+*/
+int getMaxCharsPerSample(sound_t* sound);
+
+/**
+  Writes value in decimal, with a leading '-' when negative, to str without a
+  null terminator. Returns the number of characters written, at most 11.
+*/
+int formatSampleValue(char* str, long value);
 
 /**
-  Takes a 2d array of singleSamples and concatenates them together into result.
-  Result will be the sampleData as defined by the CS229 spec under "StartData".
+  Formats numSamples samples of numChannels values in samples, starting at 
+  firstSample, as the lines of sample data defined by the CS229 spec under 
+  "StartData". str must have room for numSamples * getMaxCharsPerSample 
+  characters and is not null terminated. Returns the number of characters 
+  written.
 */
-int makeSampleString(char* result, char** singleSamples, sound_t* sound);
+size_t formatSampleLines(sampleBuffer_t* samples, unsigned short numChannels, uint64_t firstSample, uint64_t numSamples, char* str);
 
 /**
   Convert the first num characters in p to lowercase.
@@ -119,69 +318,286 @@ void toLowerCase(char* p, size_t num) {
 
 void cs229Read(FILE* fp, sound_t* sound) {
   cs229Data_t* cData = malloc(sizeof(cs229Data_t));
-  keyword_t keyword;
+  fileReader_t* reader = createCs229Reader(fp, sound);
   cs229ReadStatus_t sampleReadStatus = CS229_NO_ERROR;
-  long bytesAvailable = 16;
-  long bytesUsed = 0;
-  int samplesRead = 0;
+  uint64_t bytesAvailable = 0;
+  uint64_t bytesUsed = 0;
+  uint64_t samplesRead = 0;
+  uint64_t textLength;
   void* newData = NULL;
 
-  /*ignore newline after "CS229" header */
-  sound->error = ignoreLine(fp);
-  if(sound->error != NO_ERROR) return;
+  if(!cData || !reader) {
+    sound->error = ERROR_MEMORY;
+    free(cData);
+    if(reader) destroyFileReader(reader);
+    return;
+  }
 
-  keyword = readKeywordValue(cData, fp);
-  while(keyword != KEYWORD_STARTDATA) {
-    if(keyword == KEYWORD_ERROR) {
-      sound->error = ERROR_INVALID_KEYWORD;
-      return;
+  sound->error = cs229ReadHeader(cData, reader);
+  if(sound->error != NO_ERROR) {
+    free(cData);
+    destroyFileReader(reader);
+    return;
+  }
+
+  if(!reader->file) {
+    /* the whole sample section is in memory, so threads can share it */
+    size_t textLength = reader->length - reader->position;
+    unsigned int numWorkers = getNumWorkerThreads();
+    if(numWorkers > textLength / CS229_PARALLEL_MIN_BYTES) {
+      numWorkers = textLength / CS229_PARALLEL_MIN_BYTES;
     }
-    if(keyword == KEYWORD_BADVALUE) {
-      sound->error = ERROR_NO_VALUE;
-      return;
+    if(numWorkers > 1) {
+      sampleReadStatus = parseSampleText(cData, &reader->buffer[reader->position], textLength, numWorkers, &samplesRead);
+      if(sampleReadStatus == CS229_ERROR_MEMORY) {
+        sound->error = ERROR_MEMORY;
+        free(cData);
+        destroyFileReader(reader);
+        return;
+      }
     }
-    keyword = readKeywordValue(cData, fp);
   }
-  if(cData->bitres != 8 && cData->bitres != 16 && cData->bitres != 32) {
-    sound->error = ERROR_BIT_DEPTH;
-    return;
+
+  if(cData->hasNumSamples && sampleReadStatus == CS229_NO_ERROR
+    && readerBytesLeft(reader, &textLength) == NO_ERROR) {
+    /* the rest of the file bounds the count, so fill the samples in place */
+    sampleReadStatus = checkSampleTextLength(cData, textLength);
+    if(sampleReadStatus == CS229_NO_ERROR) {
+      bytesAvailable = cData->numSamples * cData->numChannels * cData->bitres / 8;
+      cData->data = malloc(bytesAvailable);
+      if(!cData->data && bytesAvailable > 0) {
+        sound->error = ERROR_MEMORY;
+        free(cData);
+        destroyFileReader(reader);
+        return;
+      }
+      sampleReadStatus = readSamples(cData, cData->numSamples, &samplesRead, reader);
+    }
+    if(sampleReadStatus == CS229_NO_ERROR) {
+      sampleReadStatus = readPastLastSample(reader);
+    }
+    else if(sampleReadStatus == CS229_DONE_READING) {
+      sampleReadStatus = CS229_ERROR_EOF;
+    }
+  }
+  else if(sampleReadStatus == CS229_NO_ERROR) {
+    bytesAvailable = CS229_INITIAL_SAMPLES * cData->numChannels * cData->bitres / 8;
   }
 
-  cData->data = NULL;
-  do {
+  /* without a sample count, or from a pipe that cannot vouch for one, grow by
+     half each time so at most a third is unused before the final realloc */
+  while(sampleReadStatus == CS229_NO_ERROR) {
     int bytesPerSample = cData->numChannels * cData->bitres / 8;
-    int sampleLimit;
-    bytesAvailable *= 2;
-    if(bytesPerSample == 0) {
-      /* to prevent divide by zero error */
-      sound->error = ERROR_ZERO_CHANNELS;
-      break;
+    uint64_t sampleLimit;
+    if(cData->hasNumSamples && samplesRead == cData->numSamples) {
+      sampleReadStatus = readPastLastSample(reader);
+      continue;
     }
+    bytesAvailable += bytesAvailable / 2;
     sampleLimit = bytesAvailable / bytesPerSample;
+    if(cData->hasNumSamples && sampleLimit > cData->numSamples) {
+      sampleLimit = cData->numSamples;
+      bytesAvailable = sampleLimit * bytesPerSample;
+    }
     newData = realloc(cData->data, bytesAvailable);
     if(!newData) {
       sound->error = ERROR_MEMORY;
+      free(cData->data);
       free(cData);
+      destroyFileReader(reader);
       return;
     }
     cData->data = newData;
-    sampleReadStatus = readSamples(cData, sampleLimit, &samplesRead, fp);
-  } while(sampleReadStatus == CS229_NO_ERROR && sound->error == NO_ERROR);
+    sampleReadStatus = readSamples(cData, sampleLimit, &samplesRead, reader);
+    if(cData->hasNumSamples && sampleReadStatus == CS229_DONE_READING) {
+      /* the pipe ended before the samples its header promised */
+      sampleReadStatus = CS229_ERROR_EOF;
+    }
+  }
+  destroyFileReader(reader);
   cData->numSamples = samplesRead;
   bytesUsed = samplesRead * cData->numChannels * cData->bitres / 8;
-  /* reallocate to fix overestimation of data size from do/while loop */
-  newData = realloc(cData->data, bytesUsed);
-  if(!newData && bytesUsed > 0) {
+  if(bytesUsed < bytesAvailable) {
+    /* give back the room that was never filled */
+    newData = realloc(cData->data, bytesUsed);
+    if(!newData && bytesUsed > 0) {
+      sound->error = ERROR_MEMORY;
+      free(cData->data);
+      free(cData);
+      return;
+    }
+    cData->data = newData;
+  }
+
+  cs229ToSound(cData, sound, sampleReadStatus);
+  free(cData);
+}
+
+fileReader_t* cs229OpenStream(FILE* fp, sound_t* sound) {
+  cs229Data_t cData;
+  cs229ReadStatus_t status = CS229_DONE_READING;
+  long samplesStart;
+  fileReader_t* reader = createCs229Reader(fp, sound);
+  if(!reader) {
+    sound->error = ERROR_MEMORY;
+    return NULL;
+  }
+  sound->error = cs229ReadHeader(&cData, reader);
+  if(sound->error == NO_ERROR && !cData.hasNumSamples) {
+    /* count the samples so the stream knows its length, then come back */
+    samplesStart = readerTell(reader);
+    if(samplesStart < 0) {
+      sound->error = readerSpool(reader);
+      samplesStart = 0;
+    }
+    if(sound->error == NO_ERROR) {
+      cData.data = malloc(CS229_COUNT_BLOCK_SAMPLES * cData.numChannels * cData.bitres / 8);
+      if(!cData.data) {
+        sound->error = ERROR_MEMORY;
+      }
+    }
+    if(sound->error == NO_ERROR) {
+      status = cs229CountSamples(&cData, reader);
+      free(cData.data);
+      cData.data = NULL;
+      sound->error = cs229ReadStatusToReadError(status);
+    }
+    if(sound->error == NO_ERROR) {
+      sound->error = readerSeek(reader, samplesStart);
+    }
+  }
+  if(sound->error != NO_ERROR) {
+    destroyFileReader(reader);
+    return NULL;
+  }
+  cs229ToSound(&cData, sound, status);
+  return reader;
+}
+
+readError_t cs229ReadBlock(fileReader_t* reader, sound_t* block, uint64_t numSamples) {
+  cs229Data_t cData;
+  cs229ReadStatus_t status;
+  uint64_t samplesRead = 0;
+  unsigned int numWorkers = getNumWorkerThreads();
+  cData.data = block->rawData;
+  cData.numChannels = block->numChannels;
+  cData.bitres = block->bitDepth;
+  if(numWorkers > numSamples * cData.numChannels / CS229_PARALLEL_MIN_VALUES) {
+    numWorkers = numSamples * cData.numChannels / CS229_PARALLEL_MIN_VALUES;
+  }
+  if(!reader->file && numWorkers > 1) {
+    cs229Range_t ranges[MAX_WORKER_THREADS];
+    size_t used = splitSampleLines(&reader->buffer[reader->position], reader->length - reader->position, numSamples, ranges, numWorkers);
+    status = parseSampleRanges(&cData, ranges, numWorkers, &samplesRead);
+    readerAdvance(reader, used);
+  }
+  else {
+    status = readSamples(&cData, numSamples, &samplesRead, reader);
+  }
+  if(samplesRead < numSamples && status != CS229_DONE_READING) {
+    return cs229ReadStatusToReadError(status);
+  }
+  if(samplesRead < numSamples) {
+    /* the file had fewer samples than its header promised */
+    return ERROR_EOF;
+  }
+  return NO_ERROR;
+}
+
+void cs229Probe(FILE* fp, sound_t* sound) {
+  cs229Data_t* cData = malloc(sizeof(cs229Data_t));
+  fileReader_t* reader = createFileReader(fp);
+  cs229ReadStatus_t status = CS229_DONE_READING;
+  if(!cData || !reader) {
     sound->error = ERROR_MEMORY;
     free(cData);
+    if(reader) destroyFileReader(reader);
     return;
   }
-  cData->data = newData;
-      
-  cs229ToSound(cData, sound, sampleReadStatus);
+  sound->error = cs229ReadHeader(cData, reader);
+  if(sound->error == NO_ERROR && !cData->hasNumSamples) {
+    cData->data = malloc(CS229_COUNT_BLOCK_SAMPLES * cData->numChannels * cData->bitres / 8);
+    if(!cData->data) {
+      sound->error = ERROR_MEMORY;
+    }
+    else {
+      status = cs229CountSamples(cData, reader);
+      free(cData->data);
+      cData->data = NULL;
+    }
+  }
+  destroyFileReader(reader);
+  if(sound->error == NO_ERROR) {
+    cs229ToSound(cData, sound, status);
+  }
   free(cData);
 }
 
+readError_t cs229ReadHeader(cs229Data_t* cd, fileReader_t* reader) {
+  keyword_t keyword = KEYWORD_COMMENT;
+  readError_t error;
+  cd->data = NULL;
+  cd->numSamples = 0;
+  cd->sampleRate = 0;
+  cd->numChannels = 0;
+  cd->bitres = 0;
+  cd->hasNumSamples = 0;
+
+  /*ignore newline after "CS229" header */
+  error = ignoreLine(reader);
+  while(error == NO_ERROR && keyword != KEYWORD_STARTDATA) {
+    keyword = readKeywordValue(cd, reader);
+    if(keyword == KEYWORD_ERROR) {
+      error = ERROR_INVALID_KEYWORD;
+    }
+    else if(keyword == KEYWORD_BADVALUE) {
+      error = ERROR_NO_VALUE;
+    }
+    else if(keyword == KEYWORD_SAMPLES) {
+      cd->hasNumSamples = 1;
+    }
+  }
+  if(error != NO_ERROR) {
+    return error;
+  }
+  if(cd->bitres != 8 && cd->bitres != 16 && cd->bitres != 24 && cd->bitres != 32) {
+    return ERROR_BIT_DEPTH;
+  }
+  if(cd->numChannels == 0) {
+    /* to prevent divide by zero error */
+    return ERROR_ZERO_CHANNELS;
+  }
+  if(cd->numSamples > SIZE_MAX / (cd->numChannels * cd->bitres / 8)) {
+    /* the samples could not be held in memory, or even have their size counted */
+    return ERROR_NO_VALUE;
+  }
+  return NO_ERROR;
+}
+
+cs229ReadStatus_t cs229CountSamples(cs229Data_t* cd, fileReader_t* reader) {
+  uint64_t samplesRead;
+  cs229ReadStatus_t status = CS229_NO_ERROR;
+  cd->numSamples = 0;
+  while(status == CS229_NO_ERROR) {
+    samplesRead = 0;
+    status = readSamples(cd, CS229_COUNT_BLOCK_SAMPLES, &samplesRead, reader);
+    cd->numSamples += samplesRead;
+  }
+  return status;
+}
+
+fileReader_t* createCs229Reader(FILE* fp, sound_t* sound) {
+  long offset;
+  if(!sound->mappedFile) {
+    return createFileReader(fp);
+  }
+  offset = ftell(fp);
+  if(offset < 0 || (size_t)offset > sound->mappedFileSize) {
+    return createFileReader(fp);
+  }
+  return createMemoryReader((char*)sound->mappedFile + offset, sound->mappedFileSize - offset);
+}
+
 void cs229ToSound(cs229Data_t* cd, sound_t* sound, cs229ReadStatus_t status) {
   sound->sampleRate = cd->sampleRate;
   sound->numChannels = cd->numChannels;
@@ -208,6 +624,9 @@ readError_t cs229ReadStatusToReadError(cs229ReadStatus_t status) {
   else if(status == CS229_ERROR_READING) {
     return ERROR_READING;
   }
+  else if(status == CS229_ERROR_MEMORY) {
+    return ERROR_MEMORY;
+  }
   else {
     fprintf(stderr, "Unhandled cs229ReadStatus_t enum value\n");
     return ERROR_READING;
@@ -216,27 +635,9 @@ readError_t cs229ReadStatusToReadError(cs229ReadStatus_t status) {
 
 
 
-unsigned int calculateDataSize(cs229Data_t* cd) {
+uint64_t calculateDataSize(cs229Data_t* cd) {
   if(cd->numChannels == 0 || cd->bitres == 0) return 0;
-  return (unsigned int)cd->numSamples * (unsigned int)cd->numChannels * (unsigned int)cd->bitres / 8;
-}
-
-int longToShort(long makeMeAShort) {
-  if(makeMeAShort < SHRT_MIN
-    || makeMeAShort > SHRT_MAX) {
-    printf("%ld is out of int range\n", makeMeAShort); 
-    return !makeMeAShort;
-  }
-  return (int)makeMeAShort;
-}
-
-signed char longToChar(long makeMeAChar) {
-  if(makeMeAChar < SCHAR_MIN
-    || makeMeAChar > SCHAR_MAX) {
-    printf("%ld is out of char range\n", makeMeAChar);
-    return !makeMeAChar;
-  }
-  return (char)makeMeAChar;
+  return cd->numSamples * cd->numChannels * cd->bitres / 8;
 }
 
 unsigned int longToUShort(unsigned long makeMeAUShort) {
@@ -258,8 +659,8 @@ unsigned char longToUChar(unsigned long makeMeAUChar) {
 keyword_t storeKeywordValue(char* keywordStr, char* valueStr, cs229Data_t* cd) {
   keyword_t kw;
   char* afterNumber;
-  unsigned long val;
-  unsigned int samples, sampleRate;
+  unsigned long long val;
+  unsigned int sampleRate;
   unsigned char channels, bitres;
 
   kw = strToKeyword(keywordStr);
@@ -267,16 +668,16 @@ keyword_t storeKeywordValue(char* keywordStr, char* valueStr, cs229Data_t* cd) {
     /* don't try to read value for startdata or comment, there isn't one! */
     return kw;
   }
-  val = strtol(valueStr, &afterNumber, 10);
+  val = strtoull(valueStr, &afterNumber, 10);
   if(valueStr[0] == '\0' || afterNumber[0] != '\0') {
     /* not a valid number */
     return KEYWORD_BADVALUE;
   }
   switch(kw) {
     case KEYWORD_SAMPLES:
-      samples = val;
-      if(val != samples) return KEYWORD_BADVALUE;
-      cd->numSamples = samples;
+      /* strtoull wraps negative values around instead of failing */
+      if(valueStr[0] == '-' || val == ULLONG_MAX) return KEYWORD_BADVALUE;
+      cd->numSamples = val;
       break;
     case KEYWORD_CHANNELS:
       channels = longToUChar(val);
@@ -299,16 +700,16 @@ keyword_t storeKeywordValue(char* keywordStr, char* valueStr, cs229Data_t* cd) {
   return kw;
 }
 
-keyword_t readKeywordValue(cs229Data_t* cd, FILE* fp) {
+keyword_t readKeywordValue(cs229Data_t* cd, fileReader_t* reader) {
   /* keyword is 12 bytes to hold largest keyword: "samplerate"(10), plus an 
   invalid character to ensure valid keyword, and finaly a null 
   terminator */
   char keywordStr[12];
-  /* value is 13 bytes to hold "-2147483647"(11), plus invalid character to 
-  ensure valid value, plus a null terminator */
-  char valueStr[13];
+  /* value is 22 bytes to hold "18446744073709551615"(20), plus invalid 
+  character to ensure valid value, plus a null terminator */
+  char valueStr[22];
   keyword_t kw;
-  readError_t error = getKeywordValue(keywordStr, 12, valueStr, 13, fp);
+  readError_t error = getKeywordValue(keywordStr, 12, valueStr, 22, reader);
   if(error != NO_ERROR) {
     return KEYWORD_ERROR;
   }
@@ -341,7 +742,7 @@ keyword_t strToKeyword(char* str) {
   }
 }
 
-readError_t getKeywordValue(char* keyword, size_t keywordLen, char* value, size_t valueLen, FILE* fp) {
+readError_t getKeywordValue(char* keyword, size_t keywordLen, char* value, size_t valueLen, fileReader_t* reader) {
   /* 
   1. copy characters until first whitespace
   2. store copied chars into keyword
@@ -351,7 +752,7 @@ readError_t getKeywordValue(char* keyword, size_t keywordLen, char* value, size_
   */
   size_t length;
   char finalChar, firstValueChar;
-  readError_t error = readUntilWhitespace(keyword, keywordLen, fp);
+  readError_t error = readUntilWhitespace(keyword, keywordLen, reader);
   if(error != NO_ERROR) {
     return error;
   }
@@ -380,14 +781,14 @@ readError_t getKeywordValue(char* keyword, size_t keywordLen, char* value, size_
   else if( ((finalChar == ' ' || finalChar == '\t') && length == 1) || keyword[0] == '#') {
     /* line started with whitespace or began with a #, also regard as comment */
     keyword[0] = '#';
-    error = ignoreLine(fp);
+    error = ignoreLine(reader);
     if(error != NO_ERROR) {
       return error;
     }
     return NO_ERROR;
   }
 
-  error = readUntilNonWhitespace(&firstValueChar, fp);
+  error = readUntilNonWhitespace(&firstValueChar, reader);
   if(error != NO_ERROR) {
     return error;
   }
@@ -398,7 +799,7 @@ readError_t getKeywordValue(char* keyword, size_t keywordLen, char* value, size_
   }
   value[0] = firstValueChar;
   /* already read first character of value */
-  error = readUntilWhitespace(&value[1], valueLen - 1, fp);
+  error = readUntilWhitespace(&value[1], valueLen - 1, reader);
   if(error != NO_ERROR) {
     return error;
   }
@@ -410,7 +811,7 @@ readError_t getKeywordValue(char* keyword, size_t keywordLen, char* value, size_
     return NO_ERROR;
   }
   if(finalChar != '\n') {
-    error = ignoreLine(fp);
+    error = ignoreLine(reader);
     if(error != NO_ERROR) {
       return error;
     }
@@ -422,9 +823,9 @@ readError_t getKeywordValue(char* keyword, size_t keywordLen, char* value, size_
   return NO_ERROR;
 }
 
-readError_t readUntilNonWhitespace(char* nonWhite, FILE* fp) {
+readError_t readUntilNonWhitespace(char* nonWhite, fileReader_t* reader) {
   do {
-    readError_t error = readBytes(nonWhite, 1, fp);
+    readError_t error = readerNextChar(reader, nonWhite);
     if(error != NO_ERROR) {
       return error;
     }
@@ -437,113 +838,266 @@ readError_t readUntilNonWhitespace(char* nonWhite, FILE* fp) {
   with a null terminator. When a read error occurs, adds null terminator and 
   returns readError_t early.
 */
-readError_t readUntilWhitespace(char* str, size_t n, FILE* file) {
-  char byte;
-  int i = 0;
-  readError_t readError = NO_ERROR;
-  do {
-    readError = readBytes(&byte, 1, file);
-    if(readError != NO_ERROR) {
-      str[i] = 0;
-      return readError;
-    }
-    str[i++] = byte;
-  } while(byte != '\t' && byte != ' ' && byte != '\n' && i < n - 1);
-  str[i] = 0;
-  return NO_ERROR;
+readError_t readUntilWhitespace(char* str, size_t n, fileReader_t* reader) {
+  return readerCopyUntil(reader, str, n, " \t\n");
 }
 
-/* TODO: go through this method with paper and pencil and clean it */
-cs229ReadStatus_t readSample(cs229Data_t* cd, int index, FILE* fp) {
-  int i;
+cs229ReadStatus_t readSample(cs229Data_t* cd, uint64_t index, fileReader_t* reader) {
+  char* line;
+  size_t length;
   readError_t error;
-  /* to hold "-2147483647"(11), + additional char to ensure validity, + '\0' */
-  char dataStr[13], length, valChar, *afterNumber; 
-  unsigned char lastChar;
-  short valShort;
-  long valLong;
-
-  char* dataChars;
-  short* dataShorts;
-  long* dataLongs;
-
-  lastChar = 0;
-
-  for(i = 0; i < (cd->numChannels); i++) {
-    /* to reach the next sample data */
-    error = readUntilNonWhitespace(&dataStr[0], fp);
-    error = readUntilWhitespace(&dataStr[1], 12, fp);
+  cs229ReadStatus_t status;
+  do {
+    error = readerGetLine(reader, &line, &length);
     if(error == ERROR_EOF) {
       return CS229_DONE_READING;
     }
-    if(error == ERROR_READING) {
+    if(error != NO_ERROR) {
       return CS229_ERROR_READING;
     }
-    length = strlen(dataStr);
-    lastChar = dataStr[length-1];
-    if(lastChar != ' ' && lastChar != '\t' && lastChar != '\n') {
-      return CS229_ERROR_INVALID_DATA;
+    status = decodeSampleLine(cd, index, line, length);
+  } while(status == CS229_BLANK_LINE);
+  return status;
+}
+
+cs229ReadStatus_t decodeSampleLine(cs229Data_t* cd, uint64_t index, char* line, size_t length) {
+  int i;
+  char* end = line + length;
+  /* largest magnitude allowed for a negative value, positive ones are 1 less */
+  unsigned long maxMagnitude = 1UL << (cd->bitres - 1);
+  int8_t* dataChars = (int8_t*)cd->data;
+  int16_t* dataShorts = (int16_t*)cd->data;
+  unsigned char* dataBytes = (unsigned char*)cd->data;
+  int32_t* dataInts = (int32_t*)cd->data;
+  int32_t value;
+
+  if(end > line && end[-1] == '\r') {
+    /* DOS line ending */
+    --end;
+  }
+  for(i = 0; i < cd->numChannels; i++) {
+    unsigned long magnitude = 0;
+    char negative = 0;
+    char* digits;
+    while(line < end && (*line == ' ' || *line == '\t')) {
+      ++line;
     }
-    if(lastChar == '\n' && i != cd->numChannels - 1) {
-      /* premature newline */
-      return CS229_ERROR_NOT_ENOUGH_DATA;
+    if(line == end) {
+      return i == 0 ? CS229_BLANK_LINE : CS229_ERROR_NOT_ENOUGH_DATA;
     }
-    else if(lastChar != '\n' && lastChar != '\t' && lastChar != ' '  && i == cd->numChannels - 1) {
-      /* late newline */
-      return CS229_ERROR_TOO_MUCH_DATA;
+    if(*line == '-' || *line == '+') {
+      negative = *line == '-';
+      ++line;
+    }
+    digits = line;
+    while(line < end && (unsigned char)(*line - '0') < 10) {
+      unsigned int digit = *line - '0';
+      if(magnitude > (maxMagnitude - digit) / 10) {
+        return CS229_ERROR_INVALID_DATA;
+      }
+      magnitude = magnitude * 10 + digit;
+      ++line;
     }
-    dataStr[length-1] = 0;
-    if(length > 2 && dataStr[length-2] == '\r') { 
-      dataStr[length-2] = 0;
+    if(line == digits || (line < end && *line != ' ' && *line != '\t')) {
+      /* not a number */
+      return CS229_ERROR_INVALID_DATA;
     }
-
-    valLong = strtol(dataStr, &afterNumber, 10);
-    if(dataStr[0] == '\0' || afterNumber[0] != '\0') {
-      /* not a valid number */
+    if(!negative && magnitude == maxMagnitude) {
       return CS229_ERROR_INVALID_DATA;
     }
+    /* checked against bitres above, so it fits */
+    value = negative ? -(int64_t)magnitude : (int64_t)magnitude;
+    /* stored as parsed, this runs for every value of a file */
     switch(cd->bitres) {
       case 8:
-        dataChars = (char*)cd->data;
-        valChar = longToChar(valLong);
-        if(valChar != valLong) return CS229_ERROR_INVALID_DATA;
-        dataChars[index + i] = valChar;
+        dataChars[index + i] = value;
         break;
       case 16:
-        dataShorts = (short*)cd->data;
-        valShort = longToShort(valLong);
-        if(valShort != longToShort(valLong)) return CS229_ERROR_INVALID_DATA;
-        dataShorts[index + i] = valShort;
+        dataShorts[index + i] = value;
+        break;
+      case 24:
+        packSamples24(&value, &dataBytes[(index + i) * 3], 1);
         break;
       case 32:
-        dataLongs = (long*)cd->data;
-        dataLongs[index + i] = valLong;
+        dataInts[index + i] = value;
         break;
       default:
         /* we should have caught invalid bitres before calling this function */
         return CS229_ERROR_INVALID_DATA;
     }
   }
-  if(lastChar != '\n') {
-    error = ignoreLine(fp);
+  while(line < end && (*line == ' ' || *line == '\t')) {
+    ++line;
   }
-  if(error == ERROR_EOF) {
-    /* eof error is OK, we just handled the final sample*/
-    return CS229_DONE_READING;
-  }
-  if(error != NO_ERROR) {
-    return CS229_ERROR_READING;
+  if(line != end) {
+    return CS229_ERROR_TOO_MUCH_DATA;
   }
   return CS229_NO_ERROR;
 }
 
+char isBlankLine(char* line, size_t length) {
+  size_t i;
+  for(i = 0; i < length; i++) {
+    if(line[i] != ' ' && line[i] != '\t' && (line[i] != '\r' || i != length - 1)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+uint64_t countSampleLines(char* text, size_t length) {
+  uint64_t numLines = 0;
+  char* end = text + length;
+  while(text < end) {
+    char* newline = memchr(text, '\n', end - text);
+    char* lineEnd = newline ? newline : end;
+    if(!isBlankLine(text, lineEnd - text)) {
+      ++numLines;
+    }
+    text = lineEnd + 1;
+  }
+  return numLines;
+}
+
+uint64_t splitSampleText(char* text, size_t length, cs229Range_t* ranges, unsigned int numRanges) {
+  unsigned int i;
+  uint64_t numSamples = 0;
+  char* end = text + length;
+  char* start = text;
+  cs229ParseJob_t job;
+  for(i = 0; i < numRanges; i++) {
+    char* rangeEnd = end;
+    if(i < numRanges - 1) {
+      /* end the range after the first newline at or past its share of text */
+      char* target = text + (length / numRanges) * (i + 1) - 1;
+      char* newline;
+      if(target < start) {
+        target = start;
+      }
+      newline = memchr(target, '\n', end - target);
+      rangeEnd = newline ? newline + 1 : end;
+    }
+    ranges[i].text = start;
+    ranges[i].length = rangeEnd - start;
+    start = rangeEnd;
+  }
+  job.cd = NULL;
+  job.ranges = ranges;
+  runWorkers(numRanges, countRangeWorker, &job);
+  for(i = 0; i < numRanges; i++) {
+    ranges[i].firstSample = numSamples;
+    numSamples += ranges[i].numSamples;
+  }
+  return numSamples;
+}
+
+size_t splitSampleLines(char* text, size_t length, uint64_t numSamples, cs229Range_t* ranges, unsigned int numRanges) {
+  unsigned int i;
+  uint64_t numLines = 0;
+  char* end = text + length;
+  char* position = text;
+  for(i = 0; i < numRanges; i++) {
+    uint64_t lastLine = numSamples / numRanges * (i + 1);
+    if(i == numRanges - 1) {
+      lastLine = numSamples;
+    }
+    ranges[i].text = position;
+    ranges[i].firstSample = numLines;
+    while(numLines < lastLine && position < end) {
+      char* newline = memchr(position, '\n', end - position);
+      char* lineEnd = newline ? newline : end;
+      if(!isBlankLine(position, lineEnd - position)) {
+        ++numLines;
+      }
+      position = newline ? newline + 1 : end;
+    }
+    ranges[i].length = position - ranges[i].text;
+    ranges[i].numSamples = numLines - ranges[i].firstSample;
+  }
+  return position - text;
+}
+
+cs229ReadStatus_t parseSampleRanges(cs229Data_t* cd, cs229Range_t* ranges, unsigned int numRanges, uint64_t* samplesRead) {
+  unsigned int i;
+  cs229ParseJob_t job;
+  job.cd = cd;
+  job.ranges = ranges;
+  runWorkers(numRanges, parseRangeWorker, &job);
+  *samplesRead = 0;
+  for(i = 0; i < numRanges; i++) {
+    *samplesRead += ranges[i].samplesRead;
+    if(ranges[i].status != CS229_NO_ERROR) {
+      return ranges[i].status;
+    }
+  }
+  return CS229_DONE_READING;
+}
+
+cs229ReadStatus_t parseSampleText(cs229Data_t* cd, char* text, size_t length, unsigned int numWorkers, uint64_t* samplesRead) {
+  unsigned int i;
+  cs229Range_t ranges[MAX_WORKER_THREADS];
+  cs229ReadStatus_t status;
+  uint64_t numLines = splitSampleText(text, length, ranges, numWorkers);
+  uint64_t numSamples = cd->hasNumSamples ? cd->numSamples : numLines;
+  *samplesRead = 0;
+  if(cd->hasNumSamples && checkSampleTextLength(cd, length) != CS229_NO_ERROR) {
+    return CS229_ERROR_EOF;
+  }
+  cd->data = malloc(numSamples * cd->numChannels * cd->bitres / 8);
+  if(!cd->data && numSamples > 0) {
+    return CS229_ERROR_MEMORY;
+  }
+  /* only parse as many lines as the header promised */
+  for(i = 0; i < numWorkers && numLines > numSamples; i++) {
+    if(ranges[i].firstSample >= numSamples) {
+      ranges[i].numSamples = 0;
+    }
+    else if(ranges[i].firstSample + ranges[i].numSamples > numSamples) {
+      ranges[i].numSamples = numSamples - ranges[i].firstSample;
+    }
+  }
+  status = parseSampleRanges(cd, ranges, numWorkers, samplesRead);
+  if(status == CS229_DONE_READING && numLines > numSamples) {
+    return CS229_ERROR_TOO_MUCH_DATA;
+  }
+  if(status == CS229_DONE_READING && numLines < numSamples) {
+    return CS229_ERROR_EOF;
+  }
+  return status;
+}
+
+void countRangeWorker(unsigned int index, unsigned int numWorkers, void* job) {
+  cs229Range_t* range = &((cs229ParseJob_t*)job)->ranges[index];
+  range->numSamples = countSampleLines(range->text, range->length);
+}
+
+void parseRangeWorker(unsigned int index, unsigned int numWorkers, void* job) {
+  cs229Data_t* cd = ((cs229ParseJob_t*)job)->cd;
+  cs229Range_t* range = &((cs229ParseJob_t*)job)->ranges[index];
+  fileReader_t* reader = createMemoryReader(range->text, range->length);
+  range->samplesRead = 0;
+  range->status = CS229_NO_ERROR;
+  if(!reader) {
+    range->status = CS229_ERROR_MEMORY;
+    return;
+  }
+  while(range->samplesRead < range->numSamples) {
+    range->status = readSample(cd, (range->firstSample + range->samplesRead) * cd->numChannels, reader);
+    if(range->status != CS229_NO_ERROR) {
+      break;
+    }
+    ++range->samplesRead;
+  }
+  destroyFileReader(reader);
+}
+
 /* TODO: give cs229Data a status member and modify it's status instead of returning */
-cs229ReadStatus_t readSamples(cs229Data_t* cd, int sampleLimit, int* samplesFilled, FILE* fp) {
-  int i;
-  int samplesFilledThisTime = 0;
+cs229ReadStatus_t readSamples(cs229Data_t* cd, uint64_t sampleLimit, uint64_t* samplesFilled, fileReader_t* reader) {
+  uint64_t i;
+  uint64_t samplesFilledThisTime = 0;
   cs229ReadStatus_t status = CS229_NO_ERROR;
   for(i = *samplesFilled; status == CS229_NO_ERROR && i < sampleLimit; i++) {
-    status = readSample(cd, i * cd->numChannels, fp);
+    status = readSample(cd, i * cd->numChannels, reader);
     ++samplesFilledThisTime;
   }
   if(status != CS229_NO_ERROR) {
@@ -554,6 +1108,31 @@ cs229ReadStatus_t readSamples(cs229Data_t* cd, int sampleLimit, int* samplesFill
   return status;
 }
 
+cs229ReadStatus_t readPastLastSample(fileReader_t* reader) {
+  char* line;
+  size_t length;
+  readError_t error;
+  while((error = readerGetLine(reader, &line, &length)) == NO_ERROR) {
+    if(!isBlankLine(line, length)) {
+      return CS229_ERROR_TOO_MUCH_DATA;
+    }
+  }
+  return error == ERROR_EOF ? CS229_DONE_READING : CS229_ERROR_READING;
+}
+
+cs229ReadStatus_t checkSampleTextLength(cs229Data_t* cd, uint64_t length) {
+  /* n samples take at least 2 * numChannels * n - 1 bytes, as the last 
+    newline is optional */
+  if(cd->numSamples > (length + 1) / (2 * cd->numChannels)) {
+    return CS229_ERROR_EOF;
+  }
+  return CS229_NO_ERROR;
+}
+
+readError_t cs229FinishStream(fileReader_t* reader) {
+  return cs229ReadStatusToReadError(readPastLastSample(reader));
+}
+
 int getMaxCharsIn8Bit() {
   /* maxChars is "-127" */
   return 4;
@@ -562,6 +1141,10 @@ int getMaxCharsIn16Bit() {
   /* maxChars is "-32768" */
   return 6;
 }
+int getMaxCharsIn24Bit() {
+  /* maxChars is "-8388607" */
+  return 8;
+}
 int getMaxCharsIn32Bit() {
   /* maxChars is "-2147483647" */
   return 11;
@@ -576,6 +1159,9 @@ int getMaxCharsPerSample(sound_t* sound) {
   else if(sound->bitDepth == 16) {
     maxCharsInEachNum = getMaxCharsIn16Bit();
   }
+  else if(sound->bitDepth == 24) {
+    maxCharsInEachNum = getMaxCharsIn24Bit();
+  }
   else if(sound->bitDepth == 32) {
     maxCharsInEachNum = getMaxCharsIn32Bit();
   }
@@ -585,93 +1171,162 @@ int getMaxCharsPerSample(sound_t* sound) {
   return charsForAllNums + charsForSpaces + charsForNewline;
 }
 
-/* TODO: improve bounds checking */
-int getSamplesInCs229Format(sound_t* sound, char* str, int size) {
-  int numSamples = calculateNumSamples(sound);
-  int i, j;
-  int charCount = 0;
-  char** sampleStrings = malloc(sizeof(char**) * numSamples * sound->numChannels);
-  for(i = 0; i < numSamples; i++) {
-    int currSampleIndex = i * sound->numChannels;
-    int maxCharsPerData;
-    for(j = 0; j < sound->numChannels; j++) {
-      int currDataIndex = currSampleIndex + j;
-      if(sound->bitDepth == 8) {
-        char* charData = (char*)sound->rawData;
-        /* 6 chars to fit "-127 \0" */
-        maxCharsPerData = 6;
-        sampleStrings[currDataIndex] = malloc(maxCharsPerData);
-        snprintf(sampleStrings[currDataIndex], maxCharsPerData, "%d ", charData[currDataIndex]);
-      }
-      else if(sound->bitDepth == 16) {
-        short* shortData = (short*)sound->rawData;
-        /* 8 chars to fit "-32767 \0" */
-        maxCharsPerData = 8;
-        sampleStrings[currDataIndex] = malloc(maxCharsPerData);
-        snprintf(sampleStrings[currDataIndex], maxCharsPerData, "%hd ", shortData[currDataIndex]);
-      }
-      else if(sound->bitDepth == 32) {
-        long* longData = (long*)sound->rawData;
-        /* 13 chars to fit "-2147483648 \0" */
-        maxCharsPerData = 13;
-        sampleStrings[currDataIndex] = malloc(maxCharsPerData);
-        snprintf(sampleStrings[currDataIndex], maxCharsPerData, "%ld ", longData[currDataIndex]);
-      }
-      if(charCount >= size) {
-        printf("Overflow while writing samples, code red.\n");
-        printf("tried to read %d chars\n", charCount);
-        return charCount;
-      }
-    }
+int formatSampleValue(char* str, long value) {
+  /* the two digits of every number below 100, so digits go out in pairs */
+  static const char digitPairs[] = 
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+  char digits[10];
+  int numDigits = 0;
+  int length = 0;
+  unsigned long magnitude = value < 0 ? -(unsigned long)value : (unsigned long)value;
+  if(value < 0) {
+    str[length++] = '-';
+  }
+  /* fill digits from the back */
+  while(magnitude >= 100) {
+    unsigned int pair = (magnitude % 100) * 2;
+    magnitude /= 100;
+    digits[9 - numDigits++] = digitPairs[pair + 1];
+    digits[9 - numDigits++] = digitPairs[pair];
   }
-  charCount = makeSampleString(str, sampleStrings, sound); 
-  for(i = 0; i < numSamples * sound->numChannels; i++) {
-    free(sampleStrings[i]);
+  if(magnitude >= 10) {
+    digits[9 - numDigits++] = digitPairs[magnitude * 2 + 1];
+    digits[9 - numDigits++] = digitPairs[magnitude * 2];
   }
-  free(sampleStrings);
-  return charCount;
+  else {
+    digits[9 - numDigits++] = '0' + magnitude;
+  }
+  memcpy(&str[length], &digits[10 - numDigits], numDigits);
+  return length + numDigits;
 }
 
-int makeSampleString(char* result, char** singleSamples, sound_t* sound){
-  int i, j, k, pos, numSamples;
-  numSamples = calculateNumSamples(sound);
-  pos = 0;
-  for(i = 0; i < numSamples; i++) {
-    int sampleIndex = i * sound->numChannels;
-    for(j = 0; j < sound->numChannels; j++) {
-      int dataIndex = sampleIndex + j;
-      int currLen = strlen(singleSamples[dataIndex]);
-      for(k = 0; k < currLen; k++) {
-        result[pos++] = singleSamples[dataIndex][k];
+size_t formatSampleLines(sampleBuffer_t* samples, unsigned short numChannels, uint64_t firstSample, uint64_t numSamples, char* str) {
+  int32_t values[SAMPLE_VALUE_BLOCK];
+  uint64_t first = firstSample * numChannels;
+  uint64_t numValues = numSamples * numChannels;
+  uint64_t i;
+  size_t j;
+  size_t pos = 0;
+  unsigned int channel = 0;
+  for(i = 0; i < numValues; i += SAMPLE_VALUE_BLOCK) {
+    size_t n = numValues - i < SAMPLE_VALUE_BLOCK ? numValues - i : SAMPLE_VALUE_BLOCK;
+    getSampleValues(samples, first + i, n, values);
+    for(j = 0; j < n; j++) {
+      pos += formatSampleValue(&str[pos], values[j]);
+      str[pos++] = ' ';
+      if(++channel == numChannels) {
+        str[pos++] = '\n';
+        channel = 0;
       }
     }
-    result[pos++] = '\n';
   }
-  result[pos++] = 0;
   return pos;
 }
-
-int getMaxSizeSamples(sound_t* sound) {
-  int nullTerminatorByte = 1;
-  return getMaxCharsPerSample(sound) * calculateNumSamples(sound) + nullTerminatorByte;
-}
       
 writeError_t writeCs229File(sound_t* sound, FILE* fp) {
-  int maxSizeSamples = getMaxSizeSamples(sound);
-  char* sampleData = NULL;
-  sampleData = malloc(maxSizeSamples);
-  if(!sampleData) {
-    return WRITE_ERROR_MEMORY;
-  } 
-  sampleData[0] = 0;
-  getSamplesInCs229Format(sound, sampleData, maxSizeSamples);
+  writeError_t error = writeCs229Header(sound, fp);
+  if(error == WRITE_SUCCESS) {
+    error = writeCs229Samples(sound, fp);
+  }
+  return error;
+}
+
+writeError_t writeCs229Header(sound_t* sound, FILE* fp) {
   fprintf(fp, "CS229\n");
-  fprintf(fp, "Samples %d\n", calculateNumSamples(sound));
+  fprintf(fp, "Samples %llu\n", (unsigned long long)calculateNumSamples(sound));
   fprintf(fp, "Channels %d\n", sound->numChannels);
   fprintf(fp, "BitRes %d\n", sound->bitDepth);
   fprintf(fp, "SampleRate %ld\n", sound->sampleRate);
-  fprintf(fp, "StartData\n");
-  fprintf(fp, "%s", sampleData);
-  free(sampleData);
+  if(fprintf(fp, "StartData\n") < 0) {
+    return WRITE_ERROR_TOO_FEW_CHARS;
+  }
+  return WRITE_SUCCESS;
+}
+
+writeError_t writeCs229Samples(sound_t* sound, FILE* fp) {
+  char buffer[CS229_WRITE_BUFFER_SIZE];
+  uint64_t numSamples = calculateNumSamples(sound);
+  uint64_t samplesPerWrite = CS229_WRITE_BUFFER_SIZE / getMaxCharsPerSample(sound);
+  unsigned int numWorkers = getNumWorkerThreads();
+  uint64_t i;
+  sampleBuffer_t samples;
+  /* align the samples now, the workers only read them */
+  alignSampleData(sound);
+  if(sound->error != NO_ERROR) {
+    return WRITE_ERROR_MEMORY;
+  }
+  samples = getSampleBuffer(sound);
+  if(numWorkers > calculateTotalDataElements(sound) / CS229_PARALLEL_MIN_VALUES) {
+    numWorkers = calculateTotalDataElements(sound) / CS229_PARALLEL_MIN_VALUES;
+  }
+  if(numWorkers > 1) {
+    return writeCs229SamplesInParallel(sound, &samples, fp, numWorkers);
+  }
+  for(i = 0; i < numSamples; i += samplesPerWrite) {
+    uint64_t count = numSamples - i < samplesPerWrite ? numSamples - i : samplesPerWrite;
+    size_t length = formatSampleLines(&samples, sound->numChannels, i, count, buffer);
+    if(fwrite(buffer, 1, length, fp) != length) {
+      return WRITE_ERROR_TOO_FEW_CHARS;
+    }
+  }
   return WRITE_SUCCESS;
 }
+
+writeError_t writeCs229SamplesInParallel(sound_t* sound, sampleBuffer_t* samples, FILE* fp, unsigned int numWorkers) {
+  char* buffers[MAX_WORKER_THREADS];
+  size_t lengths[MAX_WORKER_THREADS];
+  uint64_t numSamples = calculateNumSamples(sound);
+  unsigned int maxCharsPerSample = getMaxCharsPerSample(sound);
+  uint64_t samplesPerWorker = (numSamples + numWorkers - 1) / numWorkers;
+  writeError_t error = WRITE_SUCCESS;
+  cs229FormatJob_t job;
+  unsigned int i;
+  if(samplesPerWorker > CS229_PARALLEL_WRITE_SIZE / maxCharsPerSample) {
+    samplesPerWorker = CS229_PARALLEL_WRITE_SIZE / maxCharsPerSample;
+  }
+  for(i = 0; i < numWorkers; i++) {
+    buffers[i] = malloc(samplesPerWorker * maxCharsPerSample);
+    if(!buffers[i]) {
+      while(i) {
+        free(buffers[--i]);
+      }
+      return WRITE_ERROR_MEMORY;
+    }
+  }
+  job.samples = *samples;
+  job.numChannels = sound->numChannels;
+  job.buffers = buffers;
+  job.lengths = lengths;
+  job.samplesPerWorker = samplesPerWorker;
+  job.endSample = numSamples;
+  for(job.firstSample = 0; job.firstSample < numSamples && error == WRITE_SUCCESS; 
+      job.firstSample += samplesPerWorker * numWorkers) {
+    runWorkers(numWorkers, formatRangeWorker, &job);
+    for(i = 0; i < numWorkers; i++) {
+      if(fwrite(buffers[i], 1, lengths[i], fp) != lengths[i]) {
+        error = WRITE_ERROR_TOO_FEW_CHARS;
+        break;
+      }
+    }
+  }
+  for(i = 0; i < numWorkers; i++) {
+    free(buffers[i]);
+  }
+  return error;
+}
+
+void formatRangeWorker(unsigned int index, unsigned int numWorkers, void* job) {
+  cs229FormatJob_t* j = (cs229FormatJob_t*)job;
+  uint64_t first = j->firstSample + index * j->samplesPerWorker;
+  uint64_t count = j->samplesPerWorker;
+  j->lengths[index] = 0;
+  if(first >= j->endSample) {
+    return;
+  }
+  if(count > j->endSample - first) {
+    count = j->endSample - first;
+  }
+  j->lengths[index] = formatSampleLines(&j->samples, j->numChannels, first, count, j->buffers[index]);
+}
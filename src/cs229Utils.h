@@ -2,7 +2,9 @@
 #define CS229_UTILS_H
 
 #include <stdio.h>
+#include <stdint.h>
 #include "fileTypes.h"
+#include "fileReader.h"
 
 /**
   Read fp as a .cs229 file and put it into sound 
@@ -11,6 +13,41 @@
 */
 void cs229Read(FILE* fp, sound_t* sound);
 
+/**
+  Reads only the header of fp as a .cs229 file and fills in every field of 
+  sound except rawData, which is left NULL. The sample count comes from the 
+  Samples keyword when the header has it; otherwise the samples are counted 
+  without being kept.
+  Precondition: file pointer directly after "CS229" header
+*/
+void cs229Probe(FILE* fp, sound_t* sound);
+
+/**
+  Reads the header of fp as a .cs229 file into sound, like cs229Probe, and 
+  returns a reader positioned at the first sample for cs229ReadBlock. When the
+  header has no Samples keyword, the samples are counted first (through a 
+  temporary file if fp cannot seek). Reads from sound->mappedFile instead of
+  fp when the file is mapped, which lets cs229ReadBlock split large blocks 
+  across threads. Returns NULL and sets sound->error on error. The reader must
+  be freed with destroyFileReader.
+  Precondition: file pointer directly after "CS229" header
+*/
+fileReader_t* cs229OpenStream(FILE* fp, sound_t* sound);
+
+/**
+  Parses the next numSamples samples from reader into block->rawData, which 
+  must have room for them. Uses the numChannels and bitDepth of block. Large
+  blocks in a reader over memory are parsed on several threads.
+*/
+readError_t cs229ReadBlock(fileReader_t* reader, sound_t* block, uint64_t numSamples);
+
+/**
+  Checks that only blank lines are left in reader after the last sample of a
+  stream, as cs229Read does for a whole file. Returns ERROR_SAMPLE_DATA if 
+  there is another sample.
+*/
+readError_t cs229FinishStream(fileReader_t* reader);
+
 /**
   convert n characters from str to lowercase
 */
@@ -22,4 +59,17 @@ void toLowerCase(char* str, size_t n);
 */
 writeError_t writeCs229File(sound_t* sound, FILE* fp);
 
+/**
+  Writes the header of sound, up to and including "StartData", to fp. The 
+  Samples line is calculated from sound->dataSize, so for a sound that is 
+  written in blocks it must hold the size of all of them.
+*/
+writeError_t writeCs229Header(sound_t* sound, FILE* fp);
+
+/**
+  Writes the sample lines of sound to fp. Used on its own to write a sound 
+  one block at a time after writeCs229Header.
+*/
+writeError_t writeCs229Samples(sound_t* sound, FILE* fp);
+
 #endif
@@ -89,3 +89,19 @@ void printSampleRateError() {
 void printZeroChannelsError() {
   fprintf(stderr, "Sound is either empty or incorrectly zero channels\n");
 }
+
+void printChannelNumberError(int channel) {
+  fprintf(stderr, "There is no channel %d in the sounds (1st channel = 0)\n", channel);
+}
+
+void printChannelMatrixError(char* matrix) {
+  fprintf(stderr, "Could not read the channel matrix \"%s\" (see -h)\n", matrix);
+}
+
+void printChannelMatrixSizeError(int numChannels) {
+  fprintf(stderr, "Each row of the channel matrix needs %d gains, one for each channel\n", numChannels);
+}
+
+void printWriteError() {
+  fprintf(stderr, "Could not write the output file\n");
+}
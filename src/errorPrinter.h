@@ -72,4 +72,25 @@ void printSampleRateError();
 */
 void printZeroChannelsError();
 
+/**
+  Prints error when the requested channel is not in the sounds
+*/
+void printChannelNumberError(int channel);
+
+/**
+  Prints error when the channel matrix given with -m could not be read
+*/
+void printChannelMatrixError(char* matrix);
+
+/**
+  Prints error when the rows of the channel matrix do not have a gain for each
+  of the channels in the sounds
+*/
+void printChannelMatrixSizeError(int numChannels);
+
+/**
+  Prints error when the output file could not be completely written
+*/
+void printWriteError();
+
 #endif
@@ -1,6 +1,20 @@
 #include "fileReader.h"
 #include <stdio.h>
 #include <string.h>
+#include <sys/stat.h>
+
+/**
+  Refills the reader's buffer from its file when every buffered byte has been
+  consumed. Returns ERROR_EOF when the file has nothing left.
+*/
+readError_t readerFill(fileReader_t* reader);
+
+/**
+  Moves the unread bytes to the front of the buffer, doubling it if they fill
+  it, and reads more of the file after them. Returns ERROR_EOF when the file
+  has nothing left.
+*/
+readError_t readerExtend(fileReader_t* reader);
 
 readError_t readBytes(void* ptr, size_t n, FILE* file) {
   if(fread(ptr, 1, n, file) < n) {
@@ -17,11 +31,286 @@ readError_t readBytes(void* ptr, size_t n, FILE* file) {
   return NO_ERROR;
 }
 
-readError_t ignoreLine(FILE* fp) {
-  char ignoredChar = 0;
+fileReader_t* createFileReader(FILE* file) {
+  fileReader_t* reader = malloc(sizeof(fileReader_t));
+  if(!reader) {
+    return NULL;
+  }
+  reader->buffer = malloc(FILE_READER_BLOCK_SIZE);
+  if(!reader->buffer) {
+    free(reader);
+    return NULL;
+  }
+  reader->file = file;
+  reader->position = 0;
+  reader->length = 0;
+  reader->capacity = FILE_READER_BLOCK_SIZE;
+  reader->ownsFile = 0;
+  return reader;
+}
+
+fileReader_t* createMemoryReader(char* data, size_t size) {
+  fileReader_t* reader = malloc(sizeof(fileReader_t));
+  if(!reader) {
+    return NULL;
+  }
+  reader->file = NULL;
+  reader->buffer = data;
+  reader->position = 0;
+  reader->length = size;
+  reader->capacity = size;
+  reader->ownsFile = 0;
+  return reader;
+}
+
+void destroyFileReader(fileReader_t* reader) {
+  if(reader->file) {
+    free(reader->buffer);
+  }
+  if(reader->ownsFile) {
+    fclose(reader->file);
+  }
+  free(reader);
+}
+
+readError_t readerFill(fileReader_t* reader) {
+  if(reader->position < reader->length) {
+    return NO_ERROR;
+  }
+  if(!reader->file) {
+    /* a memory reader holds all of its data from the start */
+    return ERROR_EOF;
+  }
+  reader->position = 0;
+  reader->length = fread(reader->buffer, 1, reader->capacity, reader->file);
+  if(reader->length > 0) {
+    return NO_ERROR;
+  }
+  if(ferror(reader->file)) {
+    fprintf(stderr, "error reading file\n");
+    return ERROR_READING;
+  }
+  return ERROR_EOF;
+}
+
+readError_t readerExtend(fileReader_t* reader) {
+  size_t unread = reader->length - reader->position;
+  size_t bytesRead;
+  if(!reader->file) {
+    return ERROR_EOF;
+  }
+  memmove(reader->buffer, &reader->buffer[reader->position], unread);
+  reader->position = 0;
+  reader->length = unread;
+  if(unread == reader->capacity) {
+    char* newBuffer = realloc(reader->buffer, reader->capacity * 2);
+    if(!newBuffer) {
+      return ERROR_MEMORY;
+    }
+    reader->buffer = newBuffer;
+    reader->capacity *= 2;
+  }
+  bytesRead = fread(&reader->buffer[unread], 1, reader->capacity - unread, reader->file);
+  reader->length += bytesRead;
+  if(bytesRead > 0) {
+    return NO_ERROR;
+  }
+  if(ferror(reader->file)) {
+    fprintf(stderr, "error reading file\n");
+    return ERROR_READING;
+  }
+  return ERROR_EOF;
+}
+
+readError_t readerPeek(fileReader_t* reader, char* c) {
+  readError_t error = readerFill(reader);
+  if(error != NO_ERROR) {
+    return error;
+  }
+  *c = reader->buffer[reader->position];
+  return NO_ERROR;
+}
+
+readError_t readerNextChar(fileReader_t* reader, char* c) {
+  readError_t error = readerFill(reader);
+  if(error != NO_ERROR) {
+    return error;
+  }
+  *c = reader->buffer[reader->position++];
+  return NO_ERROR;
+}
+
+readError_t readerAdvance(fileReader_t* reader, size_t n) {
+  while(n) {
+    size_t available;
+    readError_t error = readerFill(reader);
+    if(error != NO_ERROR) {
+      return error;
+    }
+    available = reader->length - reader->position;
+    if(available > n) {
+      available = n;
+    }
+    reader->position += available;
+    n -= available;
+  }
+  return NO_ERROR;
+}
+
+readError_t readerScanTo(fileReader_t* reader, char delimiter) {
+  for(;;) {
+    char* found;
+    readError_t error = readerFill(reader);
+    if(error != NO_ERROR) {
+      return error;
+    }
+    found = memchr(&reader->buffer[reader->position], delimiter, reader->length - reader->position);
+    if(found) {
+      reader->position = found - reader->buffer + 1;
+      return NO_ERROR;
+    }
+    reader->position = reader->length;
+  }
+}
+
+readError_t readerCopyUntil(fileReader_t* reader, char* str, size_t n, const char* delimiters) {
+  size_t i = 0;
+  while(i < n - 1) {
+    char byte;
+    readError_t error = readerFill(reader);
+    if(error != NO_ERROR) {
+      str[i] = 0;
+      return error;
+    }
+    /* copy straight out of the buffer until a delimiter or the end of it */
+    while(i < n - 1 && reader->position < reader->length) {
+      byte = reader->buffer[reader->position++];
+      str[i++] = byte;
+      if(byte != 0 && strchr(delimiters, byte)) {
+        str[i] = 0;
+        return NO_ERROR;
+      }
+    }
+  }
+  str[i] = 0;
+  return NO_ERROR;
+}
+
+readError_t ignoreLine(fileReader_t* reader) {
+  return readerScanTo(reader, '\n');
+}
+
+readError_t readerGetLine(fileReader_t* reader, char** line, size_t* length) {
+  size_t searched = 0;
+  char* newline;
+  readError_t error = readerFill(reader);
+  if(error != NO_ERROR) {
+    return error;
+  }
+  for(;;) {
+    size_t start = reader->position + searched;
+    newline = memchr(&reader->buffer[start], '\n', reader->length - start);
+    if(newline) {
+      *line = &reader->buffer[reader->position];
+      *length = newline - *line;
+      reader->position += *length + 1;
+      return NO_ERROR;
+    }
+    /* the line runs past the buffer, so pull in more of it */
+    searched = reader->length - reader->position;
+    error = readerExtend(reader);
+    if(error == ERROR_EOF) {
+      break;
+    }
+    if(error != NO_ERROR) {
+      return error;
+    }
+  }
+  *line = &reader->buffer[reader->position];
+  *length = reader->length - reader->position;
+  reader->position = reader->length;
+  return NO_ERROR;
+}
+
+long readerTell(fileReader_t* reader) {
+  long offset;
+  if(!reader->file) {
+    return (long)reader->position;
+  }
+  offset = ftell(reader->file);
+  if(offset < 0) {
+    return -1;
+  }
+  return offset - (long)(reader->length - reader->position);
+}
+
+readError_t readerSeek(fileReader_t* reader, long offset) {
+  if(!reader->file) {
+    if(offset < 0 || (size_t)offset > reader->length) {
+      return ERROR_EOF;
+    }
+    reader->position = offset;
+    return NO_ERROR;
+  }
+  if(fseek(reader->file, offset, SEEK_SET) != 0) {
+    return ERROR_READING;
+  }
+  /* whatever was buffered belongs to the old position */
+  reader->position = 0;
+  reader->length = 0;
+  return NO_ERROR;
+}
+
+readError_t readerBytesLeft(fileReader_t* reader, uint64_t* bytesLeft) {
+  struct stat fileStat;
+  long offset;
+  if(!reader->file) {
+    *bytesLeft = reader->length - reader->position;
+    return NO_ERROR;
+  }
+  offset = ftell(reader->file);
+  if(offset < 0 || fstat(fileno(reader->file), &fileStat) != 0 
+      || !S_ISREG(fileStat.st_mode) || fileStat.st_size < offset) {
+    return ERROR_READING;
+  }
+  /* what is left of the file, and what is buffered but not read yet */
+  *bytesLeft = (uint64_t)(fileStat.st_size - offset) + (reader->length - reader->position);
+  return NO_ERROR;
+}
+
+readError_t readerSpool(fileReader_t* reader) {
+  FILE* spool;
   readError_t error = NO_ERROR;
-  while(ignoredChar != '\n' && error == NO_ERROR) {
-    error = readBytes(&ignoredChar, 1, fp);
+  if(!reader->file) {
+    /* memory readers can already seek */
+    return NO_ERROR;
+  }
+  spool = tmpfile();
+  if(!spool) {
+    return ERROR_READING;
+  }
+  while(error == NO_ERROR) {
+    size_t unread = reader->length - reader->position;
+    if(fwrite(&reader->buffer[reader->position], 1, unread, spool) != unread) {
+      error = ERROR_READING;
+      break;
+    }
+    reader->position = reader->length;
+    error = readerFill(reader);
+  }
+  if(error == ERROR_EOF) {
+    error = NO_ERROR;
+  }
+  if(error != NO_ERROR || fseek(spool, 0, SEEK_SET) != 0) {
+    fclose(spool);
+    return ERROR_READING;
   }
-  return error;
+  if(reader->ownsFile) {
+    fclose(reader->file);
+  }
+  reader->file = spool;
+  reader->ownsFile = 1;
+  reader->position = 0;
+  reader->length = 0;
+  return NO_ERROR;
 }
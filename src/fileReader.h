@@ -4,17 +4,123 @@
 #include "readError.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
 
-/** 
-  Read n bytes from file, handles read errors, and put them in ptr. 
-  Moves file pointer n positions ahead. 
+/**
+  Number of bytes a fileReader_t pulls from its file on each refill.
+*/
+#define FILE_READER_BLOCK_SIZE 65536
+
+/**
+  Cursor over a file that refills a large buffer in blocks so callers can peek,
+  advance, and scan through the bytes in memory instead of reading them one at
+  a time. Allocate with createFileReader and free with destroyFileReader.
+*/
+typedef struct {
+  /* NULL for readers created over memory */
+  FILE* file;
+  char* buffer;
+  /* index of the next unread byte in buffer */
+  size_t position;
+  /* number of valid bytes in buffer */
+  size_t length;
+  size_t capacity;
+  /* nonzero when the reader opened file itself and must close it */
+  char ownsFile;
+} fileReader_t;
+
+/**
+  Read n bytes from file, handles read errors, and put them in ptr.
+  Moves file pointer n positions ahead.
   return appropriate readError_t
 */
 readError_t readBytes(void* ptr, size_t n, FILE* file);
 
 /**
-  Ignores the rest of the line and places the file pointer after the newline
+  Allocates a reader which reads file from its current position. Returns NULL
+  on memory error. The reader reads ahead, so file should not be read directly
+  while the reader is in use.
+*/
+fileReader_t* createFileReader(FILE* file);
+
+/**
+  Allocates a reader over size bytes of data that are already in memory, such
+  as a mapped file. The reader never copies or frees data. Returns NULL on 
+  memory error.
+*/
+fileReader_t* createMemoryReader(char* data, size_t size);
+
+/**
+  Frees the reader and its buffer. Does not close the file or free the data of
+  a memory reader.
+*/
+void destroyFileReader(fileReader_t* reader);
+
+/**
+  Puts the next unread character into c without consuming it. Returns ERROR_EOF
+  when there are no characters left.
+*/
+readError_t readerPeek(fileReader_t* reader, char* c);
+
+/**
+  Consumes the next unread character and puts it into c.
+*/
+readError_t readerNextChar(fileReader_t* reader, char* c);
+
+/**
+  Consumes n characters. Returns ERROR_EOF if the file ends first.
+*/
+readError_t readerAdvance(fileReader_t* reader, size_t n);
+
+/**
+  Consumes characters up to and including the next occurrence of delimiter.
+*/
+readError_t readerScanTo(fileReader_t* reader, char delimiter);
+
+/**
+  Copies n-1 characters or up to and including the first character found in
+  delimiters into str, then pads with a null terminator. On a read error, the
+  characters copied so far are null terminated and the error is returned.
+*/
+readError_t readerCopyUntil(fileReader_t* reader, char* str, size_t n, const char* delimiters);
+
+/**
+  Ignores the rest of the line and places the reader after the newline
+*/
+readError_t ignoreLine(fileReader_t* reader);
+
+/**
+  Consumes the next line and points line at its characters in the reader's
+  buffer, without the newline, putting their count in length. The last line
+  of the file does not need a newline. The characters are only valid until 
+  the reader is used again. Returns ERROR_EOF when there are no lines left.
+*/
+readError_t readerGetLine(fileReader_t* reader, char** line, size_t* length);
+
+/**
+  Returns the offset of the next unread character, or -1 if the underlying file
+  cannot report its position (for example a pipe). The offset can be passed to
+  readerSeek.
+*/
+long readerTell(fileReader_t* reader);
+
+/**
+  Moves the reader to an offset returned by readerTell.
+*/
+readError_t readerSeek(fileReader_t* reader, long offset);
+
+/**
+  Puts how many bytes the reader has not read yet into bytesLeft. Returns 
+  ERROR_READING if the underlying file cannot report its size (for example a 
+  pipe).
+*/
+readError_t readerBytesLeft(fileReader_t* reader, uint64_t* bytesLeft);
+
+/**
+  Copies everything the reader has not read yet into a temporary file and reads
+  from that file from now on, so that a reader over a pipe can seek. The 
+  temporary file is closed by destroyFileReader.
 */
-readError_t ignoreLine(FILE* fp);
+readError_t readerSpool(fileReader_t* reader);
 
-#endif 
+#endif
@@ -1,6 +1,8 @@
 #ifndef FILE_TYPES_GUARD
 #define FILE_TYPES_GUARD
 
+#include <stdlib.h>
+#include <stdint.h>
 #include "readError.h"
 #include "writeError.h"
 
@@ -9,9 +11,22 @@
 */
 typedef enum {
   CS229,
-  WAVE
+  WAVE,
+  /* compressed, see sndzUtils.h. Samples are held like those of WAVE */
+  SNDZ
 } fileType_t;
 
+/**
+  How the samples of a sound are stored
+*/
+typedef enum {
+  /* signed integers, except that 8-bit WAVE and SNDZ samples are unsigned */
+  INTEGER_SAMPLES,
+  /* 32-bit IEEE floats from -1 to 1. Read from and written to WAVE files, and
+    used to scale and mix samples without clipping until they are written */
+  FLOAT_SAMPLES
+} sampleFormat_t;
+
 /**
   Used to hold all the data associated with sounds (both CS229 and WAVE)
 */
@@ -20,8 +35,15 @@ typedef struct {
   fileType_t fileType;
   char* fileName;
   void* rawData;
-  unsigned int dataSize;
+  /* the mapped input file when rawData points into it rather than allocated 
+    memory, otherwise NULL */
+  void* mappedFile;
+  size_t mappedFileSize;
+  /* 64 bits so that sounds over 4 GB, such as RF64 files, do not wrap */
+  uint64_t dataSize;
   readError_t error;
+  /* FLOAT_SAMPLES always have a bitDepth of 32 */
+  sampleFormat_t sampleFormat;
   unsigned short numChannels;
   unsigned short bitDepth;
 } sound_t;
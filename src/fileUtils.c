@@ -1,18 +1,75 @@
+/* for copy_file_range */
+#define _GNU_SOURCE
 #include "fileUtils.h"
 #include "fileTypes.h"
 #include "fileReader.h"
 #include "waveUtils.h"
 #include "cs229Utils.h"
+#include "sndzUtils.h"
+#include "sampleKernels.h"
 #include "readError.h"
 #include "writeError.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <limits.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
 
-void addSamplesToEndOfSound(sound_t* sound, unsigned int numData);
-void addSample(sound_t* sound, unsigned int sampleIndex); 
-unsigned int calculateTotalDataElements(sound_t* sound);
+uint64_t calculateTotalDataElements(sound_t* sound);
+
+/**
+  Returns 1 if each output of matrix copies at most one input with gain 1, 
+  filling sources with that input for each output, or -1 for outputs with no
+  inputs. Returns 0 otherwise.
+*/
+char isChannelRouting(channelMatrix_t* matrix, int* sources);
+
+/**
+  Copies each input channel in sources into its output channel for every one 
+  of the numSamples frames, copying runs of neighboring channels together. 
+  Outputs with no input keep the silence to is filled with first. Returns -1
+  on memory error and 0 otherwise.
+*/
+int routeChannels(sampleBuffer_t* from, sampleBuffer_t* to, uint64_t numSamples, channelMatrix_t* matrix, int* sources);
+
+/**
+  Mixes the channels of the numSamples frames in from into to through the 
+  gains of matrix as floats. Integers are read with full scale 1 and 
+  quantized back. Returns -1 on memory error and 0 otherwise.
+*/
+int mixChannels(sampleBuffer_t* from, sampleBuffer_t* to, sampleFormat_t sampleFormat, uint64_t numSamples, channelMatrix_t* matrix);
+
+/**
+  Returns loadEmptySound() with a copy of fileName, or NULL on memory error.
+*/
+sound_t* loadNamedSound(char* fileName);
+
+/**
+  Maps file into memory if it is a regular file and records the mapping in 
+  sound->mappedFile. Leaves sound->mappedFile NULL when the file cannot be
+  mapped (pipes, terminals, empty files) so it is read through stdio instead.
+  Pages are mapped private, so writing to them copies only the touched pages
+  and never modifies the file.
+*/
+void mapSoundFile(FILE* file, sound_t* sound);
+
+/**
+  Unmaps the file mapped by mapSoundFile, if any.
+*/
+void unmapSoundFile(sound_t* sound);
+
+/**
+  Has the kernel copy up to n bytes from inFd, starting at *inOffset, to the
+  current position of outFd without passing them through user space. Tries
+  copy_file_range, which can share extents on filesystems with reflinks, then
+  sendfile. Advances *inOffset and returns the number of bytes copied, which 
+  is less than n when neither call can finish the copy.
+*/
+size_t kernelCopy(int inFd, off_t* inOffset, int outFd, size_t n);
 
 /** 
   Returns an allocated but empty sound_t*. Must manually call methods to 
@@ -26,42 +83,240 @@ sound_t* loadEmptySound() {
   sp->fileName = NULL;
   sp->error = NO_ERROR;
   sp->rawData = NULL;
+  sp->mappedFile = NULL;
+  sp->mappedFileSize = 0;
   sp->dataSize = 0;
+  sp->sampleFormat = INTEGER_SAMPLES;
   return sp;
 }
 
-/** 
-  Loads whole sound into sound_t* and returns it. Sets sound->error and returns 
-  sound on error. Returns NULL on memory allocation error. 
-*/
-sound_t* loadSound(FILE* file, char* fileName) {
+sound_t* loadNamedSound(char* fileName) {
   sound_t* sp = loadEmptySound();
   if(!sp) {
     return NULL;
   }
-
   sp->fileName = malloc(strlen(fileName) + 1);
   if(!sp->fileName) {
     free(sp);
     return NULL;
   }
   strcpy(sp->fileName, fileName);
+  return sp;
+}
 
+/** 
+  Loads whole sound into sound_t* and returns it. Sets sound->error and returns 
+  sound on error. Returns NULL on memory allocation error. 
+*/
+sound_t* loadSound(FILE* file, char* fileName) {
+  sound_t* sp = loadNamedSound(fileName);
+  if(!sp) {
+    return NULL;
+  }
+
+  mapSoundFile(file, sp);
   getFileType(file, sp);
   if(sp->error != NO_ERROR) {
+    unmapSoundFile(sp);
     return sp;
   }
   if(WAVE == sp->fileType) {
+    /* rawData points into the mapping, keep it until unloadSound */
     wavRead(file, sp);
   }
-  if(CS229 == sp->fileType) {
+  if(CS229 == sp->fileType && !loadCachedSound(file, sp)) {
+    /* the samples are parsed into allocated memory, so the text can go */
     cs229Read(file, sp);
+    unmapSoundFile(sp);
+    if(sp->error == NO_ERROR) {
+      storeCachedSound(file, sp);
+    }
+  }
+  if(SNDZ == sp->fileType) {
+    /* the samples are decoded into allocated memory */
+    sndzRead(file, sp);
+    unmapSoundFile(sp);
+  }
+  return sp;
+}
+
+sound_t* probeSound(FILE* file, char* fileName) {
+  sound_t* sp = loadNamedSound(fileName);
+  if(!sp) {
+    return NULL;
+  }
+
+  getFileType(file, sp);
+  if(sp->error != NO_ERROR) {
+    return sp;
+  }
+  if(WAVE == sp->fileType) {
+    wavProbe(file, sp);
+  }
+  if(CS229 == sp->fileType) {
+    cs229Probe(file, sp);
+  }
+  if(SNDZ == sp->fileType) {
+    sndzProbe(file, sp);
   }
   return sp;
 }
 
+soundStream_t* openSoundStream(FILE* file, char* fileName) {
+  soundStream_t* stream = malloc(sizeof(soundStream_t));
+  if(!stream) {
+    return NULL;
+  }
+  stream->sound = loadNamedSound(fileName);
+  if(!stream->sound) {
+    free(stream);
+    return NULL;
+  }
+  stream->file = file;
+  stream->reader = NULL;
+  stream->cache = NULL;
+  stream->sndz = NULL;
+  stream->samplesRemaining = 0;
+
+  getFileType(file, stream->sound);
+  if(stream->sound->error != NO_ERROR) {
+    return stream;
+  }
+  if(WAVE == stream->sound->fileType) {
+    /* leaves file at the first sample */
+    wavProbe(file, stream->sound);
+  }
+  if(CS229 == stream->sound->fileType && !loadCachedSound(file, stream->sound)) {
+    /* parse regular files straight from memory so threads can split blocks */
+    mapSoundFile(file, stream->sound);
+    stream->reader = cs229OpenStream(file, stream->sound);
+    if(stream->reader) {
+      stream->cache = beginCachedSound(file, stream->sound);
+    }
+  }
+  if(SNDZ == stream->sound->fileType) {
+    stream->sndz = sndzOpenStream(file, stream->sound);
+  }
+  stream->samplesRemaining = calculateNumSamples(stream->sound);
+  return stream;
+}
+
+unsigned int readSoundBlock(soundStream_t* stream, sound_t* block, unsigned int maxSamples) {
+  sound_t* header = stream->sound;
+  unsigned int numSamples = maxSamples;
+  size_t blockSize;
+  void* newData;
+  if(header->error != NO_ERROR || stream->samplesRemaining == 0) {
+    return 0;
+  }
+  if(numSamples > stream->samplesRemaining) {
+    numSamples = stream->samplesRemaining;
+  }
+  blockSize = (size_t)numSamples * header->numChannels * header->bitDepth / 8;
+  ensureDataAllocated(block);
+  newData = realloc(block->rawData, blockSize);
+  if(!newData) {
+    header->error = ERROR_MEMORY;
+    return 0;
+  }
+  block->rawData = newData;
+  block->dataSize = blockSize;
+  block->sampleRate = header->sampleRate;
+  block->fileType = header->fileType;
+  block->numChannels = header->numChannels;
+  block->bitDepth = header->bitDepth;
+  block->sampleFormat = header->sampleFormat;
+  block->error = NO_ERROR;
+
+  if(WAVE == header->fileType) {
+    header->error = readBytes(block->rawData, blockSize, stream->file);
+  }
+  else if(CS229 == header->fileType && !stream->reader) {
+    /* the samples were already parsed into the cache */
+    memcpy(block->rawData, (char*)header->rawData + header->dataSize 
+      - stream->samplesRemaining * header->numChannels * header->bitDepth / 8, blockSize);
+  }
+  else if(CS229 == header->fileType) {
+    header->error = cs229ReadBlock(stream->reader, block, numSamples);
+    if(header->error == NO_ERROR && numSamples == stream->samplesRemaining) {
+      /* the file must end where its samples do, as when it is loaded whole */
+      header->error = cs229FinishStream(stream->reader);
+    }
+    if(stream->cache && header->error == NO_ERROR) {
+      appendCachedSound(stream->cache, block);
+    }
+  }
+  else if(SNDZ == header->fileType) {
+    header->error = sndzReadBlock(stream->sndz, block, numSamples);
+  }
+  if(header->error != NO_ERROR) {
+    return 0;
+  }
+  stream->samplesRemaining -= numSamples;
+  return numSamples;
+}
+
+void closeSoundStream(soundStream_t* stream) {
+  if(stream->reader) {
+    destroyFileReader(stream->reader);
+  }
+  if(stream->sndz) {
+    destroySndzReader(stream->sndz);
+  }
+  if(stream->cache) {
+    finishCachedSound(stream->cache, stream->samplesRemaining == 0 
+      && stream->sound->error == NO_ERROR);
+  }
+  unloadSound(stream->sound);
+  free(stream);
+}
+
+void mapSoundFile(FILE* file, sound_t* sound) {
+  struct stat fileStat;
+  void* mapping;
+  if(fstat(fileno(file), &fileStat) != 0 || !S_ISREG(fileStat.st_mode) 
+      || fileStat.st_size == 0) {
+    return;
+  }
+  mapping = mmap(NULL, fileStat.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(file), 0);
+  if(mapping == MAP_FAILED) {
+    return;
+  }
+  sound->mappedFile = mapping;
+  sound->mappedFileSize = fileStat.st_size;
+}
+
+void unmapSoundFile(sound_t* sound) {
+  if(!sound->mappedFile) {
+    return;
+  }
+  munmap(sound->mappedFile, sound->mappedFileSize);
+  sound->mappedFile = NULL;
+  sound->mappedFileSize = 0;
+}
+
+void ensureDataAllocated(sound_t* sound) {
+  void* newData = NULL;
+  if(!sound->mappedFile) {
+    return;
+  }
+  if(sound->dataSize > 0) {
+    newData = malloc(sound->dataSize);
+    if(!newData) {
+      sound->error = ERROR_MEMORY;
+      return;
+    }
+    memcpy(newData, sound->rawData, sound->dataSize);
+  }
+  sound->rawData = newData;
+  unmapSoundFile(sound);
+}
+
 void unloadSound(sound_t* sound) {
-  if(sound->error != ERROR_MEMORY && sound->rawData != NULL && sound->dataSize != 0) {
+  if(sound->mappedFile) {
+    unmapSoundFile(sound);
+  }
+  else if(sound->error != ERROR_MEMORY && sound->rawData != NULL && sound->dataSize != 0) {
     free(sound->rawData);
   }
   if(sound->fileName != NULL) {
@@ -82,8 +337,12 @@ void getFileType(FILE* file, sound_t* sound) {
   if(sound->error == NO_ERROR) {
     sound->error = readBytes(type, 4, file);
   }
-  if(sound->error == NO_ERROR && strncmp(type, "RIFF", 4) == 0) {
-    /* so far looks like a wave file */
+  if(sound->error == NO_ERROR && strncmp(type, "SNDZ", 4) == 0) {
+    sound->fileType = SNDZ;
+  }
+  else if(sound->error == NO_ERROR 
+      && (strncmp(type, "RIFF", 4) == 0 || strncmp(type, "RF64", 4) == 0)) {
+    /* so far looks like a wave file, RF64 has its sizes in a ds64 chunk */
     /* read past 4 "filesize" bytes, following 4 bytes should be "WAVE" */
     sound->error = readBytes(type, 4, file);
     if(sound->error == NO_ERROR) {
@@ -103,7 +362,7 @@ void getFileType(FILE* file, sound_t* sound) {
       sound->fileType = CS229;
     }
     else {
-      /* the header is not "WAVE" nor "cs229". Couldn't identify filetype */
+      /* the header is not "WAVE", "SNDZ", nor "cs229". Couldn't identify filetype */
       sound->error = ERROR_FILETYPE;
     }
   }
@@ -111,381 +370,830 @@ void getFileType(FILE* file, sound_t* sound) {
 }
 
 void convertToFileType(fileType_t resultType, sound_t* sound) {
+  if(sound->sampleFormat == FLOAT_SAMPLES) {
+    if(resultType == WAVE) {
+      /* floats are stored the same way for every file type */
+      sound->fileType = WAVE;
+      return;
+    }
+    /* CS229 and SNDZ only hold integers */
+    quantizeSamples(32, sound);
+  }
   if(resultType == CS229) {
     waveToCs229(sound);
   }
-  else if(resultType == WAVE) {
+  else {
+    /* SNDZ sounds hold their samples in the WAVE layout */
     cs229ToWave(sound);
+    sound->fileType = resultType;
   }
 }
 
 void cs229ToWave(sound_t* sound) {
-  signed char* charData = (signed char*)sound->rawData;
-  if(sound->fileType == WAVE) {
-    /* already correct type */
+  sampleBuffer_t buffer;
+  if(sound->fileType != CS229) {
+    /* already has the WAVE layout */
+    sound->fileType = WAVE;
     return;
   }
   if(sound->bitDepth == 8) {
     /* convert to unsigned, cs229 allows -127 to 127, wav (bit depth of 8) allows 0-255 */
-    int i;
-    for(i = 0; i < calculateNumSamples(sound); i++) {
-      charData[i] += 128;
-    }
+    buffer = getSampleBuffer(sound);
+    getSampleKernels()->toWave8(buffer.u8, buffer.numValues);
   }
   sound->fileType = WAVE;
 }
 
 void waveToCs229(sound_t* sound) {
-  int i;
-  char* cs229Data = (char*)sound->rawData;
+  sampleBuffer_t buffer;
+  const sampleKernels_t* kernels = getSampleKernels();
+  uint64_t i;
   if(sound->fileType == CS229) {
     /* already correct type */
     return;
   }
+  /* convert 8-bit samples to signed, and trim MIN_VALUE samples to 
+    MIN_VALUE + 1 (ex. -128 samples to -127, -32768 to -32767, etc.), in one
+    pass over every sample of every channel */
+  buffer = getSampleBuffer(sound);
   if(sound->bitDepth == 8) {
-    /* waveData and cs229Data point to the same thing */
-    unsigned char* waveData = (unsigned char*)sound->rawData;
-    /* convert samples to signed */
-    for(i = 0; i < calculateNumSamples(sound); i++) {
-      cs229Data[i] = waveData[i] - 128;
-    }
+    kernels->toCs2298(buffer.u8, buffer.numValues);
+  }
+  else if(sound->bitDepth == 16) {
+    kernels->trim16(buffer.s16, buffer.numValues);
+  }
+  else if(sound->bitDepth == 32) {
+    kernels->trim32(buffer.s32, buffer.numValues);
   }
-  /* trim MIN_VALUE samples to MIN_VALUE + 1 (ex. -128 samples to -127, -32768 to -32767, etc.) */
-  for(i = 0; i < calculateNumSamples(sound); i++) {
-    if( (sound->bitDepth == 8 && cs229Data[i] == -128)
-      || (sound->bitDepth == 16 && cs229Data[i] == -32768)
-      || (sound->bitDepth == 32 && cs229Data[i] < -2147483647) ) {
-      /* we used < -2147483647 because we need to use LL suffix for one less */
-      cs229Data[i] += 1;
+  else if(sound->bitDepth == 24) {
+    for(i = 0; i < buffer.numValues; i++) {
+      /* -8388608 is packed as 00 00 80, make it -8388607 */
+      if(buffer.u8[3 * i] == 0 && buffer.u8[3 * i + 1] == 0 && buffer.u8[3 * i + 2] == 0x80) {
+        buffer.u8[3 * i] = 1;
+      }
     }
   }
   sound->fileType = CS229;
 }
 
-int ensureSoundChannelsCombinable(sound_t* s1, sound_t* s2, fileType_t resultType) {
-  if(ensureSoundsCombinable(s1, s2, resultType) == -1) {
-    return -1;
+int planSoundFormat(sound_t* dest, sound_t** sounds, int numSounds, combineMode_t mode) {
+  int i;
+  int numLeftOut = 0;
+  uint64_t numSamples = 0;
+  unsigned int numChannels = 0;
+  dest->sampleRate = sounds[0]->sampleRate;
+  dest->bitDepth = sounds[0]->bitDepth;
+  dest->sampleFormat = INTEGER_SAMPLES;
+  for(i = 0; i < numSounds; i++) {
+    sound_t* sound = sounds[i];
+    if(sound->sampleRate != dest->sampleRate) {
+      sounds[i] = NULL;
+      numLeftOut++;
+      continue;
+    }
+    if(sound->bitDepth > dest->bitDepth) {
+      dest->bitDepth = sound->bitDepth;
+    }
+    if(sound->sampleFormat == FLOAT_SAMPLES && dest->fileType == WAVE) {
+      dest->sampleFormat = FLOAT_SAMPLES;
+    }
+    if(mode == COMBINE_CHANNELS) {
+      numChannels += sound->numChannels;
+    }
+    else if(sound->numChannels > numChannels) {
+      numChannels = sound->numChannels;
+    }
+    if(mode == COMBINE_CONCATENATE) {
+      numSamples += calculateNumSamples(sound);
+    }
+    else if(calculateNumSamples(sound) > numSamples) {
+      numSamples = calculateNumSamples(sound);
+    }
   }
-  ensureChannelLength(s1, s2);
-  return 0;
+  dest->numChannels = numChannels;
+  dest->dataSize = numSamples * dest->numChannels * dest->bitDepth / 8;
+  return numLeftOut;
 }
 
-int ensureSoundsCanConcatenate(sound_t* s1, sound_t* s2, fileType_t resultType) {
-  if(ensureSoundsCombinable(s1, s2, resultType) == -1) {
-    return -1;
+
+void scaleBitDepth(int target, sound_t* sound) {
+  /* exact in integers, which a float multiplier is not for 32-bit samples */
+  int32_t sampleMultiplier = (int32_t)1 << (target - sound->bitDepth);
+  uint64_t numDataElements = calculateTotalDataElements(sound);
+  const sampleKernels_t* kernels = getSampleKernels();
+  int32_t values[SAMPLE_VALUE_BLOCK];
+  sampleBuffer_t from, to;
+  uint8_t flip;
+  uint64_t i;
+  size_t j;
+  void* newData;
+  if(sound->bitDepth >= target) {
+    return;
   }
-  ensureNumChannels(s1, s2);
-  return 0;
+  newData = malloc(numDataElements * target / 8);
+  if(!newData && numDataElements > 0) {
+    sound->error = ERROR_MEMORY;
+    return;
+  }
+  /* widen and shift in one pass, straight into the new data. Values wider 
+    than 8 bits are always signed, so unsigned 8-bit samples are centered on
+    the way */
+  from = getSampleBuffer(sound);
+  to = makeSampleBuffer(newData, target, 0, numDataElements);
+  flip = from.isUnsigned ? 0x80 : 0;
+  if(from.bitDepth == 8 && target == 16) {
+    kernels->widen8To16(from.u8, to.s16, numDataElements, flip);
+  }
+  else if(from.bitDepth == 8 && target == 32) {
+    kernels->widen8To32(from.u8, to.s32, numDataElements, flip);
+  }
+  else if(from.bitDepth == 16 && target == 32) {
+    kernels->widen16To32(from.s16, to.s32, numDataElements);
+  }
+  else {
+    /* to or from packed 24-bit values */
+    for(i = 0; i < numDataElements; i += SAMPLE_VALUE_BLOCK) {
+      size_t n = numDataElements - i < SAMPLE_VALUE_BLOCK ? numDataElements - i : SAMPLE_VALUE_BLOCK;
+      getSampleValues(&from, i, n, values);
+      for(j = 0; j < n; j++) {
+        values[j] *= sampleMultiplier;
+      }
+      setSampleValues(&to, i, n, values);
+    }
+  }
+  if(sound->mappedFile) {
+    unmapSoundFile(sound);
+  }
+  else {
+    free(sound->rawData);
+  }
+  sound->rawData = newData;
+  sound->dataSize = numDataElements * target / 8;
+  sound->bitDepth = target;
 }
 
-int ensureSoundsMixable(sound_t* s1, sound_t* s2, fileType_t resultType) {
-  if(ensureSoundsCombinable(s1, s2, resultType) == -1) {
-    return -1;
-  }
-  ensureNumChannels(s1, s2);
-  ensureChannelLength(s1, s2);
-  return 0;
+sampleBuffer_t makeSampleBuffer(void* data, unsigned short bitDepth, char isUnsigned, uint64_t numValues) {
+  sampleBuffer_t buffer;
+  buffer.u8 = (uint8_t*)data;
+  buffer.s8 = (int8_t*)data;
+  buffer.s16 = (int16_t*)data;
+  buffer.s32 = (int32_t*)data;
+  buffer.f32 = (float*)data;
+  buffer.numValues = numValues;
+  buffer.bitDepth = bitDepth;
+  buffer.valueSize = bitDepth / 8;
+  buffer.isUnsigned = bitDepth == 8 && isUnsigned;
+  return buffer;
 }
 
-int ensureSoundsCombinable(sound_t* s1, sound_t* s2, fileType_t resultType) {
-  if(s1->sampleRate != s2->sampleRate) {
-    return -1;
+void alignSampleData(sound_t* sound) {
+  /* packed 24-bit samples are only read a byte at a time */
+  uintptr_t alignment = sound->bitDepth == 24 ? 1 : sound->bitDepth / 8;
+  if(alignment > 1 && (uintptr_t)sound->rawData % alignment != 0) {
+    /* a data chunk at an odd place in a mapped file */
+    ensureDataAllocated(sound);
   }
-  convertToFileType(resultType, s1);
-  convertToFileType(resultType, s2);
-  ensureBitDepth(s1, s2);
-  return 0;
 }
 
-void ensureBitDepth(sound_t* s1, sound_t* s2) {
-  if(s1->bitDepth > s2->bitDepth) {    
-    scaleBitDepth(s1->bitDepth, s2);
-  }
-  else if(s1->bitDepth < s2->bitDepth) {
-    scaleBitDepth(s2->bitDepth, s1);
-  }
+sampleBuffer_t getSampleBuffer(sound_t* sound) {
+  alignSampleData(sound);
+  return makeSampleBuffer(sound->rawData, sound->bitDepth, 
+    sound->fileType != CS229 && sound->sampleFormat == INTEGER_SAMPLES, 
+    calculateTotalDataElements(sound));
 }
 
-void ensureNumChannels(sound_t* s1, sound_t* s2) {
-  if(s1->numChannels > s2->numChannels) {
-    int numChannelsToAdd = s1->numChannels - s2->numChannels;
-    addZeroedChannels(numChannelsToAdd, s2);
+void getSampleValues(sampleBuffer_t* buffer, uint64_t first, size_t n, int32_t* values) {
+  size_t i;
+  if(buffer->isUnsigned) {
+    uint8_t* data = buffer->u8 + first;
+    for(i = 0; i < n; i++) {
+      values[i] = data[i] - 128;
+    }
   }
-  else if(s1->numChannels < s2->numChannels) {
-    int numChannelsToAdd = s2->numChannels - s1->numChannels;
-    addZeroedChannels(numChannelsToAdd, s1);
+  else if(buffer->bitDepth == 8) {
+    int8_t* data = buffer->s8 + first;
+    for(i = 0; i < n; i++) {
+      values[i] = data[i];
+    }
   }
-}
-
-void ensureChannelLength(sound_t* s1, sound_t* s2) {
-  unsigned int numDataPerChannelS1 = calculateNumSamples(s1); 
-  unsigned int numDataPerChannelS2 = calculateNumSamples(s2);
-  if(numDataPerChannelS1 > numDataPerChannelS2) {
-    unsigned int numDataToAdd = numDataPerChannelS1 - numDataPerChannelS2;
-    addSamplesToEndOfSound(s2, numDataToAdd);
+  else if(buffer->bitDepth == 16) {
+    int16_t* data = buffer->s16 + first;
+    for(i = 0; i < n; i++) {
+      values[i] = data[i];
+    }
   }
-  else if(numDataPerChannelS2 > numDataPerChannelS1) {
-    unsigned int numDataToAdd = numDataPerChannelS2 - numDataPerChannelS1;
-    addSamplesToEndOfSound(s1, numDataToAdd);
+  else if(buffer->bitDepth == 24) {
+    unpackSamples24(buffer->u8 + first * 3, values, n);
+  }
+  else if(buffer->bitDepth == 32) {
+    memcpy(values, buffer->s32 + first, n * sizeof(int32_t));
   }
 }
 
-void addSamplesToEndOfSound(sound_t* sound, unsigned int numSamples) {
-  void* newData;
-  unsigned int addedDataSize = numSamples * sound->numChannels * sound->bitDepth / 8;
-  sound->dataSize += addedDataSize;
-  newData = realloc(sound->rawData, sound->dataSize);
-  if(!newData) {
-    sound->error = ERROR_MEMORY;
+void setSampleValues(sampleBuffer_t* buffer, uint64_t first, size_t n, int32_t* values) {
+  size_t i;
+  if(buffer->isUnsigned) {
+    uint8_t* data = buffer->u8 + first;
+    for(i = 0; i < n; i++) {
+      data[i] = values[i] + 128;
+    }
   }
-  sound->rawData = newData;
-  while(numSamples) {
-    addSample(sound, calculateNumSamples(sound) - numSamples--);
+  else if(buffer->bitDepth == 8) {
+    int8_t* data = buffer->s8 + first;
+    for(i = 0; i < n; i++) {
+      data[i] = values[i];
+    }
+  }
+  else if(buffer->bitDepth == 16) {
+    int16_t* data = buffer->s16 + first;
+    for(i = 0; i < n; i++) {
+      data[i] = values[i];
+    }
+  }
+  else if(buffer->bitDepth == 24) {
+    packSamples24(values, buffer->u8 + first * 3, n);
+  }
+  else if(buffer->bitDepth == 32) {
+    memcpy(buffer->s32 + first, values, n * sizeof(int32_t));
   }
 }
 
-/*TODO: fix this */
-void addSample(sound_t* sound, unsigned int sampleIndex) {
-  int i;
-  if(sound->bitDepth == 8 && sound->fileType == CS229) {
-    char* charData = (char*)sound->rawData;
-    for(i = 0; i < sound->numChannels; i++) {
-      charData[sampleIndex * sound->numChannels + i] = 0;
+void getChannelValues(sampleBuffer_t* buffer, unsigned short numChannels, uint64_t first, size_t n, int32_t* values) {
+  size_t i;
+  uint64_t j = first;
+  if(buffer->isUnsigned) {
+    for(i = 0; i < n; i++, j += numChannels) {
+      values[i] = buffer->u8[j] - 128;
     }
   }
-  else if(sound->bitDepth == 8 && sound->fileType == WAVE) {
-    unsigned char* uCharData = (unsigned char*)sound->rawData;
-    for(i = 0; i < sound->numChannels; i++) {
-      uCharData[sampleIndex * sound->numChannels + i] = 127;
+  else if(buffer->bitDepth == 8) {
+    for(i = 0; i < n; i++, j += numChannels) {
+      values[i] = buffer->s8[j];
     }
   }
-  else if(sound->bitDepth == 16) {
-    short* shortData = (short*)sound->rawData;
-    for(i = 0; i < sound->numChannels; i++) {
-      shortData[sampleIndex * sound->numChannels + i] = 0;
+  else if(buffer->bitDepth == 16) {
+    for(i = 0; i < n; i++, j += numChannels) {
+      values[i] = buffer->s16[j];
     }
   }
-  else if(sound->bitDepth == 32) {
-    long* longData = (long*)sound->rawData;
-    for(i = 0; i < sound->numChannels; i++) {
-      longData[sampleIndex * sound->numChannels + i] = 0;
+  else if(buffer->bitDepth == 24) {
+    for(i = 0; i < n; i++, j += numChannels) {
+      unpackSamples24(&buffer->u8[j * 3], &values[i], 1);
     }
   }
-} 
-
-float ipow(int base, int exp) {
-  int i; 
-  float origBase, fBase;
-  fBase = origBase = (float)base;
-  if(exp < 0 ) {
-    return 0;
-  }
-  if(exp == 0) {
-    return 1;
-  }
-  for(i = 0; i < exp; i++) {
-    fBase *= origBase;
+  else if(buffer->bitDepth == 32) {
+    for(i = 0; i < n; i++, j += numChannels) {
+      values[i] = buffer->s32[j];
+    }
   }
-  return fBase;
 }
 
-void convertToBitsPerData(int bitsPerData, sound_t* sound ) {
-  unsigned int numDataElements = calculateTotalDataElements(sound);
-  if(sound->bitDepth == bitsPerData) {
-    return;
+void setChannelValues(sampleBuffer_t* buffer, unsigned short numChannels, uint64_t first, size_t n, int32_t* values) {
+  size_t i;
+  uint64_t j = first;
+  if(buffer->isUnsigned) {
+    for(i = 0; i < n; i++, j += numChannels) {
+      buffer->u8[j] = values[i] + 128;
+    }
   }
-  if(sound->bitDepth > bitsPerData) {
-    /* TODO: REMOVE TEST PRINT */
-    printf("Programmer: you tried to convert bitDepth down.");
-    return;
+  else if(buffer->bitDepth == 8) {
+    for(i = 0; i < n; i++, j += numChannels) {
+      buffer->s8[j] = values[i];
+    }
   }
-  if(sound->bitDepth == 8) {
-    char* charData = (char*)sound->rawData;
-    if(bitsPerData == 16) {
-      short* shortData = malloc(sizeof(short) * numDataElements);
-      while(numDataElements--) {
-        shortData[numDataElements] = (short)charData[numDataElements];
-      }
-      sound->rawData = shortData;
+  else if(buffer->bitDepth == 16) {
+    for(i = 0; i < n; i++, j += numChannels) {
+      buffer->s16[j] = values[i];
     }
-    else if(bitsPerData == 32) {
-      long* longData = malloc(sizeof(long) * numDataElements);
-      while(numDataElements--) {
-        longData[numDataElements] = (long)charData[numDataElements];
-      }
-      sound->rawData = longData;
-      free(charData);
+  }
+  else if(buffer->bitDepth == 24) {
+    for(i = 0; i < n; i++, j += numChannels) {
+      packSamples24(&values[i], &buffer->u8[j * 3], 1);
     }
   }
-  else if(sound->bitDepth == 16) {
-    short* shortData = (short*)sound->rawData;
-    if(bitsPerData == 32) {
-      long* longData = malloc(sizeof(long) * numDataElements);
-      while(numDataElements--) {
-        longData[numDataElements] = (long)shortData[numDataElements];
-      }
-      sound->rawData = longData;
-      free(shortData);
+  else if(buffer->bitDepth == 32) {
+    for(i = 0; i < n; i++, j += numChannels) {
+      buffer->s32[j] = values[i];
     }
   }
-  sound->dataSize *= bitsPerData / sound->bitDepth;
-  sound->bitDepth *= bitsPerData / sound->bitDepth;
 }
 
-void scaleBitDepth(int target, sound_t* sound) {
-  float sampleMultiplier = ipow(2, target) / ipow(2, sound->bitDepth);
-  int i;
-  unsigned int numDataElements = calculateTotalDataElements(sound);
-  convertToBitsPerData(target, sound);
-  if(sound->bitDepth == 8) {
-    char* charData = (char*)sound->rawData;
-    for(i = 0; i < numDataElements; i++) {
-      charData[i] *= sampleMultiplier;
-    }
+void convertToFloatSamples(sound_t* sound) {
+  uint64_t numDataElements = calculateTotalDataElements(sound);
+  /* full scale of the integers, which becomes 1.0 */
+  float scale = 1.0f / ((uint32_t)1 << (sound->bitDepth - 1));
+  int32_t values[SAMPLE_VALUE_BLOCK];
+  sampleBuffer_t buffer;
+  float* floatData;
+  uint64_t i;
+  size_t j;
+  if(sound->sampleFormat == FLOAT_SAMPLES) {
+    return;
   }
-  else if(sound->bitDepth == 16) {
-    short* shortData = (short*)sound->rawData;
-    for(i = 0; i < numDataElements; i++) {
-      shortData[i] *= sampleMultiplier;
-    }
+  floatData = malloc(numDataElements * sizeof(float));
+  if(!floatData && numDataElements > 0) {
+    sound->error = ERROR_MEMORY;
+    return;
   }
-  else if(sound->bitDepth == 32) {
-    long* longData = (long*)sound->rawData;
-    for(i = 0; i < numDataElements; i++) {
-      longData[i] *= sampleMultiplier;
+  buffer = getSampleBuffer(sound);
+  for(i = 0; i < numDataElements; i += SAMPLE_VALUE_BLOCK) {
+    size_t n = numDataElements - i < SAMPLE_VALUE_BLOCK ? numDataElements - i : SAMPLE_VALUE_BLOCK;
+    getSampleValues(&buffer, i, n, values);
+    for(j = 0; j < n; j++) {
+      floatData[i + j] = values[j] * scale;
     }
   }
-  sound->bitDepth = target;
+  if(sound->mappedFile) {
+    unmapSoundFile(sound);
+  }
+  else {
+    free(sound->rawData);
+  }
+  sound->rawData = floatData;
+  sound->dataSize = numDataElements * sizeof(float);
+  sound->bitDepth = 32;
+  sound->sampleFormat = FLOAT_SAMPLES;
 }
 
-void addZeroedChannels(int howMany, sound_t* sound) {
-  int i, j, k, newLastIndex;
-  int newNumChannels = sound->numChannels + howMany;
-  int numAdditionalData = howMany * calculateNumSamples(sound);
-  int newSize = sound->dataSize + numAdditionalData * sound->bitDepth / 8;
-  void* newData = realloc(sound->rawData, newSize);
-  if(!newData) {
+void quantizeSamples(int bitDepth, sound_t* sound) {
+  uint64_t numDataElements = calculateTotalDataElements(sound);
+  int32_t values[SAMPLE_VALUE_BLOCK];
+  float* floatData = (float*)sound->rawData;
+  sampleBuffer_t buffer;
+  void* newData;
+  uint64_t i;
+  if(sound->sampleFormat != FLOAT_SAMPLES) {
+    return;
+  }
+  newData = malloc(numDataElements * bitDepth / 8);
+  if(!newData && numDataElements > 0) {
     sound->error = ERROR_MEMORY;
     return;
   }
+  buffer = makeSampleBuffer(newData, bitDepth, sound->fileType != CS229, numDataElements);
+  for(i = 0; i < numDataElements; i += SAMPLE_VALUE_BLOCK) {
+    size_t n = numDataElements - i < SAMPLE_VALUE_BLOCK ? numDataElements - i : SAMPLE_VALUE_BLOCK;
+    quantizeValues(&floatData[i], n, bitDepth, values);
+    setSampleValues(&buffer, i, n, values);
+  }
+  if(sound->mappedFile) {
+    unmapSoundFile(sound);
+  }
+  else {
+    free(sound->rawData);
+  }
   sound->rawData = newData;
+  sound->dataSize = numDataElements * bitDepth / 8;
+  sound->bitDepth = bitDepth;
+  sound->sampleFormat = INTEGER_SAMPLES;
+}
+
+void quantizeValues(float* floats, size_t n, int bitDepth, int32_t* values) {
+  /* doubles so that the 32-bit full scale is exact */
+  double scale = (double)((uint32_t)1 << (bitDepth - 1));
+  double maxValue = scale - 1;
+  size_t i;
+  for(i = 0; i < n; i++) {
+    double value = floats[i] * scale;
+    /* clipping symmetrically also keeps CS229 samples off MIN_VALUE, and
+      selects rather than branches let the loop be vectorized */
+    value = value > maxValue ? maxValue : value;
+    value = value < -maxValue ? -maxValue : value;
+    values[i] = (int32_t)(value + (value < 0 ? -0.5 : 0.5));
+  }
+}
+
+void unpackSamples24(unsigned char* packed, int32_t* values, size_t n) {
+  size_t i = 0;
+  uint32_t w0, w1, w2;
+  /* four samples are three whole words, which beats assembling them a byte
+     at a time; the arithmetic shifts copy the sign bit down */
+  for(; i + 4 <= n; i += 4, packed += 12) {
+    memcpy(&w0, packed, 4);
+    memcpy(&w1, packed + 4, 4);
+    memcpy(&w2, packed + 8, 4);
+    values[i] = (int32_t)(w0 << 8) >> 8;
+    values[i + 1] = (int32_t)((w0 >> 24 | w1 << 8) << 8) >> 8;
+    values[i + 2] = (int32_t)((w1 >> 16 | w2 << 16) << 8) >> 8;
+    values[i + 3] = (int32_t)w2 >> 8;
+  }
+  for(; i < n; i++, packed += 3) {
+    w0 = (uint32_t)packed[0] << 8 | (uint32_t)packed[1] << 16 | (uint32_t)packed[2] << 24;
+    values[i] = (int32_t)w0 >> 8;
+  }
+}
+
+void packSamples24(int32_t* values, unsigned char* packed, size_t n) {
+  size_t i = 0;
+  uint32_t w0, w1, w2;
+  for(; i + 4 <= n; i += 4, packed += 12) {
+    w0 = ((uint32_t)values[i] & 0xFFFFFF) | (uint32_t)values[i + 1] << 24;
+    w1 = ((uint32_t)values[i + 1] >> 8 & 0xFFFF) | (uint32_t)values[i + 2] << 16;
+    w2 = ((uint32_t)values[i + 2] >> 16 & 0xFF) | (uint32_t)values[i + 3] << 8;
+    memcpy(packed, &w0, 4);
+    memcpy(packed + 4, &w1, 4);
+    memcpy(packed + 8, &w2, 4);
+  }
+  for(; i < n; i++, packed += 3) {
+    w0 = (uint32_t)values[i];
+    packed[0] = w0;
+    packed[1] = w0 >> 8;
+    packed[2] = w0 >> 16;
+  }
+}
+
+channelMatrix_t* makeChannelMatrix(unsigned short numInputs, unsigned short numOutputs) {
+  channelMatrix_t* matrix = malloc(sizeof(channelMatrix_t));
+  if(!matrix) {
+    return NULL;
+  }
+  matrix->numInputs = numInputs;
+  matrix->numOutputs = numOutputs;
+  matrix->gains = calloc((size_t)numInputs * numOutputs + 1, sizeof(float));
+  if(!matrix->gains) {
+    free(matrix);
+    return NULL;
+  }
+  return matrix;
+}
 
-  newLastIndex = calculateNumSamples(sound) * sound->numChannels + numAdditionalData - 1;
-  j = calculateNumSamples(sound) * sound->numChannels;
-  if(sound->bitDepth == 8 && sound->fileType == WAVE) {
-    unsigned char* uCharData = (unsigned char*)sound->rawData;
-    for(i = newLastIndex; i >= newNumChannels - 1; i-=(newNumChannels) ) {
-      for(k = 0; k < howMany; k++) {
-        uCharData[i-k] = 127;
+channelMatrix_t* parseChannelMatrix(char* text) {
+  channelMatrix_t* matrix;
+  unsigned long numInputs = 1, numOutputs = 1, gainsInRow = 1;
+  char* endPtr;
+  size_t i;
+  /* count the rows and check that each has as many gains as the first */
+  for(i = 0; text[i] != '\0'; i++) {
+    if(text[i] == ',') {
+      gainsInRow++;
+    }
+    else if(text[i] == ';') {
+      if(numOutputs == 1) {
+        numInputs = gainsInRow;
       }
-      for(k = i - howMany; k > i - newNumChannels; k--) {
-        uCharData[k] = uCharData[--j];
+      else if(gainsInRow != numInputs) {
+        return NULL;
       }
+      numOutputs++;
+      gainsInRow = 1;
     }
   }
-  else if(sound->bitDepth == 8 && sound->fileType == CS229) {
-    signed char* charData = (signed char*)sound->rawData;
-    for(i = newLastIndex; i >= newNumChannels - 1; i-=(newNumChannels) ) {
-      for(k = 0; k < howMany; k++) {
-        charData[i-k] = 0;
-      }
-      for(k = i - howMany; k > i - newNumChannels; k--) {
-        charData[k] = charData[--j];
+  if(numOutputs == 1) {
+    numInputs = gainsInRow;
+  }
+  if(gainsInRow != numInputs || numInputs > USHRT_MAX || numOutputs > USHRT_MAX) {
+    return NULL;
+  }
+  matrix = makeChannelMatrix(numInputs, numOutputs);
+  if(!matrix) {
+    return NULL;
+  }
+  for(i = 0; i < numInputs * numOutputs; i++) {
+    matrix->gains[i] = strtof(text, &endPtr);
+    /* every gain is a finite number followed by the separator counted above */
+    if(endPtr == text || (*endPtr != ',' && *endPtr != ';' && *endPtr != '\0')
+        || !isfinite(matrix->gains[i])) {
+      freeChannelMatrix(matrix);
+      return NULL;
+    }
+    text = *endPtr == '\0' ? endPtr : endPtr + 1;
+  }
+  return matrix;
+}
+
+void freeChannelMatrix(channelMatrix_t* matrix) {
+  free(matrix->gains);
+  free(matrix);
+}
+
+void applyChannelMatrix(float* from, float* to, size_t numFrames, channelMatrix_t* matrix) {
+  unsigned int numInputs = matrix->numInputs;
+  unsigned int numOutputs = matrix->numOutputs;
+  float* gains = matrix->gains;
+  size_t j;
+  unsigned int o, c;
+  if(numInputs == 2 && numOutputs == 1) {
+    getSampleKernels()->downmixF32(from, to, numFrames, gains[0], gains[1]);
+    return;
+  }
+  for(j = 0; j < numFrames; j++) {
+    for(o = 0; o < numOutputs; o++) {
+      float* row = &gains[o * numInputs];
+      float sum = from[j * numInputs] * row[0];
+      for(c = 1; c < numInputs; c++) {
+        sum += from[j * numInputs + c] * row[c];
       }
+      to[j * numOutputs + o] = sum;
     }
   }
-  else if(sound->bitDepth == 16) {
-    short* shortData = (short*)sound->rawData;
-     for(i = newLastIndex; i >= newNumChannels - 1; i-=(newNumChannels) ) {
-      for(k = 0; k < howMany; k++) {
-        shortData[i-k] = 0;
+}
+
+char isChannelRouting(channelMatrix_t* matrix, int* sources) {
+  unsigned int o, c;
+  for(o = 0; o < matrix->numOutputs; o++) {
+    float* row = &matrix->gains[o * matrix->numInputs];
+    sources[o] = -1;
+    for(c = 0; c < matrix->numInputs; c++) {
+      if(row[c] == 0) {
+        continue;
       }
-      for(k = i - howMany; k > i - newNumChannels; k--) {
-        shortData[k] = shortData[--j];
+      if(row[c] != 1 || sources[o] != -1) {
+        return 0;
       }
+      sources[o] = c;
     }
   }
-  else if(sound->bitDepth == 32) {
-    long* longData = (long*)sound->rawData;
-    for(i = newLastIndex; i >= newNumChannels - 1; i-=(newNumChannels) ) {
-      for(k = 0; k < howMany; k++) {
-        longData[i-k] = 0;
+  return 1;
+}
+
+int routeChannels(sampleBuffer_t* from, sampleBuffer_t* to, uint64_t numSamples, channelMatrix_t* matrix, int* sources) {
+  size_t valueSize = from->valueSize;
+  size_t fromFrameSize = matrix->numInputs * valueSize;
+  size_t toFrameSize = matrix->numOutputs * valueSize;
+  /* runs of outputs copied from neighboring inputs, in bytes */
+  size_t* runFrom = malloc(matrix->numOutputs * sizeof(size_t));
+  size_t* runTo = malloc(matrix->numOutputs * sizeof(size_t));
+  size_t* runSize = malloc(matrix->numOutputs * sizeof(size_t));
+  unsigned int numRuns = 0;
+  unsigned int o, r;
+  uint64_t i;
+  uint8_t *fromFrame, *toFrame;
+  if(!runFrom || !runTo || !runSize) {
+    free(runFrom);
+    free(runTo);
+    free(runSize);
+    return -1;
+  }
+  for(o = 0; o < matrix->numOutputs; o++) {
+    if(sources[o] == -1) {
+      continue;
+    }
+    if(numRuns > 0 && runTo[numRuns - 1] + runSize[numRuns - 1] == o * valueSize
+        && runFrom[numRuns - 1] + runSize[numRuns - 1] == sources[o] * valueSize) {
+      runSize[numRuns - 1] += valueSize;
+      continue;
+    }
+    runFrom[numRuns] = sources[o] * valueSize;
+    runTo[numRuns] = o * valueSize;
+    runSize[numRuns++] = valueSize;
+  }
+  fromFrame = from->u8;
+  toFrame = to->u8;
+  for(i = 0; i < numSamples; i++, fromFrame += fromFrameSize, toFrame += toFrameSize) {
+    for(r = 0; r < numRuns; r++) {
+      /* constant sizes let the copies of single values be inlined */
+      if(runSize[r] == 2) {
+        memcpy(&toFrame[runTo[r]], &fromFrame[runFrom[r]], 2);
+      }
+      else if(runSize[r] == 4) {
+        memcpy(&toFrame[runTo[r]], &fromFrame[runFrom[r]], 4);
       }
-      for(k = i - howMany; k > i - newNumChannels; k--) {
-        longData[k] = longData[--j];
+      else {
+        memcpy(&toFrame[runTo[r]], &fromFrame[runFrom[r]], runSize[r]);
       }
     }
   }
-  else {
-    sound->error = ERROR_BIT_DEPTH;
+  free(runFrom);
+  free(runTo);
+  free(runSize);
+  return 0;
+}
+
+int mixChannels(sampleBuffer_t* from, sampleBuffer_t* to, sampleFormat_t sampleFormat, uint64_t numSamples, channelMatrix_t* matrix) {
+  unsigned int numInputs = matrix->numInputs;
+  unsigned int numOutputs = matrix->numOutputs;
+  unsigned int maxChannels = numInputs > numOutputs ? numInputs : numOutputs;
+  /* as many frames as fit in a SAMPLE_VALUE_BLOCK of values */
+  size_t framesPerBlock = maxChannels < SAMPLE_VALUE_BLOCK ? SAMPLE_VALUE_BLOCK / maxChannels : 1;
+  float scale = 1.0f / ((uint32_t)1 << (from->bitDepth - 1));
+  int32_t* values = malloc(framesPerBlock * maxChannels * sizeof(int32_t));
+  float* inputs = malloc(framesPerBlock * numInputs * sizeof(float));
+  float* outputs = malloc(framesPerBlock * numOutputs * sizeof(float));
+  uint64_t i;
+  size_t j, n;
+  if(!values || !inputs || !outputs) {
+    free(values);
+    free(inputs);
+    free(outputs);
+    return -1;
+  }
+  for(i = 0; i < numSamples; i += framesPerBlock) {
+    float *in, *out;
+    n = numSamples - i < framesPerBlock ? numSamples - i : framesPerBlock;
+    if(sampleFormat == FLOAT_SAMPLES) {
+      in = &from->f32[i * numInputs];
+      out = &to->f32[i * numOutputs];
+    }
+    else {
+      getSampleValues(from, i * numInputs, n * numInputs, values);
+      for(j = 0; j < n * numInputs; j++) {
+        inputs[j] = values[j] * scale;
+      }
+      in = inputs;
+      out = outputs;
+    }
+    applyChannelMatrix(in, out, n, matrix);
+    if(sampleFormat == INTEGER_SAMPLES) {
+      quantizeValues(outputs, n * numOutputs, to->bitDepth, values);
+      setSampleValues(to, i * numOutputs, n * numOutputs, values);
+    }
   }
-  sound->dataSize = newSize;
-  sound->numChannels = newNumChannels;
+  free(values);
+  free(inputs);
+  free(outputs);
+  return 0;
 }
 
-void isolateChannel(sound_t* sound, unsigned int channelNum) {
-  int i, j, newDataSize;
-  void* newData;
-  char* charData = (char*)sound->rawData;
-  int bytesPerData = sound->bitDepth / 8;
-  int numSamples = calculateNumSamples(sound);
-  if(sound->numChannels == 1) {
+void remixChannels(sound_t* sound, channelMatrix_t* matrix) {
+  uint64_t numSamples = calculateNumSamples(sound);
+  const sampleKernels_t* kernels = getSampleKernels();
+  sampleBuffer_t from, to;
+  int* sources = malloc(matrix->numOutputs * sizeof(int));
+  void* newData = malloc(numSamples * matrix->numOutputs * sound->bitDepth / 8);
+  int error = 0;
+  if(!sources || (!newData && numSamples * matrix->numOutputs > 0)) {
+    free(sources);
+    free(newData);
+    sound->error = ERROR_MEMORY;
     return;
   }
-  for(i = 0; i < numSamples; i++) {
-    for(j = 0; j < bytesPerData; j++) {
-      charData[i * bytesPerData + j] = charData[(i * sound->numChannels + channelNum) * bytesPerData + j];
+  from = getSampleBuffer(sound);
+  to = makeSampleBuffer(newData, sound->bitDepth, from.isUnsigned, numSamples * matrix->numOutputs);
+  if(!isChannelRouting(matrix, sources)) {
+    error = mixChannels(&from, &to, sound->sampleFormat, numSamples, matrix);
+  }
+  else if(matrix->numInputs == 1 && matrix->numOutputs == 2 && sources[0] == 0 && sources[1] == 0 
+      && from.valueSize != 3) {
+    if(from.valueSize == 1) {
+      kernels->duplicate8(from.u8, to.u8, numSamples);
+    }
+    else if(from.valueSize == 2) {
+      kernels->duplicate16((uint16_t*)from.s16, (uint16_t*)to.s16, numSamples);
+    }
+    else {
+      kernels->duplicate32((uint32_t*)from.s32, (uint32_t*)to.s32, numSamples);
     }
   }
-  newDataSize = numSamples * bytesPerData;
-  newData = realloc(sound->rawData, newDataSize);
-  if(!newData) {
+  else {
+    /* zero bits are silence for everything but unsigned 8-bit samples */
+    memset(newData, to.isUnsigned ? 128 : 0, numSamples * matrix->numOutputs * to.valueSize);
+    error = routeChannels(&from, &to, numSamples, matrix, sources);
+  }
+  free(sources);
+  if(error == -1) {
+    free(newData);
     sound->error = ERROR_MEMORY;
     return;
   }
+  if(sound->mappedFile) {
+    unmapSoundFile(sound);
+  }
+  else {
+    free(sound->rawData);
+  }
   sound->rawData = newData;
-  sound->dataSize = newDataSize;
-  sound->numChannels = 1;
+  sound->dataSize = numSamples * matrix->numOutputs * to.valueSize;
+  sound->numChannels = matrix->numOutputs;
 }
 
-void deepCopySound(sound_t* dest, sound_t* src) {
-  int i;
-  char *destCharData, *srcCharData, *newFileName;
-  void* newData;
-  srcCharData = (char*)src->rawData;
-  dest->sampleRate = src->sampleRate;
-  dest->fileType = src->fileType;
-  newFileName = realloc(dest->fileName, strlen(src->fileName) + 1);
-  if(!newFileName) {
-    dest->error = ERROR_MEMORY;
+void addZeroedChannels(int howMany, sound_t* sound) {
+  unsigned int c;
+  channelMatrix_t* matrix = makeChannelMatrix(sound->numChannels, sound->numChannels + howMany);
+  if(!matrix) {
+    sound->error = ERROR_MEMORY;
     return;
   }
-  dest->fileName = newFileName;
-  strcpy(dest->fileName, src->fileName);
-  newData = realloc(dest->rawData, src->dataSize);
-  if(!newData) {
-    dest->error = ERROR_MEMORY;
-    return;
+  /* the channels kept, followed by silent ones */
+  for(c = 0; c < sound->numChannels; c++) {
+    matrix->gains[c * sound->numChannels + c] = 1;
+  }
+  remixChannels(sound, matrix);
+  freeChannelMatrix(matrix);
+}
+
+void matchSampleFormat(sound_t* sound, sound_t* format) {
+  if(format->sampleFormat == FLOAT_SAMPLES) {
+    convertToFloatSamples(sound);
   }
-  dest->rawData = newData;
-  destCharData = (char*)dest->rawData;
-  for(i = 0; i < src->dataSize; i++) {
-    destCharData[i] = srcCharData[i];
+  else if(sound->sampleFormat == FLOAT_SAMPLES) {
+    /* quantize once, straight to the bitDepth and layout being written */
+    sound->fileType = format->fileType;
+    quantizeSamples(format->bitDepth, sound);
   }
-  dest->dataSize = src->dataSize;
-  dest->error = src->error;
-  dest->numChannels = src->numChannels;
-  dest->bitDepth = src->bitDepth;
-} 
+  convertToFileType(format->fileType, sound);
+  if(sound->bitDepth < format->bitDepth) {
+    scaleBitDepth(format->bitDepth, sound);
+  }
+}
+
+void matchSoundFormat(sound_t* sound, sound_t* format) {
+  matchSampleFormat(sound, format);
+  if(sound->numChannels < format->numChannels) {
+    addZeroedChannels(format->numChannels - sound->numChannels, sound);
+  }
+}
 
-writeError_t writeSoundToFile(sound_t* sound, FILE* fp, fileType_t outputType) { 
+writeError_t writeSoundHeader(sound_t* sound, FILE* fp, fileType_t outputType) {
   if(outputType == CS229) {
-    writeCs229File(sound, fp);
+    return writeCs229Header(sound, fp);
   }
-  else if(outputType == WAVE) {
-    writeWaveFile(sound, fp);
+  if(outputType == SNDZ) {
+    return writeSndzHeader(sound, fp);
   }
-  return 0;
+  return writeWaveHeader(sound, fp);
+}
+
+writeError_t writeSoundSamples(sound_t* block, FILE* fp, fileType_t outputType) {
+  if(outputType == CS229) {
+    return writeCs229Samples(block, fp);
+  }
+  if(outputType == SNDZ) {
+    return writeSndzSamples(block, fp);
+  }
+  return writeWaveSamples(block, fp);
+}
+
+writeError_t finishSoundFile(sound_t* sound, FILE* fp, fileType_t outputType, uint64_t dataSizeWritten) {
+  if(outputType == CS229) {
+    /* the Samples line cannot be corrected afterwards */
+    return dataSizeWritten == sound->dataSize ? WRITE_SUCCESS : WRITE_ERROR_TOO_FEW_CHARS;
+  }
+  if(outputType == SNDZ) {
+    return finishSndzFile(sound, fp, dataSizeWritten);
+  }
+  return finishWaveFile(sound, fp, dataSizeWritten);
+}
+
+writeError_t copySoundStream(soundStream_t* stream, FILE* fp, uint64_t* dataSizeWritten) {
+  sound_t* header = stream->sound;
+  uint64_t remaining = stream->samplesRemaining * header->numChannels * header->bitDepth / 8;
+  struct stat inStat;
+  off_t inOffset;
+  char* buffer;
+  if(header->error != NO_ERROR || WAVE != header->fileType) {
+    return WRITE_SUCCESS;
+  }
+  inOffset = ftell(stream->file);
+  if(inOffset >= 0 && fstat(fileno(stream->file), &inStat) == 0 
+      && S_ISREG(inStat.st_mode) && fflush(fp) == 0) {
+    size_t copied = kernelCopy(fileno(stream->file), &inOffset, fileno(fp), remaining);
+    off_t outOffset = lseek(fileno(fp), 0, SEEK_CUR);
+    remaining -= copied;
+    *dataSizeWritten += copied;
+    /* bring both stdio streams up to where the kernel left the files */
+    if(fseek(stream->file, inOffset, SEEK_SET) != 0) {
+      header->error = ERROR_READING;
+      return WRITE_SUCCESS;
+    }
+    if(outOffset >= 0 && fseek(fp, outOffset, SEEK_SET) != 0) {
+      return WRITE_ERROR_SEEKING;
+    }
+  }
+  stream->samplesRemaining = 0;
+  if(remaining == 0) {
+    return WRITE_SUCCESS;
+  }
+  /* pipes and anything the kernel would not copy go through a buffer */
+  buffer = malloc(FILE_READER_BLOCK_SIZE);
+  if(!buffer) {
+    return WRITE_ERROR_MEMORY;
+  }
+  while(remaining) {
+    size_t n = remaining < FILE_READER_BLOCK_SIZE ? remaining : FILE_READER_BLOCK_SIZE;
+    header->error = readBytes(buffer, n, stream->file);
+    if(header->error != NO_ERROR) {
+      break;
+    }
+    if(fwrite(buffer, 1, n, fp) != n) {
+      free(buffer);
+      return WRITE_ERROR_TOO_FEW_CHARS;
+    }
+    remaining -= n;
+    *dataSizeWritten += n;
+  }
+  free(buffer);
+  return WRITE_SUCCESS;
+}
+
+size_t kernelCopy(int inFd, off_t* inOffset, int outFd, size_t n) {
+  size_t copied = 0;
+  ssize_t result;
+  while(copied < n) {
+    result = copy_file_range(inFd, inOffset, outFd, NULL, n - copied, 0);
+    if(result <= 0) {
+      break;
+    }
+    copied += result;
+  }
+  /* copy_file_range cannot write to pipes or cross filesystems on older kernels */
+  while(copied < n) {
+    result = sendfile(outFd, inFd, inOffset, n - copied);
+    if(result <= 0) {
+      break;
+    }
+    copied += result;
+  }
+  return copied;
 }
 
 readError_t getErrorFromSounds(sound_t** sounds, int numSounds) {
@@ -497,7 +1205,7 @@ readError_t getErrorFromSounds(sound_t** sounds, int numSounds) {
   return NO_ERROR;
 }
 
-unsigned int calculateNumSamples(sound_t* sound) {
+uint64_t calculateNumSamples(sound_t* sound) {
   if(sound->error != NO_ERROR 
       || sound->numChannels == 0 
       || sound->bitDepth == 0) {
@@ -521,35 +1229,20 @@ float calculateSoundLength(sound_t* sound) {
   return (float)sound->dataSize / calculateByteRate(sound);
 }
 
-unsigned int calculateTotalDataElements(sound_t* sound) {
+uint64_t calculateTotalDataElements(sound_t* sound) {
   return calculateNumSamples(sound) * sound->numChannels;
 }
 
-/*TODO: TEST */
 void printData(sound_t* sound) {
-  int i;
-  if(sound->bitDepth == 8 && sound->fileType == CS229) {
-    char* charData = (char*)sound->rawData;
-    for(i = 0; i < calculateNumSamples(sound) * sound->numChannels; i++) {
-      printf("%d:\t\t%d\n", i, charData[i]);
-    }
-  }
-  else if(sound->bitDepth == 8 && sound->fileType == WAVE) {
-    unsigned char* uCharData = (unsigned char*)sound->rawData;
-    for(i = 0; i < calculateNumSamples(sound) * sound->numChannels; i++) {
-      printf("%d:\t\t%d\n", i, uCharData[i]);
-    }
-  } 
-  else if(sound->bitDepth == 16) {
-    short* shortData = (short*)sound->rawData;
-    for(i = 0; i < calculateNumSamples(sound) * sound->numChannels; i++) {
-      printf("%d:\t\t%d\n", i, shortData[i]);
-    }
-  }
-  else if(sound->bitDepth == 32) {
-    long* longData = (long*)sound->rawData;
-    for(i = 0; i < calculateNumSamples(sound) * sound->numChannels; i++) {
-      printf("%d:\t\t%ld\n", i, longData[i]);
+  uint64_t i;
+  int32_t value;
+  sampleBuffer_t buffer = getSampleBuffer(sound);
+  for(i = 0; i < buffer.numValues; i++) {
+    if(sound->sampleFormat == FLOAT_SAMPLES) {
+      printf("%llu:\t\t%f\n", (unsigned long long)i, buffer.f32[i]);
+      continue;
     }
+    getSampleValues(&buffer, i, 1, &value);
+    printf("%llu:\t\t%ld\n", (unsigned long long)i, (long)value);
   }
 }
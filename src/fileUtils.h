@@ -3,15 +3,127 @@
 
 #include <stdio.h>
 #include "fileTypes.h"
+#include "fileReader.h"
 #include "writeError.h"
+#include "cs229Cache.h"
+#include "sndzUtils.h"
+
+/**
+  Number of samples the sound utilities read, convert, and write at a time when
+  streaming sounds.
+*/
+#define SOUND_BLOCK_SAMPLES 65536
+
+/**
+  Number of values getSampleValues and setSampleValues callers convert at a
+  time, which is small enough to keep on the stack.
+*/
+#define SAMPLE_VALUE_BLOCK 1024
+
+/**
+  A typed view of sample data, so that code indexes samples of the right width
+  instead of casting rawData in a ladder of bitDepths. Every pointer points at
+  the same data and the one matching the samples is used: s8 for 8-bit CS229
+  samples, u8 for unsigned 8-bit samples and the bytes of packed 24-bit ones, 
+  s16, s32, and f32 for FLOAT_SAMPLES. The data is aligned for its type.
+*/
+typedef struct {
+  uint8_t* u8;
+  int8_t* s8;
+  int16_t* s16;
+  int32_t* s32;
+  float* f32;
+  /* samples times channels */
+  uint64_t numValues;
+  unsigned short bitDepth;
+  /* bytes per value, 3 for packed 24-bit values */
+  unsigned short valueSize;
+  /* 8-bit values are unsigned, with silence at 128 */
+  char isUnsigned;
+} sampleBuffer_t;
+
+/**
+  How planSoundFormat combines sounds.
+*/
+typedef enum {
+  /* one after another, as many channels as the most of any sound */
+  COMBINE_CONCATENATE,
+  /* on top of each other, as long and with as many channels as the most */
+  COMBINE_MIX,
+  /* side by side, with the channels of every sound, as long as the longest */
+  COMBINE_CHANNELS
+} combineMode_t;
+
+/**
+  A routing of numInputs channels into numOutputs channels. Output channel o 
+  is the sum of every input channel c times gains[o * numInputs + c].
+*/
+typedef struct {
+  unsigned short numInputs;
+  unsigned short numOutputs;
+  float* gains;
+} channelMatrix_t;
+
+/**
+  Used to read a sound a block of samples at a time instead of all at once. 
+  Open with openSoundStream and free with closeSoundStream.
+*/
+typedef struct {
+  /* header fields and total dataSize of the stream, rawData is not used */
+  sound_t* sound;
+  FILE* file;
+  /* only used for CS229 streams, and NULL when the samples come from the 
+    cache in sound->rawData */
+  fileReader_t* reader;
+  /* the cache file the parsed samples are added to, if caching is on */
+  cs229CacheWriter_t* cache;
+  /* only used for SNDZ streams */
+  sndzReader_t* sndz;
+  uint64_t samplesRemaining;
+} soundStream_t;
 
 /** 
   Automatically load sound by allocating memory for a sound, filling in each
   data field with the appropriate data from file, and returning the sound. must
-  later call unloadSound to free the data.
+  later call unloadSound to free the data. Regular files are memory mapped and
+  the sample data of WAVE files is used straight from the mapping. CS229 files
+  are loaded from the cache when SOUNDUTILS_CACHE is set (see cs229Cache.h),
+  and cached after they are parsed. SNDZ files are decoded into allocated 
+  memory.
 */
 sound_t* loadSound(FILE* file, char* fileName); 
 
+/**
+  Reads only the header information of the sound in file: sample rate, bit 
+  depth, channels, and data size, without reading the sample data. The 
+  returned sound has a NULL rawData and must later be passed to unloadSound.
+  Returns NULL on memory allocation error.
+*/
+sound_t* probeSound(FILE* file, char* fileName);
+
+/**
+  Reads the header of the sound in file and prepares to read its samples with
+  readSoundBlock. Header errors are reported in stream->sound->error. Returns
+  NULL on memory allocation error. CS229 samples are read from the cache when
+  it has them, and otherwise added to it as they are read.
+*/
+soundStream_t* openSoundStream(FILE* file, char* fileName);
+
+/**
+  Reads up to maxSamples samples from stream into block, setting the header 
+  fields, rawData, and dataSize of block. block is owned by the caller, who may
+  convert it freely between reads and must unloadSound it when done. Returns 
+  the number of samples read, which is 0 at the end of the stream or when an 
+  error is put in stream->sound->error.
+*/
+unsigned int readSoundBlock(soundStream_t* stream, sound_t* block, unsigned int maxSamples);
+
+/**
+  Frees the stream. Does not close its file. A cache file the stream was 
+  writing is only kept if every sample was read.
+*/
+void closeSoundStream(soundStream_t* stream);
+
 /**
   Loads a sound which only has space allocated with some default values. Fill 
   these in by calling CS229 or WAVE reading functions by hand or deepCopy'ing
@@ -26,15 +138,25 @@ sound_t* loadEmptySound();
 void unloadSound(sound_t* sound);
 
 /**
-  Reads the first few bytes of the file (either "RIFF####WAVE" or "CS229") and
-  extracts the file type from it. It then sets sound->fileType to the 
+  Copies sample data that still points into a mapped input file into allocated
+  memory so that it can be resized or freed. Sets sound->error on memory error.
+  Does nothing if the data is already allocated.
+*/
+void ensureDataAllocated(sound_t* sound);
+
+/**
+  Reads the first few bytes of the file ("RIFF####WAVE", "RF64####WAVE",
+  "CS229", or "SNDZ") 
+  and extracts the file type from it. It then sets sound->fileType to the 
   appropriate fileType_t
 */
 void getFileType(FILE* file, sound_t* sound);
 
 /** 
   Convert file to another file type. If file is already the correct type it does
-  not do anything.
+  not do anything. WAVE and SNDZ sounds hold their samples the same way, so 
+  converting between them only changes sound->fileType. Float samples are only
+  held by WAVE sounds, and are quantized to 32 bits for the other types.
 */
 void convertToFileType(fileType_t resultType, sound_t* sound);
 
@@ -51,67 +173,146 @@ void cs229ToWave(sound_t* sound);
 void waveToCs229(sound_t* sound);
 
 /**
-  Ensures bitDepths and numChannels are the same, converts them to resultType.  
-  Returns 0 on success and -1 if sampleRates are not the same.
+  Fills in the sampleRate, bitDepth, sampleFormat, numChannels, and dataSize of
+  dest, whose fileType is set, for combining the numSounds sounds in the way 
+  given by mode. Only the headers of the sounds are read, once each, so every 
+  input can then be converted straight to the format of dest. dest has the 
+  sampleRate of the first sound and the largest bitDepth. Its samples are 
+  floats if any sound's are and dest is WAVE. Sounds with another sampleRate 
+  are left out and set to NULL in sounds. Returns the number left out.
 */
-int ensureSoundsCanConcatenate(sound_t* s1, sound_t* s2, fileType_t resultType);
+int planSoundFormat(sound_t* dest, sound_t** sounds, int numSounds, combineMode_t mode);
 
 /**
-  Matches up the bitDepth of s1 and s2 and converts both to resultType. Returns
-  0 on success, and -1 if the sampleRates are not the same.
-*/ 
-int ensureSoundsCombinable(sound_t* s1, sound_t* s2, fileType_t resultType);
+  Scales the integer samples of sound up to the larger bitDepth target, which 
+  must be supported, in one pass into newly allocated data. Does nothing if 
+  target is not larger.
+*/
+void scaleBitDepth(int target, sound_t* sound);
 
 /**
-  Ensures bitDepths, numChannels, and NumSamples are the same, converts them to
-  result type. Returns 0 on success and -1 if sampleRates are not the same.
+  Makes a sampleBuffer_t of numValues values of bitDepth at data. isUnsigned 
+  says 8-bit values are unsigned, as in the WAVE and SNDZ layout. data must be
+  aligned for bitDepth.
 */
-int ensureSoundsMixable(sound_t* s1, sound_t* s2, fileType_t resultType);
+sampleBuffer_t makeSampleBuffer(void* data, unsigned short bitDepth, char isUnsigned, uint64_t numValues);
 
 /**
-  Ensures bitDepths and channel length are the same, converts them to resultType.  
-  Returns 0 on success and -1 if sampleRates are not the same.
+  Copies the sample data of sound into allocated memory if it is not aligned
+  for its bitDepth, which can only happen inside a mapped file. Sets 
+  sound->error if memory runs out. This changes sound, so do it once before 
+  sharing sound between threads, which should then only use a sampleBuffer_t
+  made from it beforehand.
 */
-int ensureSoundChannelsCombinable(sound_t* s1, sound_t* s2, fileType_t resultType);
+void alignSampleData(sound_t* sound);
 
 /**
-  Scales bitDepth of the sound (s1 or s2) with lesser bitDepth than the other.
+  Returns a sampleBuffer_t of the sample data of sound, after alignSampleData.
+  Not safe to call from threads sharing sound.
 */
-void ensureBitDepth(sound_t* s1, sound_t* s2);
+sampleBuffer_t getSampleBuffer(sound_t* sound);
 
 /**
-  Adds zeroed-out channels to the sound (s1 or s2) with fewer channels until 
-  the number of channels are equal.
+  Reads n integer values of buffer, starting at value first, into values.
+  Unsigned 8-bit values are centered on 0 and packed 24-bit values are sign 
+  extended, so values are always signed.
 */
-void ensureNumChannels(sound_t* s1, sound_t* s2);
+void getSampleValues(sampleBuffer_t* buffer, uint64_t first, size_t n, int32_t* values);
 
 /**
-  Adds samples to the sound with lesser samples until the two numSamples are
-  equal.
+  Writes n signed values into buffer, starting at value first, undoing what
+  getSampleValues does. Values that do not fit bitDepth are truncated.
 */
-void ensureChannelLength(sound_t* s1, sound_t* s2);
+void setSampleValues(sampleBuffer_t* buffer, uint64_t first, size_t n, int32_t* values);
 
 /**
-  Scales the bitDepth of sound to target. Assumes that target is a supported
-  bitDepth.
+  Does getSampleValues for every numChannels-th value from first, which reads
+  n values of one channel of interleaved frames.
 */
-void scaleBitDepth(int target, sound_t* sound);
+void getChannelValues(sampleBuffer_t* buffer, unsigned short numChannels, uint64_t first, size_t n, int32_t* values);
 
-/** 
-  Adds howMany zeroed out channels to sound.
+/**
+  Does setSampleValues for every numChannels-th value from first.
 */
-void addZeroedChannels(int howMany, sound_t* sound);
+void setChannelValues(sampleBuffer_t* buffer, unsigned short numChannels, uint64_t first, size_t n, int32_t* values);
+
+/**
+  Converts the integer samples of sound to floats from -1 to 1 and sets 
+  sound->sampleFormat to FLOAT_SAMPLES, so that they can be scaled and mixed
+  any number of times without clipping or overflowing. Does nothing if the 
+  samples are already floats.
+*/
+void convertToFloatSamples(sound_t* sound);
+
+/**
+  Rounds the float samples of sound to bitDepth-bit integers in the layout of
+  sound->fileType, clipping values past -1 or 1. Does nothing if the samples
+  are already integers.
+*/
+void quantizeSamples(int bitDepth, sound_t* sound);
+
+/**
+  Rounds n float samples to bitDepth-bit integer values, clipping them as 
+  quantizeSamples does.
+*/
+void quantizeValues(float* floats, size_t n, int bitDepth, int32_t* values);
+
+/**
+  Sign extends n packed little-endian 3-byte samples from packed into values.
+  24-bit samples are stored packed and only unpacked to be processed. Like
+  the rest of the sample code, assumes a little-endian machine.
+*/
+void unpackSamples24(unsigned char* packed, int32_t* values, size_t n);
+
+/**
+  Packs the low 24 bits of n values into packed as little-endian 3-byte 
+  samples.
+*/
+void packSamples24(int32_t* values, unsigned char* packed, size_t n);
+
+/**
+  Returns a matrix routing numInputs channels into numOutputs channels with 
+  every gain 0, or NULL on memory error. Must later call freeChannelMatrix.
+*/
+channelMatrix_t* makeChannelMatrix(unsigned short numInputs, unsigned short numOutputs);
+
+/**
+  Returns the matrix written in text as rows of gains for each output channel,
+  separated by semicolons, each with one gain for every input channel, 
+  separated by commas ("0.5,0.5" is a stereo to mono downmix, and "1;1" a mono
+  to stereo copy). Returns NULL if text is not such a matrix, if a gain is not
+  finite, or on memory error.
+*/
+channelMatrix_t* parseChannelMatrix(char* text);
+
+/**
+  Frees matrix and its gains.
+*/
+void freeChannelMatrix(channelMatrix_t* matrix);
 
 /**
-  Isolates the channelNum in sound. The sound will only have one channel after
-  this method call.
+  Routes numFrames interleaved frames of matrix->numInputs float values in 
+  from into frames of matrix->numOutputs values in to, each output the sum of
+  the inputs times their gains. Stereo to mono mixes use the downmixF32 
+  sample kernel.
 */
-void isolateChannel(sound_t* sound, unsigned int channelNum);
+void applyChannelMatrix(float* from, float* to, size_t numFrames, channelMatrix_t* matrix);
 
 /**
-  Copy the members of src to sound pointed to by dest.
+  Routes the matrix->numInputs channels of sound, which must be how many it 
+  has, into matrix->numOutputs channels in one pass over the frames, into data
+  allocated once. Outputs that copy a single input with gain 1 are copied 
+  exactly, or filled with silence when they have no inputs. Mono to stereo 
+  copies and stereo to mono mixes use the sample kernels. Other outputs are 
+  mixed as floats a SAMPLE_VALUE_BLOCK of values at a time, and integers are
+  quantized as quantizeSamples does.
+*/
+void remixChannels(sound_t* sound, channelMatrix_t* matrix);
+
+/** 
+  Adds howMany zeroed out channels to sound.
 */
-void deepCopySound(sound_t* dest, sound_t* src);
+void addZeroedChannels(int howMany, sound_t* sound);
 
 /**
   Retrieves the error data element from each sound and returns the first 
@@ -123,7 +324,7 @@ readError_t getErrorFromSounds(sound_t** sounds, int numSounds);
   Uses dataSize, bitDepth, and numChannels to calculate the number of samples 
   in the given sound.
 */
-unsigned int calculateNumSamples(sound_t* sound);
+uint64_t calculateNumSamples(sound_t* sound);
 
 /**
   Calculates the sound length in seconds
@@ -133,13 +334,48 @@ float calculateSoundLength(sound_t* sound);
 /**
   Calculates total data elements in sound sample data.
 */
-unsigned int calculateTotalDataElements(sound_t* sound);
+uint64_t calculateTotalDataElements(sound_t* sound);
+
+/**
+  Converts sound to the file type and sample format of format and raises its
+  bitDepth to that of format, leaving its channels alone. Float samples are 
+  quantized straight to the bitDepth of integer formats.
+*/
+void matchSampleFormat(sound_t* sound, sound_t* format);
+
+/**
+  Does matchSampleFormat and also raises the numChannels of sound to that of
+  format. Used to bring each block of a stream to the format of the sound 
+  being written.
+*/
+void matchSoundFormat(sound_t* sound, sound_t* format);
+
+/**
+  Writes the header for sound to fp in the given outputType, so that its 
+  samples can then be written in blocks with writeSoundSamples. 
+  sound->dataSize must be the total size of all blocks.
+*/
+writeError_t writeSoundHeader(sound_t* sound, FILE* fp, fileType_t outputType);
+
+/**
+  Writes the samples of block to fp in the given outputType. block must have
+  the format of the sound passed to writeSoundHeader.
+*/
+writeError_t writeSoundSamples(sound_t* block, FILE* fp, fileType_t outputType);
+
+/**
+  Ends a sound started with writeSoundHeader(sound, fp, outputType) after
+  dataSizeWritten bytes of samples.
+*/
+writeError_t finishSoundFile(sound_t* sound, FILE* fp, fileType_t outputType, uint64_t dataSizeWritten);
 
 /**
-  Writes the sound to the file fp (opened for writing, otherwise we'll throw
-  an error), and in the given outputType.
+  Copies the remaining samples of a WAVE stream to fp byte for byte, so they 
+  must already be in the format being written to fp. When the stream reads a 
+  regular file, the kernel copies the bytes directly. Adds the number of bytes
+  written to dataSizeWritten. Read errors are put in stream->sound->error.
 */
-writeError_t writeSoundToFile(sound_t* sound, FILE* fp, fileType_t outputType);
+writeError_t copySoundStream(soundStream_t* stream, FILE* fp, uint64_t* dataSizeWritten);
 
 /** 
   A test function to print the data values contained in the given sound.
@@ -22,7 +22,7 @@ typedef enum {
   ERROR_INVALID_KEYWORD,
   /* no value given in cs229 file */
   ERROR_NO_VALUE,
-  /* error reading sample data in cs229 file */
+  /* error reading sample data in cs229 or SNDZ file */
   ERROR_SAMPLE_DATA,
   /* found zero channels, don't read the file */
   ERROR_ZERO_CHANNELS
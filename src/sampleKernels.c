@@ -0,0 +1,682 @@
+#include "sampleKernels.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SAMPLE_KERNELS_X86
+#include <immintrin.h>
+#endif
+
+/**
+  The plain C kernels, which also finish the values left over after the
+  vector kernels' last full vector.
+*/
+void toWave8Scalar(uint8_t* data, size_t n);
+void toCs2298Scalar(uint8_t* data, size_t n);
+void trim16Scalar(int16_t* data, size_t n);
+void trim32Scalar(int32_t* data, size_t n);
+void addU8Scalar(uint8_t* dest, const uint8_t* addend, size_t n);
+void add16Scalar(int16_t* dest, const int16_t* addend, size_t n);
+void add32Scalar(int32_t* dest, const int32_t* addend, size_t n);
+void widen8To16Scalar(const uint8_t* from, int16_t* to, size_t n, uint8_t flip);
+void widen8To32Scalar(const uint8_t* from, int32_t* to, size_t n, uint8_t flip);
+void widen16To32Scalar(const int16_t* from, int32_t* to, size_t n);
+void duplicate8Scalar(const uint8_t* from, uint8_t* to, size_t n);
+void duplicate16Scalar(const uint16_t* from, uint16_t* to, size_t n);
+void duplicate32Scalar(const uint32_t* from, uint32_t* to, size_t n);
+void downmixF32Scalar(const float* from, float* to, size_t n, float leftGain, float rightGain);
+
+/**
+  Sets chosenKernels, run once by getSampleKernels.
+*/
+void chooseSampleKernels();
+
+static const sampleKernels_t scalarKernels = {
+  toWave8Scalar, toCs2298Scalar, trim16Scalar, trim32Scalar,
+  addU8Scalar, add16Scalar, add32Scalar,
+  widen8To16Scalar, widen8To32Scalar, widen16To32Scalar,
+  duplicate8Scalar, duplicate16Scalar, duplicate32Scalar, downmixF32Scalar, "scalar"
+};
+
+static const sampleKernels_t* chosenKernels = &scalarKernels;
+static pthread_once_t kernelsChosen = PTHREAD_ONCE_INIT;
+
+void toWave8Scalar(uint8_t* data, size_t n) {
+  size_t i;
+  for(i = 0; i < n; i++) {
+    data[i] ^= 0x80;
+  }
+}
+
+void toCs2298Scalar(uint8_t* data, size_t n) {
+  size_t i;
+  for(i = 0; i < n; i++) {
+    /* an unsigned 0 would become -128 */
+    data[i] = (data[i] == 0 ? 1 : data[i]) ^ 0x80;
+  }
+}
+
+void trim16Scalar(int16_t* data, size_t n) {
+  size_t i;
+  for(i = 0; i < n; i++) {
+    data[i] = data[i] == INT16_MIN ? INT16_MIN + 1 : data[i];
+  }
+}
+
+void trim32Scalar(int32_t* data, size_t n) {
+  size_t i;
+  for(i = 0; i < n; i++) {
+    data[i] = data[i] == INT32_MIN ? INT32_MIN + 1 : data[i];
+  }
+}
+
+void addU8Scalar(uint8_t* dest, const uint8_t* addend, size_t n) {
+  size_t i;
+  for(i = 0; i < n; i++) {
+    /* 128 is silence, so it is counted once */
+    int sum = dest[i] + addend[i] - 128;
+    sum = sum > 255 ? 255 : sum;
+    dest[i] = sum < 0 ? 0 : sum;
+  }
+}
+
+void add16Scalar(int16_t* dest, const int16_t* addend, size_t n) {
+  size_t i;
+  for(i = 0; i < n; i++) {
+    int32_t sum = (int32_t)dest[i] + addend[i];
+    sum = sum > INT16_MAX ? INT16_MAX : sum;
+    dest[i] = sum < INT16_MIN ? INT16_MIN : sum;
+  }
+}
+
+void add32Scalar(int32_t* dest, const int32_t* addend, size_t n) {
+  size_t i;
+  for(i = 0; i < n; i++) {
+    int64_t sum = (int64_t)dest[i] + addend[i];
+    sum = sum > INT32_MAX ? INT32_MAX : sum;
+    dest[i] = sum < INT32_MIN ? INT32_MIN : sum;
+  }
+}
+
+void widen8To16Scalar(const uint8_t* from, int16_t* to, size_t n, uint8_t flip) {
+  size_t i;
+  for(i = 0; i < n; i++) {
+    to[i] = (int16_t)((int8_t)(from[i] ^ flip) * 256);
+  }
+}
+
+void widen8To32Scalar(const uint8_t* from, int32_t* to, size_t n, uint8_t flip) {
+  size_t i;
+  for(i = 0; i < n; i++) {
+    to[i] = (int8_t)(from[i] ^ flip) * 16777216;
+  }
+}
+
+void widen16To32Scalar(const int16_t* from, int32_t* to, size_t n) {
+  size_t i;
+  for(i = 0; i < n; i++) {
+    to[i] = from[i] * 65536;
+  }
+}
+
+void duplicate8Scalar(const uint8_t* from, uint8_t* to, size_t n) {
+  size_t i;
+  for(i = 0; i < n; i++) {
+    to[2 * i] = to[2 * i + 1] = from[i];
+  }
+}
+
+void duplicate16Scalar(const uint16_t* from, uint16_t* to, size_t n) {
+  size_t i;
+  for(i = 0; i < n; i++) {
+    to[2 * i] = to[2 * i + 1] = from[i];
+  }
+}
+
+void duplicate32Scalar(const uint32_t* from, uint32_t* to, size_t n) {
+  size_t i;
+  for(i = 0; i < n; i++) {
+    to[2 * i] = to[2 * i + 1] = from[i];
+  }
+}
+
+void downmixF32Scalar(const float* from, float* to, size_t n, float leftGain, float rightGain) {
+  size_t i;
+  for(i = 0; i < n; i++) {
+    to[i] = from[2 * i] * leftGain + from[2 * i + 1] * rightGain;
+  }
+}
+
+#ifdef SAMPLE_KERNELS_X86
+
+/*
+  Each kernel is compiled for its instruction set with a target attribute, so
+  the rest of the program does not need to be built for it. Unsigned 8-bit
+  values are trimmed by raising 0 to 1 before flipping, which only needs an
+  unsigned max, and SSE2, which has no signed 32-bit max, trims by
+  subtracting the -1 that comparing against INT32_MIN leaves in each match.
+  8-bit and 16-bit values are added with the saturating instructions, 8-bit
+  ones after flipping them to signed. There are none for 32-bit values, so a
+  sum that overflowed, which has a different sign from both of its terms, is
+  replaced by the limit with the sign of the terms. Values are widened and
+  shifted up in one step, by unpacking them with zeros below them for SSE2 and
+  by extending their sign and shifting for the wider sets. Mono values are
+  duplicated by unpacking them with themselves, and stereo frames are split 
+  into left and right values by shuffling. The 256-bit instructions unpack and
+  shuffle within 128-bit halves, so AVX2 puts the halves in order with a 
+  permute. Routing channels moves little data for each instruction, so the 
+  AVX-512 kernels use the AVX2 ones.
+*/
+
+__attribute__((target("sse2")))
+void toWave8Sse2(uint8_t* data, size_t n) {
+  size_t i;
+  __m128i top = _mm_set1_epi8((char)0x80);
+  for(i = 0; i + 16 <= n; i += 16) {
+    __m128i x = _mm_loadu_si128((__m128i*)&data[i]);
+    _mm_storeu_si128((__m128i*)&data[i], _mm_xor_si128(x, top));
+  }
+  toWave8Scalar(&data[i], n - i);
+}
+
+__attribute__((target("sse2")))
+void toCs2298Sse2(uint8_t* data, size_t n) {
+  size_t i;
+  __m128i top = _mm_set1_epi8((char)0x80);
+  __m128i one = _mm_set1_epi8(1);
+  for(i = 0; i + 16 <= n; i += 16) {
+    __m128i x = _mm_loadu_si128((__m128i*)&data[i]);
+    _mm_storeu_si128((__m128i*)&data[i], _mm_xor_si128(_mm_max_epu8(x, one), top));
+  }
+  toCs2298Scalar(&data[i], n - i);
+}
+
+__attribute__((target("sse2")))
+void trim16Sse2(int16_t* data, size_t n) {
+  size_t i;
+  __m128i min = _mm_set1_epi16(INT16_MIN + 1);
+  for(i = 0; i + 8 <= n; i += 8) {
+    __m128i x = _mm_loadu_si128((__m128i*)&data[i]);
+    _mm_storeu_si128((__m128i*)&data[i], _mm_max_epi16(x, min));
+  }
+  trim16Scalar(&data[i], n - i);
+}
+
+__attribute__((target("sse2")))
+void trim32Sse2(int32_t* data, size_t n) {
+  size_t i;
+  __m128i min = _mm_set1_epi32(INT32_MIN);
+  for(i = 0; i + 4 <= n; i += 4) {
+    __m128i x = _mm_loadu_si128((__m128i*)&data[i]);
+    _mm_storeu_si128((__m128i*)&data[i], _mm_sub_epi32(x, _mm_cmpeq_epi32(x, min)));
+  }
+  trim32Scalar(&data[i], n - i);
+}
+
+__attribute__((target("sse2")))
+void addU8Sse2(uint8_t* dest, const uint8_t* addend, size_t n) {
+  size_t i;
+  __m128i top = _mm_set1_epi8((char)0x80);
+  for(i = 0; i + 16 <= n; i += 16) {
+    __m128i x = _mm_xor_si128(_mm_loadu_si128((__m128i*)&dest[i]), top);
+    __m128i y = _mm_xor_si128(_mm_loadu_si128((__m128i*)&addend[i]), top);
+    _mm_storeu_si128((__m128i*)&dest[i], _mm_xor_si128(_mm_adds_epi8(x, y), top));
+  }
+  addU8Scalar(&dest[i], &addend[i], n - i);
+}
+
+__attribute__((target("sse2")))
+void add16Sse2(int16_t* dest, const int16_t* addend, size_t n) {
+  size_t i;
+  for(i = 0; i + 8 <= n; i += 8) {
+    __m128i x = _mm_loadu_si128((__m128i*)&dest[i]);
+    __m128i y = _mm_loadu_si128((__m128i*)&addend[i]);
+    _mm_storeu_si128((__m128i*)&dest[i], _mm_adds_epi16(x, y));
+  }
+  add16Scalar(&dest[i], &addend[i], n - i);
+}
+
+__attribute__((target("sse2")))
+void add32Sse2(int32_t* dest, const int32_t* addend, size_t n) {
+  size_t i;
+  __m128i max = _mm_set1_epi32(INT32_MAX);
+  for(i = 0; i + 4 <= n; i += 4) {
+    __m128i x = _mm_loadu_si128((__m128i*)&dest[i]);
+    __m128i y = _mm_loadu_si128((__m128i*)&addend[i]);
+    __m128i sum = _mm_add_epi32(x, y);
+    __m128i overflowed = _mm_srai_epi32(_mm_and_si128(_mm_xor_si128(sum, x), _mm_xor_si128(sum, y)), 31);
+    __m128i limit = _mm_xor_si128(_mm_srai_epi32(x, 31), max);
+    sum = _mm_or_si128(_mm_and_si128(overflowed, limit), _mm_andnot_si128(overflowed, sum));
+    _mm_storeu_si128((__m128i*)&dest[i], sum);
+  }
+  add32Scalar(&dest[i], &addend[i], n - i);
+}
+
+__attribute__((target("sse2")))
+void widen8To16Sse2(const uint8_t* from, int16_t* to, size_t n, uint8_t flip) {
+  size_t i;
+  __m128i flips = _mm_set1_epi8((char)flip);
+  __m128i zero = _mm_setzero_si128();
+  for(i = 0; i + 16 <= n; i += 16) {
+    __m128i x = _mm_xor_si128(_mm_loadu_si128((__m128i*)&from[i]), flips);
+    _mm_storeu_si128((__m128i*)&to[i], _mm_unpacklo_epi8(zero, x));
+    _mm_storeu_si128((__m128i*)&to[i + 8], _mm_unpackhi_epi8(zero, x));
+  }
+  widen8To16Scalar(&from[i], &to[i], n - i, flip);
+}
+
+__attribute__((target("sse2")))
+void widen8To32Sse2(const uint8_t* from, int32_t* to, size_t n, uint8_t flip) {
+  size_t i;
+  __m128i flips = _mm_set1_epi8((char)flip);
+  __m128i zero = _mm_setzero_si128();
+  for(i = 0; i + 16 <= n; i += 16) {
+    __m128i x = _mm_xor_si128(_mm_loadu_si128((__m128i*)&from[i]), flips);
+    __m128i low = _mm_unpacklo_epi8(zero, x);
+    __m128i high = _mm_unpackhi_epi8(zero, x);
+    _mm_storeu_si128((__m128i*)&to[i], _mm_unpacklo_epi16(zero, low));
+    _mm_storeu_si128((__m128i*)&to[i + 4], _mm_unpackhi_epi16(zero, low));
+    _mm_storeu_si128((__m128i*)&to[i + 8], _mm_unpacklo_epi16(zero, high));
+    _mm_storeu_si128((__m128i*)&to[i + 12], _mm_unpackhi_epi16(zero, high));
+  }
+  widen8To32Scalar(&from[i], &to[i], n - i, flip);
+}
+
+__attribute__((target("sse2")))
+void widen16To32Sse2(const int16_t* from, int32_t* to, size_t n) {
+  size_t i;
+  __m128i zero = _mm_setzero_si128();
+  for(i = 0; i + 8 <= n; i += 8) {
+    __m128i x = _mm_loadu_si128((__m128i*)&from[i]);
+    _mm_storeu_si128((__m128i*)&to[i], _mm_unpacklo_epi16(zero, x));
+    _mm_storeu_si128((__m128i*)&to[i + 4], _mm_unpackhi_epi16(zero, x));
+  }
+  widen16To32Scalar(&from[i], &to[i], n - i);
+}
+
+__attribute__((target("sse2")))
+void duplicate8Sse2(const uint8_t* from, uint8_t* to, size_t n) {
+  size_t i;
+  for(i = 0; i + 16 <= n; i += 16) {
+    __m128i x = _mm_loadu_si128((__m128i*)&from[i]);
+    _mm_storeu_si128((__m128i*)&to[2 * i], _mm_unpacklo_epi8(x, x));
+    _mm_storeu_si128((__m128i*)&to[2 * i + 16], _mm_unpackhi_epi8(x, x));
+  }
+  duplicate8Scalar(&from[i], &to[2 * i], n - i);
+}
+
+__attribute__((target("sse2")))
+void duplicate16Sse2(const uint16_t* from, uint16_t* to, size_t n) {
+  size_t i;
+  for(i = 0; i + 8 <= n; i += 8) {
+    __m128i x = _mm_loadu_si128((__m128i*)&from[i]);
+    _mm_storeu_si128((__m128i*)&to[2 * i], _mm_unpacklo_epi16(x, x));
+    _mm_storeu_si128((__m128i*)&to[2 * i + 8], _mm_unpackhi_epi16(x, x));
+  }
+  duplicate16Scalar(&from[i], &to[2 * i], n - i);
+}
+
+__attribute__((target("sse2")))
+void duplicate32Sse2(const uint32_t* from, uint32_t* to, size_t n) {
+  size_t i;
+  for(i = 0; i + 4 <= n; i += 4) {
+    __m128i x = _mm_loadu_si128((__m128i*)&from[i]);
+    _mm_storeu_si128((__m128i*)&to[2 * i], _mm_unpacklo_epi32(x, x));
+    _mm_storeu_si128((__m128i*)&to[2 * i + 4], _mm_unpackhi_epi32(x, x));
+  }
+  duplicate32Scalar(&from[i], &to[2 * i], n - i);
+}
+
+__attribute__((target("sse2")))
+void downmixF32Sse2(const float* from, float* to, size_t n, float leftGain, float rightGain) {
+  size_t i;
+  __m128 left = _mm_set1_ps(leftGain);
+  __m128 right = _mm_set1_ps(rightGain);
+  for(i = 0; i + 4 <= n; i += 4) {
+    __m128 a = _mm_loadu_ps(&from[2 * i]);
+    __m128 b = _mm_loadu_ps(&from[2 * i + 4]);
+    __m128 lefts = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+    __m128 rights = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+    _mm_storeu_ps(&to[i], _mm_add_ps(_mm_mul_ps(lefts, left), _mm_mul_ps(rights, right)));
+  }
+  downmixF32Scalar(&from[2 * i], &to[i], n - i, leftGain, rightGain);
+}
+
+__attribute__((target("avx2")))
+void toWave8Avx2(uint8_t* data, size_t n) {
+  size_t i;
+  __m256i top = _mm256_set1_epi8((char)0x80);
+  for(i = 0; i + 32 <= n; i += 32) {
+    __m256i x = _mm256_loadu_si256((__m256i*)&data[i]);
+    _mm256_storeu_si256((__m256i*)&data[i], _mm256_xor_si256(x, top));
+  }
+  toWave8Scalar(&data[i], n - i);
+}
+
+__attribute__((target("avx2")))
+void toCs2298Avx2(uint8_t* data, size_t n) {
+  size_t i;
+  __m256i top = _mm256_set1_epi8((char)0x80);
+  __m256i one = _mm256_set1_epi8(1);
+  for(i = 0; i + 32 <= n; i += 32) {
+    __m256i x = _mm256_loadu_si256((__m256i*)&data[i]);
+    _mm256_storeu_si256((__m256i*)&data[i], _mm256_xor_si256(_mm256_max_epu8(x, one), top));
+  }
+  toCs2298Scalar(&data[i], n - i);
+}
+
+__attribute__((target("avx2")))
+void trim16Avx2(int16_t* data, size_t n) {
+  size_t i;
+  __m256i min = _mm256_set1_epi16(INT16_MIN + 1);
+  for(i = 0; i + 16 <= n; i += 16) {
+    __m256i x = _mm256_loadu_si256((__m256i*)&data[i]);
+    _mm256_storeu_si256((__m256i*)&data[i], _mm256_max_epi16(x, min));
+  }
+  trim16Scalar(&data[i], n - i);
+}
+
+__attribute__((target("avx2")))
+void trim32Avx2(int32_t* data, size_t n) {
+  size_t i;
+  __m256i min = _mm256_set1_epi32(INT32_MIN + 1);
+  for(i = 0; i + 8 <= n; i += 8) {
+    __m256i x = _mm256_loadu_si256((__m256i*)&data[i]);
+    _mm256_storeu_si256((__m256i*)&data[i], _mm256_max_epi32(x, min));
+  }
+  trim32Scalar(&data[i], n - i);
+}
+
+__attribute__((target("avx2")))
+void addU8Avx2(uint8_t* dest, const uint8_t* addend, size_t n) {
+  size_t i;
+  __m256i top = _mm256_set1_epi8((char)0x80);
+  for(i = 0; i + 32 <= n; i += 32) {
+    __m256i x = _mm256_xor_si256(_mm256_loadu_si256((__m256i*)&dest[i]), top);
+    __m256i y = _mm256_xor_si256(_mm256_loadu_si256((__m256i*)&addend[i]), top);
+    _mm256_storeu_si256((__m256i*)&dest[i], _mm256_xor_si256(_mm256_adds_epi8(x, y), top));
+  }
+  addU8Scalar(&dest[i], &addend[i], n - i);
+}
+
+__attribute__((target("avx2")))
+void add16Avx2(int16_t* dest, const int16_t* addend, size_t n) {
+  size_t i;
+  for(i = 0; i + 16 <= n; i += 16) {
+    __m256i x = _mm256_loadu_si256((__m256i*)&dest[i]);
+    __m256i y = _mm256_loadu_si256((__m256i*)&addend[i]);
+    _mm256_storeu_si256((__m256i*)&dest[i], _mm256_adds_epi16(x, y));
+  }
+  add16Scalar(&dest[i], &addend[i], n - i);
+}
+
+__attribute__((target("avx2")))
+void add32Avx2(int32_t* dest, const int32_t* addend, size_t n) {
+  size_t i;
+  __m256i max = _mm256_set1_epi32(INT32_MAX);
+  for(i = 0; i + 8 <= n; i += 8) {
+    __m256i x = _mm256_loadu_si256((__m256i*)&dest[i]);
+    __m256i y = _mm256_loadu_si256((__m256i*)&addend[i]);
+    __m256i sum = _mm256_add_epi32(x, y);
+    __m256i overflowed = _mm256_srai_epi32(_mm256_and_si256(_mm256_xor_si256(sum, x), _mm256_xor_si256(sum, y)), 31);
+    __m256i limit = _mm256_xor_si256(_mm256_srai_epi32(x, 31), max);
+    _mm256_storeu_si256((__m256i*)&dest[i], _mm256_blendv_epi8(sum, limit, overflowed));
+  }
+  add32Scalar(&dest[i], &addend[i], n - i);
+}
+
+__attribute__((target("avx2")))
+void widen8To16Avx2(const uint8_t* from, int16_t* to, size_t n, uint8_t flip) {
+  size_t i;
+  __m128i flips = _mm_set1_epi8((char)flip);
+  for(i = 0; i + 16 <= n; i += 16) {
+    __m128i x = _mm_xor_si128(_mm_loadu_si128((__m128i*)&from[i]), flips);
+    _mm256_storeu_si256((__m256i*)&to[i], _mm256_slli_epi16(_mm256_cvtepi8_epi16(x), 8));
+  }
+  widen8To16Scalar(&from[i], &to[i], n - i, flip);
+}
+
+__attribute__((target("avx2")))
+void widen8To32Avx2(const uint8_t* from, int32_t* to, size_t n, uint8_t flip) {
+  size_t i;
+  __m128i flips = _mm_set1_epi8((char)flip);
+  for(i = 0; i + 16 <= n; i += 16) {
+    __m128i x = _mm_xor_si128(_mm_loadu_si128((__m128i*)&from[i]), flips);
+    _mm256_storeu_si256((__m256i*)&to[i], _mm256_slli_epi32(_mm256_cvtepi8_epi32(x), 24));
+    _mm256_storeu_si256((__m256i*)&to[i + 8], _mm256_slli_epi32(_mm256_cvtepi8_epi32(_mm_srli_si128(x, 8)), 24));
+  }
+  widen8To32Scalar(&from[i], &to[i], n - i, flip);
+}
+
+__attribute__((target("avx2")))
+void widen16To32Avx2(const int16_t* from, int32_t* to, size_t n) {
+  size_t i;
+  for(i = 0; i + 8 <= n; i += 8) {
+    __m128i x = _mm_loadu_si128((__m128i*)&from[i]);
+    _mm256_storeu_si256((__m256i*)&to[i], _mm256_slli_epi32(_mm256_cvtepi16_epi32(x), 16));
+  }
+  widen16To32Scalar(&from[i], &to[i], n - i);
+}
+
+__attribute__((target("avx2")))
+void duplicate8Avx2(const uint8_t* from, uint8_t* to, size_t n) {
+  size_t i;
+  for(i = 0; i + 32 <= n; i += 32) {
+    __m256i x = _mm256_permute4x64_epi64(_mm256_loadu_si256((__m256i*)&from[i]), 0xD8);
+    _mm256_storeu_si256((__m256i*)&to[2 * i], _mm256_unpacklo_epi8(x, x));
+    _mm256_storeu_si256((__m256i*)&to[2 * i + 32], _mm256_unpackhi_epi8(x, x));
+  }
+  duplicate8Scalar(&from[i], &to[2 * i], n - i);
+}
+
+__attribute__((target("avx2")))
+void duplicate16Avx2(const uint16_t* from, uint16_t* to, size_t n) {
+  size_t i;
+  for(i = 0; i + 16 <= n; i += 16) {
+    __m256i x = _mm256_permute4x64_epi64(_mm256_loadu_si256((__m256i*)&from[i]), 0xD8);
+    _mm256_storeu_si256((__m256i*)&to[2 * i], _mm256_unpacklo_epi16(x, x));
+    _mm256_storeu_si256((__m256i*)&to[2 * i + 16], _mm256_unpackhi_epi16(x, x));
+  }
+  duplicate16Scalar(&from[i], &to[2 * i], n - i);
+}
+
+__attribute__((target("avx2")))
+void duplicate32Avx2(const uint32_t* from, uint32_t* to, size_t n) {
+  size_t i;
+  for(i = 0; i + 8 <= n; i += 8) {
+    __m256i x = _mm256_permute4x64_epi64(_mm256_loadu_si256((__m256i*)&from[i]), 0xD8);
+    _mm256_storeu_si256((__m256i*)&to[2 * i], _mm256_unpacklo_epi32(x, x));
+    _mm256_storeu_si256((__m256i*)&to[2 * i + 8], _mm256_unpackhi_epi32(x, x));
+  }
+  duplicate32Scalar(&from[i], &to[2 * i], n - i);
+}
+
+__attribute__((target("avx2")))
+void downmixF32Avx2(const float* from, float* to, size_t n, float leftGain, float rightGain) {
+  size_t i;
+  __m256 left = _mm256_set1_ps(leftGain);
+  __m256 right = _mm256_set1_ps(rightGain);
+  for(i = 0; i + 8 <= n; i += 8) {
+    __m256 a = _mm256_loadu_ps(&from[2 * i]);
+    __m256 b = _mm256_loadu_ps(&from[2 * i + 8]);
+    __m256 lefts = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+    __m256 rights = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+    __m256 mono = _mm256_add_ps(_mm256_mul_ps(lefts, left), _mm256_mul_ps(rights, right));
+    /* frames 0, 1, 4, 5, 2, 3, 6, 7 back into order */
+    mono = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(mono), 0xD8));
+    _mm256_storeu_ps(&to[i], mono);
+  }
+  downmixF32Scalar(&from[2 * i], &to[i], n - i, leftGain, rightGain);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+void toWave8Avx512(uint8_t* data, size_t n) {
+  size_t i;
+  __m512i top = _mm512_set1_epi8((char)0x80);
+  for(i = 0; i + 64 <= n; i += 64) {
+    __m512i x = _mm512_loadu_si512(&data[i]);
+    _mm512_storeu_si512(&data[i], _mm512_xor_si512(x, top));
+  }
+  toWave8Scalar(&data[i], n - i);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+void toCs2298Avx512(uint8_t* data, size_t n) {
+  size_t i;
+  __m512i top = _mm512_set1_epi8((char)0x80);
+  __m512i one = _mm512_set1_epi8(1);
+  for(i = 0; i + 64 <= n; i += 64) {
+    __m512i x = _mm512_loadu_si512(&data[i]);
+    _mm512_storeu_si512(&data[i], _mm512_xor_si512(_mm512_max_epu8(x, one), top));
+  }
+  toCs2298Scalar(&data[i], n - i);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+void trim16Avx512(int16_t* data, size_t n) {
+  size_t i;
+  __m512i min = _mm512_set1_epi16(INT16_MIN + 1);
+  for(i = 0; i + 32 <= n; i += 32) {
+    __m512i x = _mm512_loadu_si512(&data[i]);
+    _mm512_storeu_si512(&data[i], _mm512_max_epi16(x, min));
+  }
+  trim16Scalar(&data[i], n - i);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+void trim32Avx512(int32_t* data, size_t n) {
+  size_t i;
+  __m512i min = _mm512_set1_epi32(INT32_MIN + 1);
+  for(i = 0; i + 16 <= n; i += 16) {
+    __m512i x = _mm512_loadu_si512(&data[i]);
+    _mm512_storeu_si512(&data[i], _mm512_max_epi32(x, min));
+  }
+  trim32Scalar(&data[i], n - i);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+void addU8Avx512(uint8_t* dest, const uint8_t* addend, size_t n) {
+  size_t i;
+  __m512i top = _mm512_set1_epi8((char)0x80);
+  for(i = 0; i + 64 <= n; i += 64) {
+    __m512i x = _mm512_xor_si512(_mm512_loadu_si512(&dest[i]), top);
+    __m512i y = _mm512_xor_si512(_mm512_loadu_si512(&addend[i]), top);
+    _mm512_storeu_si512(&dest[i], _mm512_xor_si512(_mm512_adds_epi8(x, y), top));
+  }
+  addU8Scalar(&dest[i], &addend[i], n - i);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+void add16Avx512(int16_t* dest, const int16_t* addend, size_t n) {
+  size_t i;
+  for(i = 0; i + 32 <= n; i += 32) {
+    __m512i x = _mm512_loadu_si512(&dest[i]);
+    __m512i y = _mm512_loadu_si512(&addend[i]);
+    _mm512_storeu_si512(&dest[i], _mm512_adds_epi16(x, y));
+  }
+  add16Scalar(&dest[i], &addend[i], n - i);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+void add32Avx512(int32_t* dest, const int32_t* addend, size_t n) {
+  size_t i;
+  __m512i max = _mm512_set1_epi32(INT32_MAX);
+  for(i = 0; i + 16 <= n; i += 16) {
+    __m512i x = _mm512_loadu_si512(&dest[i]);
+    __m512i y = _mm512_loadu_si512(&addend[i]);
+    __m512i sum = _mm512_add_epi32(x, y);
+    __mmask16 overflowed = _mm512_cmplt_epi32_mask(_mm512_and_si512(_mm512_xor_si512(sum, x), _mm512_xor_si512(sum, y)), _mm512_setzero_si512());
+    __m512i limit = _mm512_xor_si512(_mm512_srai_epi32(x, 31), max);
+    _mm512_storeu_si512(&dest[i], _mm512_mask_blend_epi32(overflowed, sum, limit));
+  }
+  add32Scalar(&dest[i], &addend[i], n - i);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+void widen8To16Avx512(const uint8_t* from, int16_t* to, size_t n, uint8_t flip) {
+  size_t i;
+  __m256i flips = _mm256_set1_epi8((char)flip);
+  for(i = 0; i + 32 <= n; i += 32) {
+    __m256i x = _mm256_xor_si256(_mm256_loadu_si256((__m256i*)&from[i]), flips);
+    _mm512_storeu_si512(&to[i], _mm512_slli_epi16(_mm512_cvtepi8_epi16(x), 8));
+  }
+  widen8To16Scalar(&from[i], &to[i], n - i, flip);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+void widen8To32Avx512(const uint8_t* from, int32_t* to, size_t n, uint8_t flip) {
+  size_t i;
+  __m128i flips = _mm_set1_epi8((char)flip);
+  for(i = 0; i + 16 <= n; i += 16) {
+    __m128i x = _mm_xor_si128(_mm_loadu_si128((__m128i*)&from[i]), flips);
+    _mm512_storeu_si512(&to[i], _mm512_slli_epi32(_mm512_cvtepi8_epi32(x), 24));
+  }
+  widen8To32Scalar(&from[i], &to[i], n - i, flip);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+void widen16To32Avx512(const int16_t* from, int32_t* to, size_t n) {
+  size_t i;
+  for(i = 0; i + 16 <= n; i += 16) {
+    __m256i x = _mm256_loadu_si256((__m256i*)&from[i]);
+    _mm512_storeu_si512(&to[i], _mm512_slli_epi32(_mm512_cvtepi16_epi32(x), 16));
+  }
+  widen16To32Scalar(&from[i], &to[i], n - i);
+}
+
+static const sampleKernels_t sse2Kernels = {
+  toWave8Sse2, toCs2298Sse2, trim16Sse2, trim32Sse2,
+  addU8Sse2, add16Sse2, add32Sse2,
+  widen8To16Sse2, widen8To32Sse2, widen16To32Sse2,
+  duplicate8Sse2, duplicate16Sse2, duplicate32Sse2, downmixF32Sse2, "sse2"
+};
+
+static const sampleKernels_t avx2Kernels = {
+  toWave8Avx2, toCs2298Avx2, trim16Avx2, trim32Avx2,
+  addU8Avx2, add16Avx2, add32Avx2,
+  widen8To16Avx2, widen8To32Avx2, widen16To32Avx2,
+  duplicate8Avx2, duplicate16Avx2, duplicate32Avx2, downmixF32Avx2, "avx2"
+};
+
+static const sampleKernels_t avx512Kernels = {
+  toWave8Avx512, toCs2298Avx512, trim16Avx512, trim32Avx512,
+  addU8Avx512, add16Avx512, add32Avx512,
+  widen8To16Avx512, widen8To32Avx512, widen16To32Avx512,
+  duplicate8Avx2, duplicate16Avx2, duplicate32Avx2, downmixF32Avx2, "avx512"
+};
+
+#endif
+
+void chooseSampleKernels() {
+#ifdef SAMPLE_KERNELS_X86
+  /* the widest set allowed, all of them unless SOUNDUTILS_SIMD names one */
+  const sampleKernels_t* allowed[] = {&avx512Kernels, &avx2Kernels, &sse2Kernels};
+  char* setting = getenv("SOUNDUTILS_SIMD");
+  int first = 0;
+  int i;
+  for(i = 0; setting && i < 3; i++) {
+    if(strcmp(setting, allowed[i]->name) == 0) {
+      first = i;
+    }
+  }
+  if(setting && strcmp(setting, "scalar") == 0) {
+    return;
+  }
+  __builtin_cpu_init();
+  if(first <= 0 && __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+    chosenKernels = &avx512Kernels;
+  }
+  else if(first <= 1 && __builtin_cpu_supports("avx2")) {
+    chosenKernels = &avx2Kernels;
+  }
+  else if(__builtin_cpu_supports("sse2")) {
+    chosenKernels = &sse2Kernels;
+  }
+#endif
+}
+
+const sampleKernels_t* getSampleKernels() {
+  pthread_once(&kernelsChosen, chooseSampleKernels);
+  return chosenKernels;
+}
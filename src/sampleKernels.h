@@ -0,0 +1,55 @@
+#ifndef SAMPLE_KERNELS_GUARD
+#define SAMPLE_KERNELS_GUARD
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+  The kernels that convert samples between the CS229 and WAVE layouts and
+  bit depths, add samples together, and route channels, each a single pass
+  over every value. getSampleKernels
+  picks the versions written for the widest vector instructions the processor
+  has.
+*/
+typedef struct {
+  /* signed 8-bit CS229 values to unsigned WAVE values, by flipping the top
+    bit of each byte */
+  void (*toWave8)(uint8_t* data, size_t n);
+  /* unsigned 8-bit WAVE values to signed CS229 values, trimming -128 to -127
+    on the way */
+  void (*toCs2298)(uint8_t* data, size_t n);
+  /* trims -32768 to -32767 */
+  void (*trim16)(int16_t* data, size_t n);
+  /* trims -2147483648 to -2147483647 */
+  void (*trim32)(int32_t* data, size_t n);
+  /* add addend to dest, saturating each sum to the range of the bit depth.
+    8-bit values are unsigned, as in the WAVE layout */
+  void (*addU8)(uint8_t* dest, const uint8_t* addend, size_t n);
+  void (*add16)(int16_t* dest, const int16_t* addend, size_t n);
+  void (*add32)(int32_t* dest, const int32_t* addend, size_t n);
+  /* widen 8-bit values to 16 or 32 bits and 16-bit values to 32 bits,
+    shifting them up to full scale. flip is 0x80 for unsigned 8-bit values, 
+    which centers them, and 0 for signed ones */
+  void (*widen8To16)(const uint8_t* from, int16_t* to, size_t n, uint8_t flip);
+  void (*widen8To32)(const uint8_t* from, int32_t* to, size_t n, uint8_t flip);
+  void (*widen16To32)(const int16_t* from, int32_t* to, size_t n);
+  /* copy each of n mono values twice, into a stereo pair */
+  void (*duplicate8)(const uint8_t* from, uint8_t* to, size_t n);
+  void (*duplicate16)(const uint16_t* from, uint16_t* to, size_t n);
+  void (*duplicate32)(const uint32_t* from, uint32_t* to, size_t n);
+  /* n stereo float frames to mono ones, left times leftGain plus right times
+    rightGain */
+  void (*downmixF32)(const float* from, float* to, size_t n, float leftGain, float rightGain);
+  /* "scalar", "sse2", "avx2", or "avx512" */
+  const char* name;
+} sampleKernels_t;
+
+/**
+  Returns the kernels for the widest of SSE2, AVX2, and AVX-512 that the
+  processor supports, or plain C ones on other processors. The
+  SOUNDUTILS_SIMD environment variable can name a narrower set to use
+  instead. The choice is made once, on the first call.
+*/
+const sampleKernels_t* getSampleKernels();
+
+#endif
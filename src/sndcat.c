@@ -16,30 +16,41 @@ void printHelp(char* cmd);
 fileType_t handleCommandLineArgs(int argc, char** argv, char** fileNames, int capacity, int* numFilesRead, char** outputFileName);
 
 /**
-  Concatenate numSounds sounds from the sound_t* array and put the resulting
-  sound into dest. 
+  Fills in the format and total dataSize of the concatenation of the streams
+  into dest with planSoundFormat. Streams whose sample rate differs from the
+  first stream's are reported, closed, and set to NULL so they are left out.
 */
-void concatenateSoundArray(sound_t* dest, sound_t** sounds, int numSounds);
+void planConcatenation(sound_t* dest, soundStream_t** streams, int numStreams);
 
 /**
-  Concatenate s1 and s2 and return the given resultType representation of the
-  sound. Converts sounds to proper bitDepth and numChannels before 
-  concatenating. Does not preserve s1 and s2's original sound.
+  Reads stream a block at a time, converts each block to the format of dest, 
+  and writes it to outputFile. Adds the number of bytes written to 
+  dataSizeWritten. block is the scratch sound the blocks are read into.
 */
-void concatenateSounds(sound_t* s1, sound_t* s2, fileType_t resultType);
+writeError_t concatenateStream(sound_t* dest, soundStream_t* stream, sound_t* block, FILE* outputFile, uint64_t* dataSizeWritten);
 
 /**
-  Take the data from append and attach it to the end of dest. Updates the 
-  dataSize field of dest.
+  Returns 1 if every stream left in streams is a WAVE sound with the format of
+  dest and dest is written as WAVE, so the samples can be copied unchanged.
+  Returns 0 otherwise.
 */
-void concatenateData(sound_t* dest, sound_t* append);
+char canCopyStreams(sound_t* dest, soundStream_t** streams, int numStreams);
+
+/**
+  Closes the stream and the file it reads, unless that file is stdin.
+*/
+void closeInputStream(soundStream_t* stream);
 
 int main(int argc, char** argv) {
   int i, fileLimit, numFiles;
-  char **fileNames, *outputFileName, isInputStdin;
-  sound_t *dest, **sounds;
+  uint64_t dataSizeWritten;
+  char **fileNames, *outputFileName, isInputStdin, copyStreams;
+  sound_t *dest, *block;
+  soundStream_t** streams;
+  FILE* outputFile;
   fileType_t outputType;
-  sounds = NULL;
+  writeError_t writeError;
+  streams = NULL;
   fileNames = NULL;
   outputFileName = NULL;
   numFiles = 0;
@@ -62,66 +73,100 @@ int main(int argc, char** argv) {
     numFiles = 1;
     isInputStdin = 1;
   }
-  sounds = malloc(sizeof(sound_t*) * numFiles);
-  if(!sounds) {
+  streams = malloc(sizeof(soundStream_t*) * numFiles);
+  if(!streams) {
     printMemoryError();
     free(fileNames);
     exit(1);
   }
   if(isInputStdin) {
-    sounds[0] = loadSound(stdin, "StdinSound");
+    streams[0] = openSoundStream(stdin, "StdinSound");
+    if(!streams[0]) {
+      printMemoryError();
+      exit(1);
+    }
   }
   for(i = 0; i < numFiles && !isInputStdin; i++) {
     FILE* fp;
     fp = fopen(fileNames[i], "rb");
     if(!fp) {
       printFileOpenError(fileNames[i]);
-      free(fileNames);
-      free(sounds);
       exit(1);
     }
-    sounds[i] = loadSound(fp, fileNames[i]);
-    fclose(fp);
+    streams[i] = openSoundStream(fp, fileNames[i]);
+    if(!streams[i]) {
+      printMemoryError();
+      exit(1);
+    }
   }
   free(fileNames);
-  if(getErrorFromSounds(sounds, numFiles) != NO_ERROR) {
-    for(i = 0; i < numFiles; i++) {
-      printErrorsInSound(sounds[i]);
+  for(i = 0; i < numFiles; i++) {
+    if(streams[i]->sound->error != NO_ERROR) {
+      printErrorsInSound(streams[i]->sound);
+      exit(1);
     }
-    free(sounds);
-    exit(1);
   }
   dest = loadEmptySound();
+  block = loadEmptySound();
+  if(!dest || !block) {
+    printMemoryError();
+    exit(1);
+  }
   dest->fileType = outputType;
-  concatenateSoundArray(dest, sounds, numFiles);
+  planConcatenation(dest, streams, numFiles);
 
   if(outputFileName == NULL) {
-    writeSoundToFile(dest, stdout, outputType);
+    outputFile = stdout;
   }
   else {
-    FILE* fp;
-    fp = fopen(outputFileName, "wb");
-    if(!fp) {
+    outputFile = fopen(outputFileName, "wb");
+    if(!outputFile) {
       printFileOpenError(outputFileName);
-      free(sounds);
-      unloadSound(dest);
-      fclose(fp);
       exit(1);
     }
-    writeSoundToFile(dest, fp, outputType);
-    fclose(fp);
-  } 
+  }
+  dataSizeWritten = 0;
+  copyStreams = canCopyStreams(dest, streams, numFiles);
+  writeError = writeSoundHeader(dest, outputFile, outputType);
+  for(i = 0; i < numFiles && writeError == WRITE_SUCCESS; i++) {
+    if(!streams[i]) {
+      continue;
+    }
+    if(copyStreams) {
+      writeError = copySoundStream(streams[i], outputFile, &dataSizeWritten);
+    }
+    else {
+      writeError = concatenateStream(dest, streams[i], block, outputFile, &dataSizeWritten);
+    }
+    if(streams[i]->sound->error != NO_ERROR) {
+      printErrorsInSound(streams[i]->sound);
+      exit(1);
+    }
+  }
+  if(writeError == WRITE_SUCCESS) {
+    writeError = finishSoundFile(dest, outputFile, outputType, dataSizeWritten);
+  }
+  if(writeError != WRITE_SUCCESS) {
+    printWriteError();
+    exit(1);
+  }
+  if(outputFile != stdout) {
+    fclose(outputFile);
+  }
+  unloadSound(block);
   unloadSound(dest);
   for(i = 0; i < numFiles; i++) {
-    unloadSound(sounds[i]);
+    if(streams[i]) {
+      closeInputStream(streams[i]);
+    }
   }
-  free(sounds);
+  free(streams);
   return 0;
 }
 
 fileType_t handleCommandLineArgs(int argc, char** argv, char** fileNames, int capacity, int* numFilesRead, char** outputFileName) {
   int i;
-  /* will be reset to WAV if we see -w option */
+  /* will be reset to WAV or SNDZ if we see the -w or -z option */
   fileType_t outputType = CS229;
   for(i = 1; i < argc; i++) {
     if(argv[i][0] == '-') {
@@ -138,6 +183,9 @@ fileType_t handleCommandLineArgs(int argc, char** argv, char** fileNames, int ca
       else if(argv[i][1] == 'w') {
         outputType = WAVE;
       }
+      else if(argv[i][1] == 'z') {
+        outputType = SNDZ;
+      }
       else {
         printInvalidOptionError(argv[i][1]);
         *numFilesRead = -1;
@@ -156,12 +204,13 @@ void printHelp(char* cmd) {
   printf("Usage: %s file1 [file2 ...] [options]\n\n", cmd);
 
   printf("Utility:\n");
-  printf("This program reads the CS229/WAVE file(s) passed as arguments, concatenates them,\n");
-  printf("and writes the result to a file (default:stdout , see -o option). Outputs in the\n");
-  printf("requested format (default:CS229, see -w option)\n\n");
+  printf("This program reads the CS229/WAVE/SNDZ file(s) passed as arguments,\n");
+  printf("concatenates them, and writes the result to a file (default:stdout , see -o\n");
+  printf("option). Outputs in the requested format (default:CS229, see -w and -z\n");
+  printf("options)\n\n");
 
   printf("Defaults:\n");
-  printf("Default output file type is CS229 (see -w option)\n");
+  printf("Default output file type is CS229 (see -w and -z options)\n");
   printf("Default output file is stdout unless another file is provided with -o.\n");
   printf("If no source file(s) are provided by the arguments, input is read from stdin.\n");
   printf("If only one source file is provided, the file is rewritten as-is in the desired\n"); 
@@ -171,54 +220,67 @@ void printHelp(char* cmd) {
   printf("-h\t\tdisplays this help page\n");
   printf("-o [file]\toutput to a file rather than standard out\n");
   printf("-w\t\toutput in the WAVE format rather than CS229\n");
+  printf("-z\t\toutput in the compressed SNDZ format rather than CS229\n");
 }
 
-void concatenateSoundArray(sound_t* dest, sound_t** sounds, int numSounds) {
+void planConcatenation(sound_t* dest, soundStream_t** streams, int numStreams) {
   int i;
-  fileType_t oldType;
-  convertToFileType(dest->fileType, sounds[0]);
-  /* "un"copy the file type of sounds[0] */
-  oldType = dest->fileType;
-  deepCopySound(dest, sounds[0]);
-  dest->fileType = oldType;
-  for(i = 0; i < numSounds; i++) {
-    convertToFileType(dest->fileType, sounds[i]);
-  }
-  for(i = 1; i < numSounds; i++) {
-    concatenateSounds(dest, sounds[i], dest->fileType);
+  sound_t** sounds = malloc(numStreams * sizeof(sound_t*));
+  if(!sounds) {
+    printMemoryError();
+    exit(1);
+  }
+  for(i = 0; i < numStreams; i++) {
+    sounds[i] = streams[i]->sound;
+  }
+  planSoundFormat(dest, sounds, numStreams, COMBINE_CONCATENATE);
+  for(i = 0; i < numStreams; i++) {
+    if(!sounds[i]) {
+      printSampleRateError();
+      closeInputStream(streams[i]);
+      streams[i] = NULL;
+    }
   }
+  free(sounds);
 }
 
-
-
-/**
-  concatenate sounds and store the concatenated sound into dest. Use the
-  format specified by resultType 
-*/
-void concatenateSounds(sound_t* dest, sound_t* src, fileType_t resultType) {
-  if(ensureSoundsCanConcatenate(dest, src, resultType) == -1) {
-    printSampleRateError();
-    return;
+writeError_t concatenateStream(sound_t* dest, soundStream_t* stream, sound_t* block, FILE* outputFile, uint64_t* dataSizeWritten) {
+  writeError_t error = WRITE_SUCCESS;
+  while(error == WRITE_SUCCESS && readSoundBlock(stream, block, SOUND_BLOCK_SAMPLES) > 0) {
+    matchSoundFormat(block, dest);
+    if(block->error != NO_ERROR) {
+      stream->sound->error = block->error;
+      break;
+    }
+    error = writeSoundSamples(block, outputFile, dest->fileType);
+    *dataSizeWritten += block->dataSize;
   }
-  concatenateData(dest, src);
+  return error;
 }
 
-void concatenateData(sound_t* dest, sound_t* append) {
+char canCopyStreams(sound_t* dest, soundStream_t** streams, int numStreams) {
   int i;
-  char *destCharData, *appendCharData;
-  int newDataSize = dest->dataSize + append->dataSize;
-  /* we can access these as chars because we are only writing them */
-  char* newData = (char*)realloc(dest->rawData, newDataSize);
-  if(!newData) {
-    printMemoryError();
-    dest->error = ERROR_MEMORY;
-    return;
+  if(dest->fileType != WAVE) {
+    return 0;
+  }
+  for(i = 0; i < numStreams; i++) {
+    sound_t* sound;
+    if(!streams[i]) {
+      continue;
+    }
+    sound = streams[i]->sound;
+    if(sound->fileType != WAVE || sound->bitDepth != dest->bitDepth 
+        || sound->sampleFormat != dest->sampleFormat
+        || sound->numChannels != dest->numChannels) {
+      return 0;
+    }
   }
-  dest->rawData = newData;
-  destCharData = (char*)dest->rawData;
-  appendCharData = (char*)append->rawData;
-  for(i = 0; i < append->dataSize; i++) {
-    destCharData[dest->dataSize + i] = appendCharData[i];
+  return 1;
+}
+
+void closeInputStream(soundStream_t* stream) {
+  if(stream->file != stdin) {
+    fclose(stream->file);
   }
-  dest->dataSize = newDataSize;
+  closeSoundStream(stream);
 }
@@ -1,9 +1,22 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "errorPrinter.h"
 #include "fileTypes.h"
 #include "fileUtils.h"
 
+/**
+  An input stream and the run of its channels that goes into the output.
+  numChannels is 0 when none of the stream's channels are output.
+*/
+typedef struct {
+  soundStream_t* stream;
+  unsigned int firstChannel;
+  unsigned int numChannels;
+  /* output channel that firstChannel is written to */
+  unsigned int destChannel;
+} channelSource_t;
+
 /**
   Displays the fully-formatted help screen to the user via stdout
 */
@@ -11,38 +24,50 @@ void printHelp(char* cmd);
 
 /**
   Handles the command line arguments by reading them and filling in fileNames, 
-  numFilesRead, outputChannel, and outputFileName. Returns the requested output
-  fileType_t.
+  numFilesRead, outputChannel, matrixText, and outputFileName. Returns the 
+  requested output fileType_t.
 */
-fileType_t handleCommandLineArgs(int argc, char** argv, char** fileNames, int capacity, int* numFilesRead, int* outputChannel, char** outputFileName);
+fileType_t handleCommandLineArgs(int argc, char** argv, char** fileNames, int capacity, int* numFilesRead, int* outputChannel, char** matrixText, char** outputFileName);
 
 /**
-  Connects the channels of dest and src and puts the result into dest. This 
-  function also ensures that the number of samples are the same for each sound.
+  Fills in the format and total dataSize of dest with planSoundFormat, and the
+  channel run of each source. The output has the channels of every source in
+  order, or only outputChannel if it is not -1. Sources whose sample rate 
+  differs from the first one's are reported, closed, and left out. Returns -1 if outputChannel does not exist,
+  and 0 otherwise.
 */
-void distributeIntoChannels(sound_t* dest, sound_t* src);
+int planChannels(sound_t* dest, channelSource_t* sources, int numSources, int outputChannel);
 
 /**
-  Combines the channels of s1 and s2 with the given resultType.
+  Reads a block of samples from each source and copies its channels straight
+  into their places in one interleaved output block, which is then written to
+  outputFile in the format of dest. Sources that end early are continued with
+  silence. If matrix is not NULL, each block is routed through it into the 
+  channels of dest. Stops early if reading a source fails, leaving the error in
+  its stream's sound.
 */
-void combineChannels(sound_t* s1, sound_t* s2, fileType_t resultType);
+writeError_t interleaveStreams(sound_t* dest, channelSource_t* sources, int numSources, channelMatrix_t* matrix, FILE* outputFile);
 
 /**
-  Combines the channels of numSounds sounds in the sounds array and places the
-  result into dest. Outputs in the filetype given by dest->fileType
+  Closes the stream and the file it reads, unless that file is stdin.
 */
-void combineChannelsSoundArray(sound_t* dest, sound_t** sounds, int numSounds);
+void closeInputStream(soundStream_t* stream);
 
 int main(int argc, char** argv) {
   fileType_t outputType;
   FILE* outputFile;
-  char isInputStdin, *outputFileName, **fileNames;
+  char isInputStdin, *outputFileName, *matrixText, **fileNames;
   int fileLimit, numFiles;
   int outputChannel;
-  sound_t *dest, **sounds;
+  uint64_t numSamples;
+  channelMatrix_t* matrix = NULL;
+  sound_t* dest;
+  channelSource_t* sources;
+  writeError_t writeError;
   int i;
   isInputStdin = 0;
   outputFileName = NULL;
+  matrixText = NULL;
   numFiles = 0;
   outputChannel = -1;
   /* allocate enough space for every arg or 1 spot for stdin */
@@ -52,70 +77,117 @@ int main(int argc, char** argv) {
     printMemoryError();
     exit(1);
   }
-  outputType = handleCommandLineArgs(argc, argv, fileNames, fileLimit, &numFiles, &outputChannel, &outputFileName);
+  outputType = handleCommandLineArgs(argc, argv, fileNames, fileLimit, &numFiles, &outputChannel, &matrixText, &outputFileName);
   if(numFiles == -1) {
     /* means we printed help or invalid option */
     free(fileNames);
     exit(0);
   }
+  if(matrixText) {
+    matrix = parseChannelMatrix(matrixText);
+    if(!matrix) {
+      printChannelMatrixError(matrixText);
+      free(fileNames);
+      exit(1);
+    }
+  }
   if(numFiles == 0) {
     numFiles = 1;
     isInputStdin = 1;
   }
-  sounds = malloc(sizeof(sound_t*) * numFiles);
-  if(!sounds) {
+  sources = malloc(sizeof(channelSource_t) * numFiles);
+  if(!sources) {
     printMemoryError();
     free(fileNames);
     exit(1);
   }
   if(isInputStdin) {
-    sounds[0] = loadSound(stdin, "StdinSound");
-  }
-  if(outputFileName == NULL) {
-    outputFile = stdout;
-  }
-  else {
-    outputFile = fopen(outputFileName, "wb");
-    if(!outputFile) {
-      free(fileNames);
-      free(sounds);
-      printFileOpenError(outputFileName);
+    sources[0].stream = openSoundStream(stdin, "StdinSound");
+    if(!sources[0].stream) {
+      printMemoryError();
       exit(1);
     }
   }
-
   for(i = 0; i < numFiles && !isInputStdin; i++) {
     FILE* fp;
     fp = fopen(fileNames[i], "rb");
     if(!fp) {
       printFileOpenError(fileNames[i]);
-      free(sounds);
+      free(sources);
       free(fileNames);
       exit(1);
     }
-    sounds[i] = loadSound(fp, fileNames[i]);
-    fclose(fp);
+    sources[i].stream = openSoundStream(fp, fileNames[i]);
+    if(!sources[i].stream) {
+      printMemoryError();
+      exit(1);
+    }
+  }
+  free(fileNames);
+  for(i = 0; i < numFiles; i++) {
+    if(sources[i].stream->sound->error != NO_ERROR) {
+      printErrorsInSound(sources[i].stream->sound);
+      exit(1);
+    }
   }
   dest = loadEmptySound();
+  if(!dest) {
+    printMemoryError();
+    exit(1);
+  }
   dest->fileType = outputType;
-  combineChannelsSoundArray(dest, sounds, numFiles); 
-  if(outputChannel > -1) {
-    isolateChannel(dest, outputChannel);
+  if(planChannels(dest, sources, numFiles, outputChannel) == -1) {
+    printChannelNumberError(outputChannel);
+    exit(1);
+  }
+  if(matrix) {
+    if(matrix->numInputs != dest->numChannels) {
+      printChannelMatrixSizeError(dest->numChannels);
+      exit(1);
+    }
+    numSamples = calculateNumSamples(dest);
+    dest->numChannels = matrix->numOutputs;
+    dest->dataSize = numSamples * dest->numChannels * dest->bitDepth / 8;
+  }
+
+  if(outputFileName == NULL) {
+    outputFile = stdout;
+  }
+  else {
+    outputFile = fopen(outputFileName, "wb");
+    if(!outputFile) {
+      printFileOpenError(outputFileName);
+      exit(1);
+    }
+  }
+  writeError = interleaveStreams(dest, sources, numFiles, matrix, outputFile);
+  for(i = 0; i < numFiles; i++) {
+    if(sources[i].stream && sources[i].stream->sound->error != NO_ERROR) {
+      printErrorsInSound(sources[i].stream->sound);
+      exit(1);
+    }
+  }
+  if(writeError != WRITE_SUCCESS) {
+    printWriteError();
+    exit(1);
   }
-  writeSoundToFile(dest, outputFile, outputType);
   fclose(outputFile);
   unloadSound(dest);
+  if(matrix) {
+    freeChannelMatrix(matrix);
+  }
   for(i = 0; i < numFiles; i++) {
-    unloadSound(sounds[i]);
+    if(sources[i].stream) {
+      closeInputStream(sources[i].stream);
+    }
   }
-  free(sounds);
-  free(fileNames);
+  free(sources);
   return 0;
 }
 
-fileType_t handleCommandLineArgs(int argc, char** argv, char** fileNames, int capacity, int* numFilesRead, int* outputChannel, char** outputFileName) {
+fileType_t handleCommandLineArgs(int argc, char** argv, char** fileNames, int capacity, int* numFilesRead, int* outputChannel, char** matrixText, char** outputFileName) {
   int i;
-  /* will be reset to WAV if we see -w option */
+  /* will be reset to WAV or SNDZ if we see the -w or -z option */
   fileType_t outputType = CS229;
   /* -1 is value to output all channels */
   *outputChannel = -1;
@@ -134,11 +206,19 @@ fileType_t handleCommandLineArgs(int argc, char** argv, char** fileNames, int ca
       else if(argv[i][1] == 'w') {
         outputType = WAVE;
       }
+      else if(argv[i][1] == 'z') {
+        outputType = SNDZ;
+      }
       else if(argv[i][1] == 'c') {
         *outputChannel = strtol(argv[i+1], NULL, 10);
         /* don't include the number as a file name */
         ++i;
       }
+      else if(argv[i][1] == 'm') {
+        *matrixText = argv[i+1];
+        /* don't include the matrix as a file name */
+        ++i;
+      }
       else {
         printInvalidOptionError(argv[i][1]);
         *numFilesRead = -1;
@@ -152,47 +232,160 @@ fileType_t handleCommandLineArgs(int argc, char** argv, char** fileNames, int ca
   return outputType;
 }
 
-void combineChannelsSoundArray(sound_t* dest, sound_t** sounds, int numSounds) {
+int planChannels(sound_t* dest, channelSource_t* sources, int numSources, int outputChannel) {
   int i;
-  for(i = 0; i < numSounds; i++) {
-    convertToFileType(dest->fileType, sounds[i]);
+  uint64_t numSamples;
+  unsigned int totalChannels = 0;
+  sound_t** sounds = malloc(numSources * sizeof(sound_t*));
+  if(!sounds) {
+    printMemoryError();
+    exit(1);
+  }
+  for(i = 0; i < numSources; i++) {
+    sounds[i] = sources[i].stream->sound;
   }
-  deepCopySound(dest, sounds[0]);
-  for(i = 1; i < numSounds; i++) {
-    combineChannels(dest, sounds[i], dest->fileType);
+  planSoundFormat(dest, sounds, numSources, COMBINE_CHANNELS);
+  for(i = 0; i < numSources; i++) {
+    if(!sounds[i]) {
+      printSampleRateError();
+      closeInputStream(sources[i].stream);
+      sources[i].stream = NULL;
+      sources[i].numChannels = 0;
+      continue;
+    }
+    sources[i].firstChannel = 0;
+    sources[i].numChannels = sounds[i]->numChannels;
+    sources[i].destChannel = totalChannels;
+    totalChannels += sounds[i]->numChannels;
+  }
+  free(sounds);
+  if(outputChannel > -1) {
+    if(outputChannel >= totalChannels) {
+      return -1;
+    }
+    /* keep only the run holding outputChannel, narrowed to that channel */
+    for(i = 0; i < numSources; i++) {
+      unsigned int destChannel = sources[i].destChannel;
+      if(sources[i].numChannels == 0 || outputChannel < destChannel
+          || outputChannel >= destChannel + sources[i].numChannels) {
+        sources[i].numChannels = 0;
+        continue;
+      }
+      sources[i].firstChannel = outputChannel - destChannel;
+      sources[i].numChannels = 1;
+      sources[i].destChannel = 0;
+    }
+    numSamples = calculateNumSamples(dest);
+    dest->numChannels = 1;
+    dest->dataSize = numSamples * dest->bitDepth / 8;
   }
+  return 0;
 }
 
-void combineChannels(sound_t* s1, sound_t* s2, fileType_t resultType) {
-  if(ensureSoundChannelsCombinable(s1, s2, resultType) == -1) {
-    printSampleRateError();
-    return;
+writeError_t interleaveStreams(sound_t* dest, channelSource_t* sources, int numSources, channelMatrix_t* matrix, FILE* outputFile) {
+  int i;
+  char readFailed = 0;
+  unsigned int numSamples, samplesRead, j;
+  uint64_t samplesLeft;
+  unsigned int bytesPerData = dest->bitDepth / 8;
+  /* the channels are interleaved before they are routed into dest's */
+  unsigned int numChannels = matrix ? matrix->numInputs : dest->numChannels;
+  unsigned int bytesPerSample = numChannels * bytesPerData;
+  uint64_t dataSizeWritten = 0;
+  /* unsigned 8-bit WAVE and SNDZ samples are silent at 128, floats at 0.0 */
+  int silence = (dest->fileType != CS229 && dest->bitDepth == 8) ? 128 : 0;
+  sound_t *output, *block;
+  writeError_t error;
+  output = loadEmptySound();
+  block = loadEmptySound();
+  if(!output || !block) {
+    return WRITE_ERROR_MEMORY;
+  }
+  output->sampleRate = dest->sampleRate;
+  output->fileType = dest->fileType;
+  output->bitDepth = dest->bitDepth;
+  output->sampleFormat = dest->sampleFormat;
+  output->numChannels = numChannels;
+  output->rawData = malloc(SOUND_BLOCK_SAMPLES * bytesPerSample);
+  if(!output->rawData) {
+    unloadSound(output);
+    unloadSound(block);
+    return WRITE_ERROR_MEMORY;
   }
-  distributeIntoChannels(s1, s2);
-}
 
-void distributeIntoChannels(sound_t* dest, sound_t* append) {
-  int i, j, numSamples, bytesPerDestSample, bytesPerAppendSample;
-  void* newData = realloc(dest->rawData, dest->dataSize);
-  char *destCharData, *appendCharData;
-  if(!newData) {
-    dest->error = ERROR_MEMORY;
-    return;
-  }
-  dest->rawData = newData;
-  appendCharData = (char*)append->rawData;
-  /* add channels to make space for append's data */
-  addZeroedChannels(append->numChannels, dest);
-  destCharData = (char*)dest->rawData;
-  numSamples = calculateNumSamples(dest);
-  bytesPerDestSample = dest->numChannels * append->bitDepth / 8;
-  bytesPerAppendSample = append->numChannels * append->bitDepth / 8;
-  for(i = 0; i < numSamples; i++) {
-    int firstNewData = bytesPerDestSample * (i + 1) - bytesPerAppendSample;
-    for(j = 0; j < bytesPerAppendSample; j++) {
-      destCharData[firstNewData + j] = appendCharData[i * bytesPerAppendSample + j];
+  error = writeSoundHeader(dest, outputFile, dest->fileType);
+  samplesLeft = calculateNumSamples(dest);
+  while(error == WRITE_SUCCESS && !readFailed && samplesLeft > 0) {
+    numSamples = samplesLeft < SOUND_BLOCK_SAMPLES ? samplesLeft : SOUND_BLOCK_SAMPLES;
+    output->dataSize = numSamples * bytesPerSample;
+    memset(output->rawData, silence, output->dataSize);
+    for(i = 0; i < numSources; i++) {
+      char *src, *dst;
+      unsigned int srcBytesPerSample, runBytes;
+      if(sources[i].numChannels == 0) {
+        continue;
+      }
+      samplesRead = readSoundBlock(sources[i].stream, block, numSamples);
+      if(samplesRead == 0) {
+        readFailed = sources[i].stream->sound->error != NO_ERROR;
+        if(readFailed) {
+          break;
+        }
+        continue;
+      }
+      matchSampleFormat(block, dest);
+      if(block->error != NO_ERROR) {
+        sources[i].stream->sound->error = block->error;
+        readFailed = 1;
+        break;
+      }
+      srcBytesPerSample = block->numChannels * bytesPerData;
+      runBytes = sources[i].numChannels * bytesPerData;
+      src = (char*)block->rawData + sources[i].firstChannel * bytesPerData;
+      dst = (char*)output->rawData + sources[i].destChannel * bytesPerData;
+      for(j = 0; j < samplesRead; j++) {
+        memcpy(dst, src, runBytes);
+        src += srcBytesPerSample;
+        dst += bytesPerSample;
+      }
+    }
+    if(readFailed) {
+      break;
+    }
+    if(matrix) {
+      remixChannels(output, matrix);
+      if(output->error != NO_ERROR) {
+        error = WRITE_ERROR_MEMORY;
+        break;
+      }
+    }
+    error = writeSoundSamples(output, outputFile, dest->fileType);
+    dataSizeWritten += output->dataSize;
+    samplesLeft -= numSamples;
+    if(matrix) {
+      /* routing replaced the block with one of dest's channels */
+      void* data = realloc(output->rawData, SOUND_BLOCK_SAMPLES * bytesPerSample);
+      if(!data) {
+        error = WRITE_ERROR_MEMORY;
+        break;
+      }
+      output->rawData = data;
+      output->numChannels = numChannels;
     }
   }
+  if(error == WRITE_SUCCESS && !readFailed) {
+    error = finishSoundFile(dest, outputFile, dest->fileType, dataSizeWritten);
+  }
+  unloadSound(output);
+  unloadSound(block);
+  return error;
+}
+
+void closeInputStream(soundStream_t* stream) {
+  if(stream->file != stdin) {
+    fclose(stream->file);
+  }
+  closeSoundStream(stream);
 }
 
 void printHelp(char* cmd) {
@@ -205,14 +398,18 @@ void printHelp(char* cmd) {
   printf("source sounds. \n\n");
   
   printf("Defaults:\n");
-  printf("Default output is in CS229 format (see -w option to change). \n");
+  printf("Default output is in CS229 format (see -w and -z options to change). \n");
   printf("Default output is to stdout unless another file is given (with -o)\n");
   printf("If no source files are given, tries to read file from stdin\n\n");
 
   printf("Options:\n");
   printf("-c [n]\t\tOnly include channel n in output (1st channel = 0, etc.)\n");
   printf("-h\t\tPrint this screen\n");
+  printf("-m [matrix]\tRoute the channels through matrix: a row of gains for each output\n");
+  printf("\t\tchannel separated by ';', with a gain for each channel separated\n");
+  printf("\t\tby ',' (\"0.5,0.5\" mixes stereo to mono, \"1;1\" copies mono to stereo)\n");
   printf("-o [fileName]\tOutput file to fileName\n");
   printf("-w\t\tOutput in WAVE format\n");
+  printf("-z\t\tOutput in the compressed SNDZ format\n");
 }
 
@@ -17,6 +17,12 @@ void fileTypeToString(char* str, fileType_t type);
 */
 void printSoundDetails(sound_t* sound);
 
+/**
+  Reads the sound in file for printing. Only the header is read unless 
+  fullRead is set, in which case all of the sample data is read and checked.
+*/
+sound_t* readSoundInfo(FILE* file, char* fileName, char fullRead);
+
 /**
   Prints usage message.
 */
@@ -28,10 +34,30 @@ void printUsage(char* exeName);
 void printHelp(char* exeName);
 
 int main(int argc, char* argv[]) {
-  int i;
-  if(argc < 2) {
+  int i, numFiles;
+  char fullRead = 0;
+  numFiles = 0;
+  for(i = 1; i < argc; i++) {
+    if('-' == argv[i][0]) {
+      if('h' == argv[i][1]) {
+        printHelp(argv[0]);
+        exit(0);
+      }
+      else if('f' == argv[i][1]) {
+        fullRead = 1;
+      }
+      else {
+        printInvalidOptionError(argv[i][1]);
+        exit(0);
+      }
+    }
+    else {
+      ++numFiles;
+    }
+  }
+  if(numFiles == 0) {
     char* stdinFileName = "standard input file";
-    sound_t* stdinSound = loadSound(stdin, stdinFileName);
+    sound_t* stdinSound = readSoundInfo(stdin, stdinFileName, fullRead);
     printf("\n");
     if(!stdinSound) {
       printMemoryError();
@@ -46,27 +72,19 @@ int main(int argc, char* argv[]) {
     unloadSound(stdinSound);
   }
   else {
-    for(i = 1; i < argc; i++) {
-      if('-' == argv[i][0]) {
-        if('h' == argv[i][1]) {
-          printHelp(argv[0]);
-          exit(0);
-        }
-        else {
-          printInvalidOptionError(argv[i][1]);
-          exit(0);
-        }
-      }
-    }
     for(i = 1; i < argc; i++) {
       sound_t* autoLoadedSound;
       char* fileName = argv[i];
-      FILE* fp2 = fopen(fileName, "rb");
+      FILE* fp2;
+      if('-' == fileName[0]) {
+        continue;
+      }
+      fp2 = fopen(fileName, "rb");
       if(!fp2) {
         printFileOpenError(fileName);
         exit(1);
       } 
-      autoLoadedSound = loadSound(fp2, fileName);
+      autoLoadedSound = readSoundInfo(fp2, fileName, fullRead);
       if(!autoLoadedSound) { 
         printMemoryError();
         exit(1);
@@ -95,14 +113,26 @@ void printSoundDetails(sound_t* sound) {
   printf("File name: %s\n", sound->fileName);
   printf("File type: %s\n", typeStr);
   printf("Sample rate: %ld\n", sound->sampleRate);
-  printf("Bit depth: %d\n", sound->bitDepth);
+  if(sound->sampleFormat == FLOAT_SAMPLES) {
+    printf("Bit depth: %d (float)\n", sound->bitDepth);
+  }
+  else {
+    printf("Bit depth: %d\n", sound->bitDepth);
+  }
   printf("Number of channels: %d\n", sound->numChannels);
-  printf("Number of samples: %d\n", calculateNumSamples(sound));
+  printf("Number of samples: %llu\n", (unsigned long long)calculateNumSamples(sound));
   printf("Sound length (seconds): %.3f\n", calculateSoundLength(sound));
 }
 
+sound_t* readSoundInfo(FILE* file, char* fileName, char fullRead) {
+  if(fullRead) {
+    return loadSound(file, fileName);
+  }
+  return probeSound(file, fileName);
+}
+
 void printUsage(char* exeName) {
-  printf("Usage: %s file1 [file2 ...]\n\n", exeName);
+  printf("Usage: %s file1 [file2 ...] [options]\n\n", exeName);
 }
 
 void printHelp(char* exeName) {
@@ -110,10 +140,15 @@ void printHelp(char* exeName) {
   printUsage(exeName);
 
   printf("Utility:\n");
-  printf("This program reads each wav and CS229 sound file passed as\n");
+  printf("This program reads each wav, CS229, and SNDZ sound file passed as\n");
   printf("arguments and outputs their information.\n\n");
+
+  printf("Defaults:\n");
+  printf("Only the file headers are read. CS229 files without a Samples line are\n");
+  printf("scanned to count their samples.\n\n");
   
   printf("Options: \n");
+  printf("-f\treads and checks all sample data, not just the header\n");
   printf("-h\tdisplays this help page\n");
 } 
 
@@ -124,4 +159,7 @@ void fileTypeToString(char* str, fileType_t type) {
   else if(type == CS229) {
     strcpy(str, "CS229");
   } 
+  else if(type == SNDZ) {
+    strcpy(str, "SNDZ");
+  }
 }
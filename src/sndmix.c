@@ -1,54 +1,91 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "fileTypes.h"
 #include "fileUtils.h"
 #include "errorPrinter.h"
+#include "sampleKernels.h"
 
 /**
-  Fills in filenames, numFilesRead, outputFileName, scalarStrs, and 
-  numScalarsRead from the command line arguments. Returns the requested
+  Fills in filenames, numFilesRead, outputFileName, matrixText, scalarStrs, 
+  and numScalarsRead from the command line arguments. Returns the requested
   output fileType_t
 */
-fileType_t handleCommandLineArgs(int argc, char** argv, char** fileNames, int* numFilesRead, char** outputFileName, char** scalarStrs, int* numScalarsRead);
+fileType_t handleCommandLineArgs(int argc, char** argv, char** fileNames, int* numFilesRead, char** outputFileName, char** matrixText, char** scalarStrs, int* numScalarsRead);
 
 /**
-  Mixes sounds together by scaling each sample by their scalar, adding the 
-  sounds' sample data together mathematically, and placing the resulting file
-  into dest.
+  Fills in the format and total dataSize of the mix of the streams into dest
+  with planSoundFormat. Streams whose sample rate differs from the first 
+  stream's are reported, closed, and set to NULL so they are left out.
 */
-void mixSounds(sound_t* dest, sound_t** sounds, float* scalars, int numSounds);
+void planMix(sound_t* dest, soundStream_t** streams, int numStreams);
 
 /**
-  Converts the string array strings to floats and place the result into floats.
-  Only read up to numData, and return 0 if we encounter an error, otherwise
-  return 1;
+  Returns 1 if every scalar of a stream left in streams is 1, every such
+  stream has the integer samples and bitDepth of dest, which is not 24, and 
+  every gain of matrix, if there is one, is 0 or 1, so the samples can be 
+  added and routed as they are. Returns 0 otherwise.
 */
-char stringsToFloats(char** strings, float* floats, unsigned int numData);
+char canAddIntegers(sound_t* dest, soundStream_t** streams, float* scalars, int numStreams, channelMatrix_t* matrix);
 
 /**
-  Scales the sample data of sound by the given scalar.
+  Mixes the streams together a block at a time by scaling each sample by their
+  scalar and adding the streams' sample data together mathematically, then 
+  writes each mixed block to outputFile in the format of dest. Blocks are 
+  mixed by mixBlocks, so the mix is only rounded and clipped once, when it is
+  quantized to the format of dest. When canAddIntegers, blocks are
+  instead added as integers in the WAVE layout, by addSampleData when there 
+  are at most two and no matrix and by sumIntegerBlocks otherwise, so each 
+  sum is saturated once, and MIN_VALUE sums are trimmed as quantizing would. 
+  Streams that end early are mixed in as silence. If matrix is not NULL, the
+  streams have its numInputs channels and their sums are routed through it 
+  into the channels of dest before they are quantized. Stops early if reading
+  a stream fails, leaving the error in that stream's sound.
 */
-void scaleSampleData(sound_t* sound, float scalar);
+writeError_t mixStreams(sound_t* dest, soundStream_t** streams, float* scalars, int numStreams, channelMatrix_t* matrix, FILE* outputFile);
 
 /**
-  Scales numChars chars from char array by the given scalar.
+  Fills the samples of mix, whose format and dataSize are set, with the sum of
+  the samples of each of the numBlocks blocks times its scalar. Blocks must 
+  have the numChannels of mix, or matrix->numInputs if matrix is not NULL, but
+  may be shorter, and may have any bitDepth and sampleFormat. This is done in
+  one pass about a SAMPLE_VALUE_BLOCK of values at a time: each block's values
+  are read once and summed as floats, scaled by their scalar and their full 
+  scale together, the sums are routed through matrix, and each output is 
+  quantized and written once. Sets the error of mix if memory runs out.
 */
-void scaleChars(char* chars, int numChars, float scalar);
+void mixBlocks(sound_t* mix, sound_t** blocks, float* scalars, int numBlocks, channelMatrix_t* matrix);
 
 /**
-  Scales numShorts shorts from short array by the given scalar.
+  Fills the integer samples of mix, which is in the WAVE layout with its 
+  format and dataSize set, with the sum of the samples of the numBlocks 
+  blocks. Blocks must have the sample format of mix, and its numChannels or
+  matrix->numInputs if matrix is not NULL, but may be shorter. The sums are 
+  kept in 64 bits about a SAMPLE_VALUE_BLOCK of values at a time, routed 
+  through matrix, whose gains must be whole numbers, and saturated once, after
+  the last block, so they do not depend on the order of the blocks. Sets the
+  error of mix if memory runs out.
 */
-void scaleShorts(short* shorts, int numShorts, float scalar);
+void sumIntegerBlocks(sound_t* mix, sound_t** blocks, int numBlocks, channelMatrix_t* matrix);
 
 /**
-  Scales numLongs longs from long array by the given scalar.
+  Closes the stream and the file it reads.
+*/
+void closeInputStream(soundStream_t* stream);
+
+/**
+  Converts the string array strings to floats and place the result into floats.
+  Only read up to numData, and return 0 if we encounter an error, otherwise
+  return 1;
 */
-void scaleLongs(long* longs, int numLongs, float scalar);
+char stringsToFloats(char** strings, float* floats, unsigned int numData);
 
 /**
-  Mathematically adds the sample data of the the two sounds (dest and addend)
-  and stores the result in dest. This function allows overflow and is expected
-  to receive values that will not overflow
+  Adds the sample data of addend to that of dest, which must have the same 
+  sampleFormat and bitDepth. addend may have fewer samples than dest, in which
+  case only the start of dest is added to. Floats do not overflow, so their 
+  sum is only clipped when it is quantized. Integers, which must be 8, 16, or
+  32-bit and in the WAVE layout, saturate as they are added.
 */
 void addSampleData(sound_t* dest, sound_t* addend);
 
@@ -80,12 +117,17 @@ void printHelp(char* cmd);
 
 int main(int argc, char** argv) {
   int i, numFiles, numScalars;
-  char *outputFileName, **fileNames, **scalarStrs;
-  sound_t *dest, **sounds;
+  char *outputFileName, *matrixText, **fileNames, **scalarStrs;
+  uint64_t numSamples;
+  channelMatrix_t* matrix = NULL;
+  sound_t* dest;
+  soundStream_t** streams;
   float* scalarFloats;
   FILE* outputFile;
   fileType_t outputType;
+  writeError_t writeError;
   outputFileName = NULL;
+  matrixText = NULL;
   scalarStrs = NULL;
   scalarFloats = NULL;
   numFiles = 0;
@@ -96,19 +138,28 @@ int main(int argc, char** argv) {
     printMemoryError();
     exit(1);
   }
-  scalarStrs = malloc(sizeof(int) * argc);
+  scalarStrs = malloc(sizeof(char*) * argc);
   if(!scalarStrs) {
     printMemoryError();
     free(fileNames);
     exit(1);
   }
-  outputType = handleCommandLineArgs(argc, argv, fileNames, &numFiles, &outputFileName, scalarStrs, &numScalars);
+  outputType = handleCommandLineArgs(argc, argv, fileNames, &numFiles, &outputFileName, &matrixText, scalarStrs, &numScalars);
   if(numFiles == -1) {
     /* we printed help or encountered an invalid option */ 
     free(fileNames);
     free(scalarStrs);
     exit(0);
   }
+  if(matrixText) {
+    matrix = parseChannelMatrix(matrixText);
+    if(!matrix) {
+      printChannelMatrixError(matrixText);
+      free(fileNames);
+      free(scalarStrs);
+      exit(1);
+    }
+  }
   if(numFiles == 0) {
     printUsage(argv[0]);
     printf("\n");
@@ -137,83 +188,94 @@ int main(int argc, char** argv) {
     exit(1);
   }
   free(scalarStrs);
-  sounds = malloc(numFiles * sizeof(sound_t*));
-  if(!sounds) {
+  streams = malloc(numFiles * sizeof(soundStream_t*));
+  if(!streams) {
     printMemoryError();
     free(fileNames);
     exit(1);
   }
-  if(outputFileName == NULL) {
-    outputFile = stdout;
-  }
-  else {
-    outputFile = fopen(outputFileName, "wb");
-    if(!outputFile) {
-      free(fileNames);
-      free(sounds);
-      printFileOpenError(outputFileName);
-      exit(1);
-    }
-  }
 
   for(i = 0; i < numFiles; i++) {
     FILE* fp;
     fp = fopen(fileNames[i], "rb");
     if(!fp) {
       printFileOpenError(fileNames[i]);
-      free(sounds);
+      free(streams);
       free(fileNames);
       exit(1);
     }
-    sounds[i] = loadSound(fp, fileNames[i]);
-    fclose(fp);
+    streams[i] = openSoundStream(fp, fileNames[i]);
+    if(!streams[i]) {
+      printMemoryError();
+      exit(1);
+    }
   }
   free(fileNames);
-  if(getErrorFromSounds(sounds, numFiles) != NO_ERROR) {
-    for(i = 0; i < numFiles; i++) {
-      printErrorsInSound(sounds[i]);
+  for(i = 0; i < numFiles; i++) {
+    if(streams[i]->sound->error != NO_ERROR) {
+      printErrorsInSound(streams[i]->sound);
+      exit(1);
     }
-    free(sounds);
-    exit(1);
   }
   dest = loadEmptySound();
-  dest->fileType = outputType; 
   if(!dest) {
     printMemoryError();
-    free(fileNames);
     exit(1);
   }
-  mixSounds(dest, sounds, scalarFloats, numFiles);
+  dest->fileType = outputType; 
+  planMix(dest, streams, numFiles);
+  if(matrix) {
+    if(matrix->numInputs != dest->numChannels) {
+      printChannelMatrixSizeError(dest->numChannels);
+      exit(1);
+    }
+    numSamples = calculateNumSamples(dest);
+    dest->numChannels = matrix->numOutputs;
+    dest->dataSize = numSamples * dest->numChannels * dest->bitDepth / 8;
+  }
+
   if(outputFileName == NULL) {
-    writeSoundToFile(dest, stdout, outputType);
+    outputFile = stdout;
   }
   else {
-    FILE* fp;
-    fp = fopen(outputFileName, "wb");
-    if(!fp) {
+    outputFile = fopen(outputFileName, "wb");
+    if(!outputFile) {
       printFileOpenError(outputFileName);
-      free(sounds);
-      unloadSound(dest);
-      fclose(fp);
       exit(1);
     }
-    writeSoundToFile(dest, fp, outputType);
-    fclose(fp);
-  } 
+  }
+  writeError = mixStreams(dest, streams, scalarFloats, numFiles, matrix, outputFile);
+  for(i = 0; i < numFiles; i++) {
+    if(streams[i] && streams[i]->sound->error != NO_ERROR) {
+      printErrorsInSound(streams[i]->sound);
+      exit(1);
+    }
+  }
+  if(writeError != WRITE_SUCCESS) {
+    printWriteError();
+    exit(1);
+  }
+  if(outputFile != stdout) {
+    fclose(outputFile);
+  }
   unloadSound(dest);
+  if(matrix) {
+    freeChannelMatrix(matrix);
+  }
   for(i = 0; i < numFiles; i++) {
-    unloadSound(sounds[i]);
+    if(streams[i]) {
+      closeInputStream(streams[i]);
+    }
   }
-  free(sounds);
-
-  free(dest);
+  free(streams);
+  free(scalarFloats);
   exit(0);
 }
 
-fileType_t handleCommandLineArgs(int argc, char** argv, char** fileNames, int* numFilesRead, char** outputFileName, char** scalars, int* numScalarsRead) {
+fileType_t handleCommandLineArgs(int argc, char** argv, char** fileNames, int* numFilesRead, char** outputFileName, char** matrixText, char** scalars, int* numScalarsRead) {
   int i;
   char justSawScalar = 0;
-  /* starts as CS229, will be converted to wav if we see -w */
+  /* starts as CS229, will be converted to wav or SNDZ if we see -w or -z */
   fileType_t outputType = CS229;
   for(i = 1; i < argc; i++) {
     if(argv[i][0] == '-') {
@@ -227,9 +289,17 @@ fileType_t handleCommandLineArgs(int argc, char** argv, char** fileNames, int* n
         /* don't reread the file name as an input file */
         ++i;
       }
+      else if(argv[i][1] == 'm') {
+        *matrixText = argv[i+1];
+        /* don't read the matrix as a scalar */
+        ++i;
+      }
       else if(argv[i][1] == 'w') {
         outputType = WAVE;
       }
+      else if(argv[i][1] == 'z') {
+        outputType = SNDZ;
+      }
       else {
         printInvalidOptionError(argv[i][1]);
         *numFilesRead = -1;
@@ -251,98 +321,353 @@ fileType_t handleCommandLineArgs(int argc, char** argv, char** fileNames, int* n
   return outputType;
 }
 
-void mixSounds(sound_t* dest, sound_t** sounds, float* scalars, int numSounds) {
+void planMix(sound_t* dest, soundStream_t** streams, int numStreams) {
   int i;
-  for(i = 0; i < numSounds; i++) {
-    scaleSampleData(sounds[i], scalars[i]);
+  sound_t** sounds = malloc(numStreams * sizeof(sound_t*));
+  if(!sounds) {
+    printMemoryError();
+    exit(1);
+  }
+  for(i = 0; i < numStreams; i++) {
+    sounds[i] = streams[i]->sound;
   }
-  deepCopySound(dest, sounds[0]);
-  for(i = 1; i < numSounds; i++ ) {
-    if(ensureSoundsMixable(dest, sounds[i], dest->fileType) == -1) {
+  planSoundFormat(dest, sounds, numStreams, COMBINE_MIX);
+  for(i = 0; i < numStreams; i++) {
+    if(!sounds[i]) {
       printSampleRateError();
+      closeInputStream(streams[i]);
+      streams[i] = NULL;
     }
-    convertToFileType(dest->fileType, sounds[i]);
-    addSampleData(dest, sounds[i]);
   }
+  free(sounds);
 }
 
-char stringsToFloats(char** strings, float* floats, unsigned int numData) {
-  char* endPtr;
-  while(numData--) {
-    floats[numData] = strtof(strings[numData], &endPtr);
-    if(floats[numData] == 0 && endPtr == strings[numData]) {
-      printScalarConversionError(strings[numData]);
-      return 0;
+writeError_t mixStreams(sound_t* dest, soundStream_t** streams, float* scalars, int numStreams, channelMatrix_t* matrix, FILE* outputFile) {
+  int i, numMixed;
+  char readFailed = 0;
+  char addIntegers = canAddIntegers(dest, streams, scalars, numStreams, matrix);
+  /* the streams are mixed with the channels the matrix routes from */
+  unsigned int numInputs = matrix ? matrix->numInputs : dest->numChannels;
+  unsigned int numSamples;
+  uint64_t samplesLeft;
+  uint64_t dataSizeWritten = 0;
+  sound_t *mix, **blocks, **mixed;
+  float* mixedScalars;
+  void* newData;
+  writeError_t error;
+  mix = loadEmptySound();
+  blocks = calloc(numStreams, sizeof(sound_t*));
+  mixed = malloc(numStreams * sizeof(sound_t*));
+  mixedScalars = malloc(numStreams * sizeof(float));
+  error = mix && blocks && mixed && mixedScalars ? WRITE_SUCCESS : WRITE_ERROR_MEMORY;
+  for(i = 0; error == WRITE_SUCCESS && i < numStreams; i++) {
+    blocks[i] = loadEmptySound();
+    if(!blocks[i]) {
+      error = WRITE_ERROR_MEMORY;
     }
   }
-  return 1;
+  if(error == WRITE_SUCCESS) {
+    mix->sampleRate = dest->sampleRate;
+    mix->numChannels = dest->numChannels;
+    error = writeSoundHeader(dest, outputFile, dest->fileType);
+  }
+  samplesLeft = calculateNumSamples(dest);
+  while(error == WRITE_SUCCESS && !readFailed && samplesLeft > 0) {
+    numSamples = samplesLeft < SOUND_BLOCK_SAMPLES ? samplesLeft : SOUND_BLOCK_SAMPLES;
+    /* mix straight into the format of dest, or add integers with its
+      bitDepth in the WAVE layout */
+    mix->fileType = addIntegers ? WAVE : dest->fileType;
+    mix->sampleFormat = dest->sampleFormat;
+    mix->bitDepth = dest->bitDepth;
+    mix->dataSize = numSamples * mix->numChannels * mix->bitDepth / 8;
+    newData = realloc(mix->rawData, mix->dataSize);
+    if(!newData) {
+      error = WRITE_ERROR_MEMORY;
+      break;
+    }
+    mix->rawData = newData;
+    numMixed = 0;
+    for(i = 0; i < numStreams; i++) {
+      if(!streams[i]) {
+        continue;
+      }
+      if(readSoundBlock(streams[i], blocks[i], numSamples) == 0) {
+        /* a stream that has ended adds silence */
+        readFailed = streams[i]->sound->error != NO_ERROR;
+        if(readFailed) {
+          break;
+        }
+        continue;
+      }
+      if(addIntegers) {
+        matchSampleFormat(blocks[i], mix);
+      }
+      if(blocks[i]->numChannels < numInputs) {
+        addZeroedChannels(numInputs - blocks[i]->numChannels, blocks[i]);
+      }
+      if(blocks[i]->error != NO_ERROR) {
+        streams[i]->sound->error = blocks[i]->error;
+        readFailed = 1;
+        break;
+      }
+      mixed[numMixed] = blocks[i];
+      mixedScalars[numMixed++] = scalars[i];
+    }
+    if(readFailed) {
+      break;
+    }
+    if(addIntegers && numMixed <= 2 && !matrix) {
+      /* adding to silence is exact, so only the second block's add can 
+        saturate. unsigned 8-bit silence is 128 */
+      memset(mix->rawData, mix->bitDepth == 8 ? 128 : 0, mix->dataSize);
+      for(i = 0; i < numMixed; i++) {
+        addSampleData(mix, mixed[i]);
+      }
+    }
+    else if(addIntegers) {
+      sumIntegerBlocks(mix, mixed, numMixed, matrix);
+    }
+    if(addIntegers) {
+      /* trims MIN_VALUE sums to MIN_VALUE + 1, as quantizing would */
+      convertToFileType(CS229, mix);
+      convertToFileType(dest->fileType, mix);
+    }
+    else {
+      mixBlocks(mix, mixed, mixedScalars, numMixed, matrix);
+    }
+    if(mix->error != NO_ERROR) {
+      error = WRITE_ERROR_MEMORY;
+      break;
+    }
+    error = writeSoundSamples(mix, outputFile, dest->fileType);
+    dataSizeWritten += mix->dataSize;
+    samplesLeft -= numSamples;
+  }
+  if(error == WRITE_SUCCESS && !readFailed) {
+    error = finishSoundFile(dest, outputFile, dest->fileType, dataSizeWritten);
+  }
+  for(i = 0; blocks && i < numStreams; i++) {
+    if(blocks[i]) {
+      unloadSound(blocks[i]);
+    }
+  }
+  if(mix) {
+    unloadSound(mix);
+  }
+  free(blocks);
+  free(mixed);
+  free(mixedScalars);
+  return error;
 }
 
-void scaleSampleData(sound_t* sound, float scalar) {
-  int numSamples = calculateNumSamples(sound);
-  if(sound->bitDepth == 8) {
-    scaleChars((char*)sound->rawData, numSamples, scalar);
+void mixBlocks(sound_t* mix, sound_t** blocks, float* scalars, int numBlocks, channelMatrix_t* matrix) {
+  unsigned int numInputs = matrix ? matrix->numInputs : mix->numChannels;
+  unsigned int maxChannels = numInputs > mix->numChannels ? numInputs : mix->numChannels;
+  /* whole frames at a time, so they can be routed */
+  size_t framesPerBlock = maxChannels < SAMPLE_VALUE_BLOCK ? SAMPLE_VALUE_BLOCK / maxChannels : 1;
+  uint64_t numFrames = calculateNumSamples(mix);
+  float* sums = malloc(framesPerBlock * numInputs * sizeof(float));
+  float* outputs = matrix ? malloc(framesPerBlock * mix->numChannels * sizeof(float)) : sums;
+  int32_t* values = malloc(framesPerBlock * maxChannels * sizeof(int32_t));
+  sampleBuffer_t mixBuffer = getSampleBuffer(mix);
+  sampleBuffer_t* buffers = malloc(numBlocks * sizeof(sampleBuffer_t));
+  float* factors = malloc(numBlocks * sizeof(float));
+  uint64_t i, first;
+  size_t j, n;
+  int k;
+  if(!sums || !outputs || !values || !buffers || !factors) {
+    mix->error = ERROR_MEMORY;
+    if(outputs != sums) {
+      free(outputs);
+    }
+    free(sums);
+    free(values);
+    free(buffers);
+    free(factors);
+    return;
+  }
+  for(k = 0; k < numBlocks; k++) {
+    buffers[k] = getSampleBuffer(blocks[k]);
+    /* integers are scaled to floats with full scale 1 along with their 
+      scalar. The full scale is a power of two, so this rounds just as 
+      scaling them one after the other would */
+    factors[k] = scalars[k];
+    if(blocks[k]->sampleFormat == INTEGER_SAMPLES) {
+      factors[k] *= 1.0f / ((uint32_t)1 << (blocks[k]->bitDepth - 1));
+    }
   }
-  else if(sound->bitDepth == 16) {
-    scaleShorts((short*)sound->rawData, numSamples, scalar);
+  for(i = 0; i < numFrames; i += framesPerBlock) {
+    size_t numSamples = numFrames - i < framesPerBlock ? numFrames - i : framesPerBlock;
+    n = numSamples * numInputs;
+    first = i * numInputs;
+    memset(sums, 0, n * sizeof(float));
+    for(k = 0; k < numBlocks; k++) {
+      /* shorter blocks only add to the start of the mix */
+      size_t m = buffers[k].numValues <= first ? 0 
+        : buffers[k].numValues - first < n ? buffers[k].numValues - first : n;
+      if(blocks[k]->sampleFormat == FLOAT_SAMPLES) {
+        for(j = 0; j < m; j++) {
+          sums[j] += buffers[k].f32[first + j] * factors[k];
+        }
+      }
+      else {
+        getSampleValues(&buffers[k], first, m, values);
+        for(j = 0; j < m; j++) {
+          sums[j] += values[j] * factors[k];
+        }
+      }
+    }
+    if(matrix) {
+      applyChannelMatrix(sums, outputs, numSamples, matrix);
+    }
+    n = numSamples * mix->numChannels;
+    first = i * mix->numChannels;
+    if(mix->sampleFormat == FLOAT_SAMPLES) {
+      memcpy(&mixBuffer.f32[first], outputs, n * sizeof(float));
+    }
+    else {
+      quantizeValues(outputs, n, mix->bitDepth, values);
+      setSampleValues(&mixBuffer, first, n, values);
+    }
   }
-  else if(sound->bitDepth == 32) {
-    scaleLongs((long*)sound->rawData, numSamples, scalar);
+  if(outputs != sums) {
+    free(outputs);
   }
+  free(sums);
+  free(values);
+  free(buffers);
+  free(factors);
 }
 
-void scaleChars(char* chars, int numChars, float scalar) {
-  int i;
-  for(i = 0; i < numChars; i++) {
-    chars[i] *= scalar;
+void sumIntegerBlocks(sound_t* mix, sound_t** blocks, int numBlocks, channelMatrix_t* matrix) {
+  unsigned int numInputs = matrix ? matrix->numInputs : mix->numChannels;
+  unsigned int maxChannels = numInputs > mix->numChannels ? numInputs : mix->numChannels;
+  /* whole frames at a time, so they can be routed */
+  size_t framesPerBlock = maxChannels < SAMPLE_VALUE_BLOCK ? SAMPLE_VALUE_BLOCK / maxChannels : 1;
+  uint64_t numFrames = calculateNumSamples(mix);
+  int64_t maxValue = ((int64_t)1 << (mix->bitDepth - 1)) - 1;
+  int64_t* sums = malloc(framesPerBlock * numInputs * sizeof(int64_t));
+  int64_t* outputs = matrix ? malloc(framesPerBlock * mix->numChannels * sizeof(int64_t)) : sums;
+  int32_t* values = malloc(framesPerBlock * maxChannels * sizeof(int32_t));
+  sampleBuffer_t mixBuffer = getSampleBuffer(mix);
+  sampleBuffer_t* buffers = malloc(numBlocks * sizeof(sampleBuffer_t));
+  uint64_t i, first;
+  size_t j, n;
+  unsigned int o, c;
+  int k;
+  if(!sums || !outputs || !values || !buffers) {
+    mix->error = ERROR_MEMORY;
+    if(outputs != sums) {
+      free(outputs);
+    }
+    free(sums);
+    free(values);
+    free(buffers);
+    return;
+  }
+  for(k = 0; k < numBlocks; k++) {
+    buffers[k] = getSampleBuffer(blocks[k]);
+  }
+  for(i = 0; i < numFrames; i += framesPerBlock) {
+    size_t numSamples = numFrames - i < framesPerBlock ? numFrames - i : framesPerBlock;
+    n = numSamples * numInputs;
+    first = i * numInputs;
+    memset(sums, 0, n * sizeof(int64_t));
+    for(k = 0; k < numBlocks; k++) {
+      /* shorter blocks only add to the start of the mix */
+      size_t m = buffers[k].numValues <= first ? 0 
+        : buffers[k].numValues - first < n ? buffers[k].numValues - first : n;
+      getSampleValues(&buffers[k], first, m, values);
+      for(j = 0; j < m; j++) {
+        sums[j] += values[j];
+      }
+    }
+    for(j = 0; matrix && j < numSamples; j++) {
+      for(o = 0; o < matrix->numOutputs; o++) {
+        float* row = &matrix->gains[o * numInputs];
+        int64_t sum = 0;
+        for(c = 0; c < numInputs; c++) {
+          sum += (int64_t)row[c] * sums[j * numInputs + c];
+        }
+        outputs[j * matrix->numOutputs + o] = sum;
+      }
+    }
+    n = numSamples * mix->numChannels;
+    for(j = 0; j < n; j++) {
+      values[j] = outputs[j] > maxValue ? maxValue 
+        : outputs[j] < -maxValue - 1 ? -maxValue - 1 : outputs[j];
+    }
+    setSampleValues(&mixBuffer, i * mix->numChannels, n, values);
+  }
+  if(outputs != sums) {
+    free(outputs);
   }
+  free(sums);
+  free(values);
+  free(buffers);
 }
 
-void scaleShorts(short* shorts, int numShorts, float scalar) {
+char canAddIntegers(sound_t* dest, soundStream_t** streams, float* scalars, int numStreams, channelMatrix_t* matrix) {
   int i;
-  for(i = 0; i < numShorts; i++) {
-    shorts[i] *= scalar;
+  if(dest->sampleFormat != INTEGER_SAMPLES || dest->bitDepth == 24) {
+    return 0;
   }
+  for(i = 0; i < numStreams; i++) {
+    if(streams[i] && (scalars[i] != 1 
+      || streams[i]->sound->sampleFormat != INTEGER_SAMPLES 
+      || streams[i]->sound->bitDepth != dest->bitDepth)) {
+      return 0;
+    }
+  }
+  for(i = 0; matrix && i < matrix->numInputs * matrix->numOutputs; i++) {
+    if(matrix->gains[i] != 0 && matrix->gains[i] != 1) {
+      return 0;
+    }
+  }
+  return 1;
 }
 
-void scaleLongs(long* longs, int numLongs, float scalar) {
-  int i;
-  for(i = 0; i < numLongs; i++) {
-    longs[i] *= scalar;
+void closeInputStream(soundStream_t* stream) {
+  fclose(stream->file);
+  closeSoundStream(stream);
+}
+
+char stringsToFloats(char** strings, float* floats, unsigned int numData) {
+  char* endPtr;
+  while(numData--) {
+    floats[numData] = strtof(strings[numData], &endPtr);
+    if(floats[numData] == 0 && endPtr == strings[numData]) {
+      printScalarConversionError(strings[numData]);
+      return 0;
+    }
   }
+  return 1;
 }
 
 void addSampleData(sound_t* dest, sound_t* addend) {
-  int i;
-  if(dest->bitDepth != addend->bitDepth) {
-    printf("Error: tried to add two sounds of different bit depths\n");
-    return;
-  }
-  if(dest->fileType != addend->fileType) {
-    printf("Error: tried to add two sounds of different file types\n");
+  uint64_t i;
+  uint64_t numValues = calculateTotalDataElements(addend);
+  const sampleKernels_t* kernels = getSampleKernels();
+  sampleBuffer_t destBuffer, addendBuffer;
+  if(dest->sampleFormat != addend->sampleFormat || dest->bitDepth != addend->bitDepth) {
+    printf("Error: tried to add sounds with different sample formats\n");
     return;
   }
-  if(dest->bitDepth == 8) {
-    for(i = 0; i < calculateTotalDataElements(dest); i++) {
-      char* destCharData = (char*)dest->rawData;
-      char* addendCharData = (char*)addend->rawData;
-      destCharData[i] += addendCharData[i];
-
+  destBuffer = getSampleBuffer(dest);
+  addendBuffer = getSampleBuffer(addend);
+  if(dest->sampleFormat == FLOAT_SAMPLES) {
+    for(i = 0; i < numValues; i++) {
+      destBuffer.f32[i] += addendBuffer.f32[i];
     }
   }
+  else if(dest->bitDepth == 8) {
+    kernels->addU8(destBuffer.u8, addendBuffer.u8, numValues);
+  }
   else if(dest->bitDepth == 16) {
-    for(i = 0; i < calculateTotalDataElements(dest); i++) {
-      short* destShortData = (short*)dest->rawData;
-      short* addendShortData = (short*)addend->rawData;
-      destShortData[i] += addendShortData[i];
-    }
+    kernels->add16(destBuffer.s16, addendBuffer.s16, numValues);
   }
   else if(dest->bitDepth == 32) {
-    for(i = 0; i < calculateTotalDataElements(dest); i++) {
-      long* destLongData = (long*)dest->rawData;
-      long* addendLongData = (long*)addend->rawData;
-      destLongData[i] += addendLongData[i];
-    }
+    kernels->add32(destBuffer.s32, addendBuffer.s32, numValues);
   }
 }
 
@@ -374,16 +699,22 @@ void printHelp(char* cmd) {
   printf("If the sounds have unequal channels, zeroed out channels will be added to the\n");
   printf("one with fewer channels.\n");
   printf("If the sounds have different bit depths, the smaller samples are scaled up to\n");
-  printf("match the larger ones.\n\n");
+  printf("match the larger ones.\n");
+  printf("The samples are mixed as floats, and clipped only when they are written.\n\n");
   
   printf("Defaults:\n");
-  printf("Default output is in CS229 format (see -w option to change). \n");
+  printf("Default output is in CS229 format (see -w and -z options to change). \n");
   printf("Default output is to stdout unless another file is given (see -o)\n");
   printf("If no source files are given, file is read from stdin\n\n");
 
   printf("Options:\n");
   printf("-h\t\tPrint this screen\n");
+  printf("-m [matrix]\tRoute the channels of the mix through matrix: a row of gains for\n");
+  printf("\t\teach output channel separated by ';', with a gain for each channel\n");
+  printf("\t\tseparated by ',' (\"0.5,0.5\" mixes stereo to mono, \"1;1\" copies\n");
+  printf("\t\tmono to stereo)\n");
   printf("-o [fileName]\tOutput file to fileName\n");
   printf("-w\t\tOutput in WAVE format\n");
+  printf("-z\t\tOutput in the compressed SNDZ format\n");
 }
 
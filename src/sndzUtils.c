@@ -0,0 +1,861 @@
+#include "sndzUtils.h"
+#include "fileReader.h"
+#include "fileUtils.h"
+#include "workerThreads.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+/* bytes of the header after the "SNDZ" specifier */
+#define SNDZ_HEADER_SIZE 18
+
+/* offset of the dataSize field from the start of the file */
+#define SNDZ_DATA_SIZE_OFFSET 14
+
+#define SNDZ_BLOCK_HEADER_SIZE 8
+
+/* most blocks each thread compresses before they are written */
+#define SNDZ_ROUND_BLOCKS 16
+
+/**
+  Packs bits most significant first into out.
+*/
+typedef struct {
+  unsigned char* out;
+  size_t position;
+  uint64_t bits;
+  unsigned int numBits;
+} bitWriter_t;
+
+/**
+  Unpacks bits most significant first from in. Reading past length gives zero
+  bits, which is caught by comparing the bits used to length afterwards.
+*/
+typedef struct {
+  unsigned char* in;
+  size_t length;
+  size_t position;
+  uint64_t bits;
+  unsigned int numBits;
+} bitReader_t;
+
+/**
+  The samples of sound from firstFrame to endFrame, compressed a share of
+  framesPerWorker samples per thread, each into its own buffer. The threads
+  only read the samples through samples, which is made before they start.
+*/
+typedef struct {
+  sound_t* sound;
+  sampleBuffer_t samples;
+  unsigned long firstFrame;
+  unsigned long endFrame;
+  unsigned long framesPerWorker;
+  unsigned char* buffers[MAX_WORKER_THREADS];
+  size_t lengths[MAX_WORKER_THREADS];
+} sndzEncodeJob_t;
+
+/**
+  Blocks decoded by the threads into data, which is in the WAVE layout.
+*/
+typedef struct {
+  unsigned char* data;
+  unsigned short numChannels;
+  unsigned short bitDepth;
+  sndzBlock_t* blocks;
+  unsigned long numBlocks;
+} sndzDecodeJob_t;
+
+/**
+  Reads the header after the "SNDZ" specifier into sound and checks that it
+  describes a sound we can read. Sets sound->error on error.
+*/
+void readSndzHeader(FILE* fp, sound_t* sound);
+
+/**
+  Returns the n byte little-endian number at bytes.
+*/
+uint64_t getLittleEndian(unsigned char* bytes, int n);
+
+/**
+  Stores value as an n byte little-endian number at bytes.
+*/
+void putLittleEndian(unsigned char* bytes, uint64_t value, int n);
+
+/**
+  Returns the most bytes a block of samples with numChannels and bitDepth can
+  take.
+*/
+size_t getMaxBlockSize(unsigned short numChannels, unsigned short bitDepth);
+
+/**
+  Reads everything left in fp into an allocated buffer.
+*/
+readError_t readRest(FILE* fp, unsigned char** text, size_t* length);
+
+/**
+  Finds the blocks holding the first numFrames samples in the length bytes at
+  text and puts them in an allocated array. Returns ERROR_EOF without 
+  allocating if length bytes are too few for that many blocks.
+*/
+readError_t findBlocks(unsigned char* text, size_t length, unsigned long numFrames, sndzBlock_t** blocks, unsigned long* numBlocks);
+
+/**
+  Reads whole blocks from reader->file until they hold at least numSamples
+  samples, and decodes them into reader->samples.
+*/
+readError_t readSndzBlocks(sndzReader_t* reader, unsigned long numSamples);
+
+/**
+  Decodes the blocks of job on up to getNumWorkerThreads() threads and returns
+  the error of the first block that failed.
+*/
+readError_t decodeBlocks(sndzDecodeJob_t* job);
+
+/**
+  workerFunction_t that decodes one worker's share of a sndzDecodeJob_t.
+*/
+void decodeRangeWorker(unsigned int index, unsigned int numWorkers, void* job);
+
+/**
+  workerFunction_t that compresses one worker's share of a sndzEncodeJob_t.
+*/
+void encodeRangeWorker(unsigned int index, unsigned int numWorkers, void* job);
+
+/**
+  Decodes the block into its samples of data.
+*/
+readError_t decodeBlock(sndzBlock_t* block, unsigned char* data, unsigned short numChannels, unsigned short bitDepth);
+
+/**
+  Compresses numFrames samples of numChannels channels in samples, starting 
+  at firstFrame, into one block at out, which must have room for 
+  getMaxBlockSize bytes. Returns the size of the block.
+*/
+size_t encodeBlock(sampleBuffer_t* samples, unsigned short numChannels, unsigned long firstFrame, unsigned long numFrames, unsigned char* out);
+
+/**
+  Codes the n values of one channel into out, choosing the predictor order and
+  Rice parameter that make them smallest. Returns the number of bytes used.
+*/
+size_t encodeChannel(int32_t* x, unsigned long n, unsigned short bitDepth, unsigned char* out);
+
+/**
+  Decodes n values of one channel from the length bytes at in into x, and puts
+  the number of bytes they took in used.
+*/
+readError_t decodeChannel(unsigned char* in, size_t length, unsigned long n, unsigned short bitDepth, int32_t* x, size_t* used);
+
+/**
+  Copies numFrames values of channel, starting at firstFrame, out of the 
+  frames of numChannels values in samples as signed numbers.
+*/
+void loadChannel(sampleBuffer_t* samples, unsigned short numChannels, unsigned int channel, unsigned long firstFrame, unsigned long numFrames, int32_t* x);
+
+/**
+  Copies numFrames signed values of channel into data, in the WAVE layout,
+  starting at firstFrame.
+*/
+void storeChannel(unsigned char* data, unsigned short numChannels, unsigned short bitDepth, unsigned int channel, unsigned long firstFrame, unsigned long numFrames, int32_t* x);
+
+/**
+  Predicts x[i] from the values before it with the fixed polynomial predictor
+  of the given order, or of order i for the first values.
+*/
+int64_t predictValue(int32_t* x, unsigned long i, unsigned int order);
+
+/**
+  Returns the number of bits Rice coding the n mapped residuals in u with
+  parameter k takes.
+*/
+uint64_t getRiceSize(uint64_t* u, unsigned long n, unsigned int k, unsigned int escapeBits);
+
+void putBits(bitWriter_t* writer, uint64_t value, unsigned int n);
+void flushBits(bitWriter_t* writer);
+void fillBits(bitReader_t* reader, unsigned int n);
+uint64_t getBits(bitReader_t* reader, unsigned int n);
+
+void sndzRead(FILE* fp, sound_t* sound) {
+  unsigned char* text = NULL;
+  size_t length = 0;
+  long offset = -1;
+  sndzDecodeJob_t job;
+  readSndzHeader(fp, sound);
+  if(sound->error != NO_ERROR) {
+    return;
+  }
+  if(sound->mappedFile) {
+    offset = ftell(fp);
+  }
+  if(offset >= 0 && (size_t)offset <= sound->mappedFileSize) {
+    text = (unsigned char*)sound->mappedFile + offset;
+    length = sound->mappedFileSize - offset;
+  }
+  else {
+    offset = -1;
+    sound->error = readRest(fp, &text, &length);
+  }
+  job.data = NULL;
+  job.blocks = NULL;
+  job.numChannels = sound->numChannels;
+  job.bitDepth = sound->bitDepth;
+  if(sound->error == NO_ERROR) {
+    sound->error = findBlocks(text, length, calculateNumSamples(sound), &job.blocks, &job.numBlocks);
+  }
+  if(sound->error == NO_ERROR && sound->dataSize > 0) {
+    job.data = malloc(sound->dataSize);
+    if(!job.data) {
+      sound->error = ERROR_MEMORY;
+    }
+  }
+  if(sound->error == NO_ERROR) {
+    sound->error = decodeBlocks(&job);
+  }
+  free(job.blocks);
+  if(offset < 0) {
+    free(text);
+  }
+  if(sound->error != NO_ERROR) {
+    free(job.data);
+    sound->dataSize = 0;
+    return;
+  }
+  sound->rawData = job.data;
+}
+
+void sndzProbe(FILE* fp, sound_t* sound) {
+  readSndzHeader(fp, sound);
+}
+
+sndzReader_t* sndzOpenStream(FILE* fp, sound_t* sound) {
+  sndzReader_t* reader = malloc(sizeof(sndzReader_t));
+  if(!reader) {
+    sound->error = ERROR_MEMORY;
+    return NULL;
+  }
+  readSndzHeader(fp, sound);
+  if(sound->error != NO_ERROR) {
+    free(reader);
+    return NULL;
+  }
+  reader->file = fp;
+  reader->numChannels = sound->numChannels;
+  reader->bitDepth = sound->bitDepth;
+  reader->compressed = NULL;
+  reader->compressedCapacity = 0;
+  reader->blocks = NULL;
+  reader->blocksCapacity = 0;
+  reader->samples = NULL;
+  reader->samplesCapacity = 0;
+  reader->numFrames = 0;
+  reader->nextFrame = 0;
+  return reader;
+}
+
+readError_t sndzReadBlock(sndzReader_t* reader, sound_t* block, unsigned long numSamples) {
+  size_t bytesPerFrame = reader->numChannels * reader->bitDepth / 8;
+  unsigned char* out = block->rawData;
+  unsigned long n;
+  readError_t error;
+  while(numSamples > 0) {
+    if(reader->nextFrame == reader->numFrames) {
+      error = readSndzBlocks(reader, numSamples);
+      if(error != NO_ERROR) {
+        return error;
+      }
+    }
+    n = reader->numFrames - reader->nextFrame;
+    if(n > numSamples) {
+      n = numSamples;
+    }
+    memcpy(out, reader->samples + reader->nextFrame * bytesPerFrame, n * bytesPerFrame);
+    out += n * bytesPerFrame;
+    reader->nextFrame += n;
+    numSamples -= n;
+  }
+  return NO_ERROR;
+}
+
+void destroySndzReader(sndzReader_t* reader) {
+  free(reader->compressed);
+  free(reader->blocks);
+  free(reader->samples);
+  free(reader);
+}
+
+writeError_t writeSndzFile(sound_t* sound, FILE* fp) {
+  writeError_t error = WRITE_SUCCESS;
+  if(!sound->rawData && sound->dataSize > 0) {
+    return WRITE_ERROR_MEMORY;
+  }
+  error = writeSndzHeader(sound, fp);
+  if(error == WRITE_SUCCESS) {
+    error = writeSndzSamples(sound, fp);
+  }
+  if(error == WRITE_SUCCESS) {
+    error = finishSndzFile(sound, fp, sound->dataSize);
+  }
+  return error;
+}
+
+writeError_t writeSndzHeader(sound_t* sound, FILE* fp) {
+  unsigned char header[4 + SNDZ_HEADER_SIZE];
+  memcpy(header, "SNDZ", 4);
+  putLittleEndian(&header[4], SNDZ_VERSION, 2);
+  putLittleEndian(&header[6], sound->numChannels, 2);
+  putLittleEndian(&header[8], sound->bitDepth, 2);
+  putLittleEndian(&header[10], sound->sampleRate, 4);
+  putLittleEndian(&header[14], sound->dataSize, 8);
+  if(fwrite(header, 1, sizeof(header), fp) != sizeof(header)) {
+    return WRITE_ERROR_TOO_FEW_CHARS;
+  }
+  return WRITE_SUCCESS;
+}
+
+writeError_t writeSndzSamples(sound_t* sound, FILE* fp) {
+  unsigned int i;
+  unsigned long frame;
+  sndzEncodeJob_t job;
+  writeError_t error = WRITE_SUCCESS;
+  unsigned long numFrames = calculateNumSamples(sound);
+  unsigned long numBlocks = (numFrames + SNDZ_BLOCK_FRAMES - 1) / SNDZ_BLOCK_FRAMES;
+  unsigned long blocksPerWorker;
+  unsigned int numWorkers = getNumWorkerThreads();
+  if(numBlocks == 0) {
+    return WRITE_SUCCESS;
+  }
+  if(numWorkers > numBlocks) {
+    numWorkers = numBlocks;
+  }
+  blocksPerWorker = (numBlocks + numWorkers - 1) / numWorkers;
+  if(blocksPerWorker > SNDZ_ROUND_BLOCKS) {
+    blocksPerWorker = SNDZ_ROUND_BLOCKS;
+  }
+  /* align the samples now, the workers only read them */
+  alignSampleData(sound);
+  if(sound->error != NO_ERROR) {
+    return WRITE_ERROR_MEMORY;
+  }
+  job.sound = sound;
+  job.samples = getSampleBuffer(sound);
+  job.framesPerWorker = blocksPerWorker * SNDZ_BLOCK_FRAMES;
+  for(i = 0; i < numWorkers; i++) {
+    job.buffers[i] = malloc(blocksPerWorker * getMaxBlockSize(sound->numChannels, sound->bitDepth));
+    if(!job.buffers[i]) {
+      error = WRITE_ERROR_MEMORY;
+      numWorkers = i;
+      break;
+    }
+  }
+  for(frame = 0; error == WRITE_SUCCESS && frame < numFrames; frame += numWorkers * job.framesPerWorker) {
+    job.firstFrame = frame;
+    job.endFrame = frame + numWorkers * job.framesPerWorker;
+    if(job.endFrame > numFrames) {
+      job.endFrame = numFrames;
+    }
+    runWorkers(numWorkers, encodeRangeWorker, &job);
+    for(i = 0; i < numWorkers && error == WRITE_SUCCESS; i++) {
+      if(fwrite(job.buffers[i], 1, job.lengths[i], fp) != job.lengths[i]) {
+        error = WRITE_ERROR_TOO_FEW_CHARS;
+      }
+    }
+  }
+  for(i = 0; i < numWorkers; i++) {
+    free(job.buffers[i]);
+  }
+  return error;
+}
+
+writeError_t finishSndzFile(sound_t* sound, FILE* fp, uint64_t dataSizeWritten) {
+  unsigned char dataSize[8];
+  if(dataSizeWritten == sound->dataSize) {
+    return WRITE_SUCCESS;
+  }
+  /* the header promised a different size, go back and fix it */
+  putLittleEndian(dataSize, dataSizeWritten, 8);
+  if(fseek(fp, SNDZ_DATA_SIZE_OFFSET, SEEK_SET) != 0 || fwrite(dataSize, 1, 8, fp) != 8) {
+    return WRITE_ERROR_SEEKING;
+  }
+  if(fseek(fp, 0, SEEK_END) != 0) {
+    return WRITE_ERROR_SEEKING;
+  }
+  return WRITE_SUCCESS;
+}
+
+void readSndzHeader(FILE* fp, sound_t* sound) {
+  unsigned char header[SNDZ_HEADER_SIZE];
+  unsigned int bytesPerFrame;
+  sound->error = readBytes(header, SNDZ_HEADER_SIZE, fp);
+  if(sound->error != NO_ERROR) {
+    return;
+  }
+  sound->numChannels = getLittleEndian(&header[2], 2);
+  sound->bitDepth = getLittleEndian(&header[4], 2);
+  sound->sampleRate = getLittleEndian(&header[6], 4);
+  sound->dataSize = getLittleEndian(&header[10], 8);
+  if(getLittleEndian(header, 2) != SNDZ_VERSION) {
+    sound->error = ERROR_FILETYPE;
+  }
+  else if(sound->numChannels == 0) {
+    sound->error = ERROR_ZERO_CHANNELS;
+  }
+  else if(sound->bitDepth != 8 && sound->bitDepth != 16 && sound->bitDepth != 24 && sound->bitDepth != 32) {
+    sound->error = ERROR_BIT_DEPTH;
+  }
+  if(sound->error != NO_ERROR) {
+    sound->dataSize = 0;
+    return;
+  }
+  bytesPerFrame = sound->numChannels * sound->bitDepth / 8;
+  /* the size in bits must fit too, or counting the samples wraps around */
+  if(sound->dataSize % bytesPerFrame != 0 || sound->dataSize > UINT64_MAX / 8) {
+    sound->error = ERROR_SAMPLE_DATA;
+    sound->dataSize = 0;
+  }
+}
+
+uint64_t getLittleEndian(unsigned char* bytes, int n) {
+  uint64_t value = 0;
+  while(n--) {
+    value = (value << 8) | bytes[n];
+  }
+  return value;
+}
+
+void putLittleEndian(unsigned char* bytes, uint64_t value, int n) {
+  int i;
+  for(i = 0; i < n; i++) {
+    bytes[i] = value & 0xFF;
+    value >>= 8;
+  }
+}
+
+size_t getMaxBlockSize(unsigned short numChannels, unsigned short bitDepth) {
+  /* a coded channel is only used when it is smaller than the plain values */
+  return SNDZ_BLOCK_HEADER_SIZE + numChannels * (3 + SNDZ_BLOCK_FRAMES * bitDepth / 8);
+}
+
+readError_t readRest(FILE* fp, unsigned char** text, size_t* length) {
+  size_t capacity = FILE_READER_BLOCK_SIZE;
+  unsigned char* newText;
+  *length = 0;
+  *text = malloc(capacity);
+  if(!*text) {
+    return ERROR_MEMORY;
+  }
+  while(!feof(fp)) {
+    if(*length == capacity) {
+      capacity *= 2;
+      newText = realloc(*text, capacity);
+      if(!newText) {
+        free(*text);
+        *text = NULL;
+        return ERROR_MEMORY;
+      }
+      *text = newText;
+    }
+    *length += fread(*text + *length, 1, capacity - *length, fp);
+    if(ferror(fp)) {
+      free(*text);
+      *text = NULL;
+      return ERROR_READING;
+    }
+  }
+  return NO_ERROR;
+}
+
+readError_t findBlocks(unsigned char* text, size_t length, unsigned long numFrames, sndzBlock_t** blocks, unsigned long* numBlocks) {
+  unsigned long capacity = numFrames / SNDZ_BLOCK_FRAMES + 1;
+  unsigned long frames = 0;
+  size_t position = 0;
+  sndzBlock_t* newBlocks;
+  *numBlocks = 0;
+  *blocks = NULL;
+  /* every block holds at most SNDZ_BLOCK_FRAMES frames and takes at least its
+    header, so a dataSize this text cannot hold is caught before allocating */
+  if((numFrames + SNDZ_BLOCK_FRAMES - 1) / SNDZ_BLOCK_FRAMES > length / SNDZ_BLOCK_HEADER_SIZE) {
+    return ERROR_EOF;
+  }
+  *blocks = malloc(capacity * sizeof(sndzBlock_t));
+  if(!*blocks) {
+    return ERROR_MEMORY;
+  }
+  while(frames < numFrames) {
+    sndzBlock_t* block;
+    if(length - position < SNDZ_BLOCK_HEADER_SIZE) {
+      return ERROR_EOF;
+    }
+    if(*numBlocks == capacity) {
+      /* blocks written by separate writeSndzSamples calls can be short */
+      capacity *= 2;
+      newBlocks = realloc(*blocks, capacity * sizeof(sndzBlock_t));
+      if(!newBlocks) {
+        return ERROR_MEMORY;
+      }
+      *blocks = newBlocks;
+    }
+    block = &(*blocks)[(*numBlocks)++];
+    block->bytes = getLittleEndian(&text[position], 4);
+    block->frames = getLittleEndian(&text[position + 4], 4);
+    block->firstFrame = frames;
+    block->payload = &text[position + SNDZ_BLOCK_HEADER_SIZE];
+    position += SNDZ_BLOCK_HEADER_SIZE;
+    if(block->frames == 0 || block->frames > SNDZ_BLOCK_FRAMES
+        || block->frames > numFrames - frames) {
+      return ERROR_SAMPLE_DATA;
+    }
+    if(block->bytes > length - position) {
+      return ERROR_EOF;
+    }
+    position += block->bytes;
+    frames += block->frames;
+  }
+  return NO_ERROR;
+}
+
+readError_t readSndzBlocks(sndzReader_t* reader, unsigned long numSamples) {
+  unsigned char header[SNDZ_BLOCK_HEADER_SIZE];
+  size_t bytesPerFrame = reader->numChannels * reader->bitDepth / 8;
+  size_t maxBlockSize = getMaxBlockSize(reader->numChannels, reader->bitDepth);
+  size_t used = 0;
+  unsigned long i, frames = 0;
+  sndzDecodeJob_t job;
+  readError_t error;
+  job.numBlocks = 0;
+  while(frames < numSamples) {
+    sndzBlock_t* block;
+    error = readBytes(header, SNDZ_BLOCK_HEADER_SIZE, reader->file);
+    if(error != NO_ERROR) {
+      return error;
+    }
+    if(job.numBlocks == reader->blocksCapacity) {
+      unsigned long capacity = reader->blocksCapacity ? reader->blocksCapacity * 2 : SNDZ_ROUND_BLOCKS;
+      sndzBlock_t* newBlocks = realloc(reader->blocks, capacity * sizeof(sndzBlock_t));
+      if(!newBlocks) {
+        return ERROR_MEMORY;
+      }
+      reader->blocks = newBlocks;
+      reader->blocksCapacity = capacity;
+    }
+    block = &reader->blocks[job.numBlocks++];
+    block->bytes = getLittleEndian(header, 4);
+    block->frames = getLittleEndian(&header[4], 4);
+    block->firstFrame = frames;
+    if(block->frames == 0 || block->frames > SNDZ_BLOCK_FRAMES
+        || block->bytes > maxBlockSize - SNDZ_BLOCK_HEADER_SIZE) {
+      return ERROR_SAMPLE_DATA;
+    }
+    if(used + block->bytes > reader->compressedCapacity) {
+      size_t capacity = 2 * (used + block->bytes);
+      unsigned char* newCompressed = realloc(reader->compressed, capacity);
+      if(!newCompressed) {
+        return ERROR_MEMORY;
+      }
+      reader->compressed = newCompressed;
+      reader->compressedCapacity = capacity;
+    }
+    error = readBytes(&reader->compressed[used], block->bytes, reader->file);
+    if(error != NO_ERROR) {
+      return error;
+    }
+    used += block->bytes;
+    frames += block->frames;
+  }
+  /* the buffer may have moved while it grew */
+  used = 0;
+  for(i = 0; i < job.numBlocks; i++) {
+    reader->blocks[i].payload = &reader->compressed[used];
+    used += reader->blocks[i].bytes;
+  }
+  if(frames * bytesPerFrame > reader->samplesCapacity) {
+    unsigned char* newSamples = realloc(reader->samples, frames * bytesPerFrame);
+    if(!newSamples) {
+      return ERROR_MEMORY;
+    }
+    reader->samples = newSamples;
+    reader->samplesCapacity = frames * bytesPerFrame;
+  }
+  job.data = reader->samples;
+  job.numChannels = reader->numChannels;
+  job.bitDepth = reader->bitDepth;
+  job.blocks = reader->blocks;
+  reader->nextFrame = 0;
+  reader->numFrames = frames;
+  return decodeBlocks(&job);
+}
+
+readError_t decodeBlocks(sndzDecodeJob_t* job) {
+  unsigned long i;
+  unsigned int numWorkers = getNumWorkerThreads();
+  if(numWorkers > job->numBlocks) {
+    numWorkers = job->numBlocks;
+  }
+  if(numWorkers == 0) {
+    return NO_ERROR;
+  }
+  runWorkers(numWorkers, decodeRangeWorker, job);
+  for(i = 0; i < job->numBlocks; i++) {
+    if(job->blocks[i].error != NO_ERROR) {
+      return job->blocks[i].error;
+    }
+  }
+  return NO_ERROR;
+}
+
+void decodeRangeWorker(unsigned int index, unsigned int numWorkers, void* job) {
+  sndzDecodeJob_t* decodeJob = (sndzDecodeJob_t*)job;
+  unsigned long i = decodeJob->numBlocks * index / numWorkers;
+  unsigned long end = decodeJob->numBlocks * (index + 1) / numWorkers;
+  for(; i < end; i++) {
+    decodeJob->blocks[i].error = decodeBlock(&decodeJob->blocks[i], decodeJob->data, decodeJob->numChannels, decodeJob->bitDepth);
+  }
+}
+
+void encodeRangeWorker(unsigned int index, unsigned int numWorkers, void* job) {
+  sndzEncodeJob_t* encodeJob = (sndzEncodeJob_t*)job;
+  unsigned long frame = encodeJob->firstFrame + index * encodeJob->framesPerWorker;
+  unsigned long end = frame + encodeJob->framesPerWorker;
+  size_t length = 0;
+  if(end > encodeJob->endFrame) {
+    end = encodeJob->endFrame;
+  }
+  for(; frame < end; frame += SNDZ_BLOCK_FRAMES) {
+    unsigned long numFrames = end - frame < SNDZ_BLOCK_FRAMES ? end - frame : SNDZ_BLOCK_FRAMES;
+    length += encodeBlock(&encodeJob->samples, encodeJob->sound->numChannels, frame, numFrames, encodeJob->buffers[index] + length);
+  }
+  encodeJob->lengths[index] = length;
+}
+
+readError_t decodeBlock(sndzBlock_t* block, unsigned char* data, unsigned short numChannels, unsigned short bitDepth) {
+  int32_t x[SNDZ_BLOCK_FRAMES];
+  unsigned int channel;
+  size_t position = 0;
+  size_t used;
+  readError_t error;
+  for(channel = 0; channel < numChannels; channel++) {
+    error = decodeChannel(block->payload + position, block->bytes - position, block->frames, bitDepth, x, &used);
+    if(error != NO_ERROR) {
+      return error;
+    }
+    position += used;
+    storeChannel(data, numChannels, bitDepth, channel, block->firstFrame, block->frames, x);
+  }
+  return NO_ERROR;
+}
+
+size_t encodeBlock(sampleBuffer_t* samples, unsigned short numChannels, unsigned long firstFrame, unsigned long numFrames, unsigned char* out) {
+  int32_t x[SNDZ_BLOCK_FRAMES];
+  unsigned int channel;
+  size_t length = SNDZ_BLOCK_HEADER_SIZE;
+  for(channel = 0; channel < numChannels; channel++) {
+    loadChannel(samples, numChannels, channel, firstFrame, numFrames, x);
+    length += encodeChannel(x, numFrames, samples->bitDepth, out + length);
+  }
+  putLittleEndian(out, length - SNDZ_BLOCK_HEADER_SIZE, 4);
+  putLittleEndian(out + 4, numFrames, 4);
+  return length;
+}
+
+size_t encodeChannel(int32_t* x, unsigned long n, unsigned short bitDepth, unsigned char* out) {
+  uint64_t u[SNDZ_BLOCK_FRAMES];
+  uint64_t errors[SNDZ_MAX_ORDER + 1] = {0};
+  uint64_t sum = 0, size, bestSize;
+  unsigned int escapeBits = bitDepth + 5;
+  unsigned int order, k, bestOrder = 0, bestK = 0, tryK;
+  unsigned long i;
+  bitWriter_t writer;
+
+  /* the order that predicts best leaves the smallest residuals */
+  for(i = 0; i < n; i++) {
+    for(order = 0; order <= SNDZ_MAX_ORDER; order++) {
+      int64_t residual = x[i] - predictValue(x, i, order);
+      errors[order] += residual < 0 ? -residual : residual;
+    }
+  }
+  for(order = 1; order <= SNDZ_MAX_ORDER; order++) {
+    if(errors[order] < errors[bestOrder]) {
+      bestOrder = order;
+    }
+  }
+  for(i = 0; i < n; i++) {
+    int64_t residual = x[i] - predictValue(x, i, bestOrder);
+    u[i] = residual < 0 ? ((uint64_t)-residual << 1) - 1 : (uint64_t)residual << 1;
+    sum += u[i];
+  }
+
+  /* the best parameter is near log2 of the mean, so only try around it */
+  for(k = 0; k < 30 && ((uint64_t)n << (k + 1)) <= sum; k++);
+  bestSize = (uint64_t)n * bitDepth;
+  bestK = SNDZ_VERBATIM;
+  for(tryK = k > 0 ? k - 1 : 0; tryK <= k + 1; tryK++) {
+    size = getRiceSize(u, n, tryK, escapeBits);
+    if(size < bestSize) {
+      bestSize = size;
+      bestK = tryK;
+    }
+  }
+
+  writer.out = out + 2;
+  writer.position = 0;
+  writer.bits = 0;
+  writer.numBits = 0;
+  if(bestK == SNDZ_VERBATIM) {
+    out[0] = 0;
+    out[1] = SNDZ_VERBATIM;
+    for(i = 0; i < n; i++) {
+      putBits(&writer, (uint32_t)x[i] & (0xFFFFFFFFUL >> (32 - bitDepth)), bitDepth);
+    }
+  }
+  else {
+    out[0] = bestOrder;
+    out[1] = bestK;
+    for(i = 0; i < n; i++) {
+      uint64_t quotient = u[i] >> bestK;
+      if(quotient < SNDZ_ESCAPE_LENGTH) {
+        /* quotient ones and a zero */
+        putBits(&writer, ((uint64_t)1 << (quotient + 1)) - 2, quotient + 1);
+        putBits(&writer, u[i], bestK);
+      }
+      else {
+        putBits(&writer, ((uint64_t)1 << SNDZ_ESCAPE_LENGTH) - 1, SNDZ_ESCAPE_LENGTH);
+        putBits(&writer, u[i] >> 32, escapeBits > 32 ? escapeBits - 32 : 0);
+        putBits(&writer, u[i], escapeBits < 32 ? escapeBits : 32);
+      }
+    }
+  }
+  flushBits(&writer);
+  return 2 + writer.position;
+}
+
+readError_t decodeChannel(unsigned char* in, size_t length, unsigned long n, unsigned short bitDepth, int32_t* x, size_t* used) {
+  unsigned int order, k, quotient;
+  unsigned int escapeBits = bitDepth + 5;
+  int64_t minValue = -((int64_t)1 << (bitDepth - 1));
+  int64_t maxValue = ((int64_t)1 << (bitDepth - 1)) - 1;
+  uint64_t bitsUsed;
+  unsigned long i;
+  bitReader_t reader;
+  if(length < 2) {
+    return ERROR_EOF;
+  }
+  order = in[0];
+  k = in[1];
+  if(order > SNDZ_MAX_ORDER || (k != SNDZ_VERBATIM && k > 31)) {
+    return ERROR_SAMPLE_DATA;
+  }
+  reader.in = in + 2;
+  reader.length = length - 2;
+  reader.position = 0;
+  reader.bits = 0;
+  reader.numBits = 0;
+  for(i = 0; i < n; i++) {
+    int64_t value;
+    if(k == SNDZ_VERBATIM) {
+      value = getBits(&reader, bitDepth);
+      if(value > maxValue) {
+        value -= (int64_t)1 << bitDepth;
+      }
+    }
+    else {
+      uint64_t u, window;
+      fillBits(&reader, 32);
+      window = reader.bits >> (reader.numBits - 32);
+      for(quotient = 0; quotient < SNDZ_ESCAPE_LENGTH && (window & (0x80000000UL >> quotient)); quotient++);
+      if(quotient < SNDZ_ESCAPE_LENGTH) {
+        reader.numBits -= quotient + 1;
+        u = ((uint64_t)quotient << k) | getBits(&reader, k);
+      }
+      else {
+        reader.numBits -= SNDZ_ESCAPE_LENGTH;
+        u = getBits(&reader, escapeBits > 32 ? escapeBits - 32 : 0) << 32;
+        u |= getBits(&reader, escapeBits < 32 ? escapeBits : 32);
+      }
+      value = predictValue(x, i, order) + ((u & 1) ? -(int64_t)(u >> 1) - 1 : (int64_t)(u >> 1));
+      if(value < minValue || value > maxValue) {
+        return ERROR_SAMPLE_DATA;
+      }
+    }
+    x[i] = value;
+  }
+  bitsUsed = (uint64_t)reader.position * 8 - reader.numBits;
+  if(bitsUsed > (uint64_t)reader.length * 8) {
+    return ERROR_EOF;
+  }
+  *used = 2 + (bitsUsed + 7) / 8;
+  return NO_ERROR;
+}
+
+void loadChannel(sampleBuffer_t* samples, unsigned short numChannels, unsigned int channel, unsigned long firstFrame, unsigned long numFrames, int32_t* x) {
+  getChannelValues(samples, numChannels, (uint64_t)firstFrame * numChannels + channel, numFrames, x);
+}
+
+void storeChannel(unsigned char* data, unsigned short numChannels, unsigned short bitDepth, unsigned int channel, unsigned long firstFrame, unsigned long numFrames, int32_t* x) {
+  /* only the values of this channel are written, so the size is not needed */
+  sampleBuffer_t buffer = makeSampleBuffer(data, bitDepth, 1, 0);
+  setChannelValues(&buffer, numChannels, (uint64_t)firstFrame * numChannels + channel, numFrames, x);
+}
+
+int64_t predictValue(int32_t* x, unsigned long i, unsigned int order) {
+  if(order > i) {
+    order = i;
+  }
+  switch(order) {
+    case 1:
+      return x[i-1];
+    case 2:
+      return 2 * (int64_t)x[i-1] - x[i-2];
+    case 3:
+      return 3 * ((int64_t)x[i-1] - x[i-2]) + x[i-3];
+    case 4:
+      return 4 * ((int64_t)x[i-1] + x[i-3]) - 6 * (int64_t)x[i-2] - x[i-4];
+    default:
+      return 0;
+  }
+}
+
+uint64_t getRiceSize(uint64_t* u, unsigned long n, unsigned int k, unsigned int escapeBits) {
+  unsigned long i;
+  uint64_t size = 0;
+  for(i = 0; i < n; i++) {
+    uint64_t quotient = u[i] >> k;
+    size += quotient < SNDZ_ESCAPE_LENGTH ? quotient + 1 + k : SNDZ_ESCAPE_LENGTH + escapeBits;
+  }
+  return size;
+}
+
+void putBits(bitWriter_t* writer, uint64_t value, unsigned int n) {
+  if(n == 0) {
+    return;
+  }
+  writer->bits = (writer->bits << n) | (value & (((uint64_t)1 << n) - 1));
+  writer->numBits += n;
+  while(writer->numBits >= 8) {
+    writer->numBits -= 8;
+    writer->out[writer->position++] = writer->bits >> writer->numBits;
+  }
+}
+
+void flushBits(bitWriter_t* writer) {
+  if(writer->numBits > 0) {
+    writer->out[writer->position++] = writer->bits << (8 - writer->numBits);
+    writer->numBits = 0;
+  }
+}
+
+void fillBits(bitReader_t* reader, unsigned int n) {
+  while(reader->numBits < n) {
+    unsigned char byte = reader->position < reader->length ? reader->in[reader->position] : 0;
+    reader->bits = (reader->bits << 8) | byte;
+    reader->numBits += 8;
+    ++reader->position;
+  }
+}
+
+uint64_t getBits(bitReader_t* reader, unsigned int n) {
+  if(n == 0) {
+    return 0;
+  }
+  fillBits(reader, n);
+  reader->numBits -= n;
+  return (reader->bits >> reader->numBits) & (((uint64_t)1 << n) - 1);
+}
@@ -0,0 +1,150 @@
+#ifndef SNDZ_UTILS_H
+#define SNDZ_UTILS_H
+
+#include <stdio.h>
+#include "fileTypes.h"
+#include "readError.h"
+#include "writeError.h"
+
+/*
+  A SNDZ file is a losslessly compressed sound. After the "SNDZ" file type
+  specifier comes a header of little-endian fields:
+
+    version      2 bytes, SNDZ_VERSION
+    numChannels  2 bytes
+    bitDepth     2 bytes, 8, 16, 24, or 32
+    sampleRate   4 bytes
+    dataSize     8 bytes, the size of the samples once decoded
+
+  and then blocks of at most SNDZ_BLOCK_FRAMES samples, each of which can be
+  decoded on its own:
+
+    bytes        4 bytes, the size of the rest of the block
+    frames       4 bytes, the number of samples in the block
+    per channel: the predictor order (1 byte), the Rice parameter (1 byte),
+                 and the coded residuals, padded to a whole byte
+
+  Each value is predicted from the ones before it in its channel by the fixed
+  polynomial predictor of the given order (0 to SNDZ_MAX_ORDER), using a lower
+  order for the first few values of the block. The residuals are zigzag mapped
+  to unsigned and Rice coded: the quotient in unary as ones ended by a zero,
+  then the low bits. A quotient of SNDZ_ESCAPE_LENGTH ones with no zero is
+  followed by the whole mapped residual in bitDepth + 5 bits instead. When the
+  Rice parameter is SNDZ_VERBATIM, the channel's values are stored as plain
+  bitDepth-bit two's complement numbers.
+
+  Decoded samples use the WAVE layout: 8-bit samples are unsigned and 24-bit
+  samples are packed in 3 bytes.
+*/
+
+#define SNDZ_VERSION 2
+
+/* most samples in one block */
+#define SNDZ_BLOCK_FRAMES 4096
+
+#define SNDZ_MAX_ORDER 4
+
+/* Rice parameter of a channel stored without coding */
+#define SNDZ_VERBATIM 255
+
+/* longest unary quotient, which escapes a residual too big to code */
+#define SNDZ_ESCAPE_LENGTH 24
+
+/**
+  Describes where one block is and the samples it decodes to, and how decoding
+  it went.
+*/
+typedef struct {
+  unsigned char* payload;
+  unsigned long bytes;
+  unsigned long frames;
+  /* index of the first sample of the block in the samples decoded with it */
+  unsigned long firstFrame;
+  readError_t error;
+} sndzBlock_t;
+
+/**
+  Reads a SNDZ sound a block of samples at a time. Open with sndzOpenStream and
+  free with destroySndzReader.
+*/
+typedef struct {
+  FILE* file;
+  unsigned short numChannels;
+  unsigned short bitDepth;
+  /* blocks read from file at once, so they can be decoded in parallel */
+  unsigned char* compressed;
+  size_t compressedCapacity;
+  sndzBlock_t* blocks;
+  unsigned long blocksCapacity;
+  /* decoded samples from the blocks that have not been returned yet */
+  unsigned char* samples;
+  size_t samplesCapacity;
+  unsigned long numFrames;
+  unsigned long nextFrame;
+} sndzReader_t;
+
+/**
+  Reads the SNDZ file fp entirely into sound, decoding its blocks on several
+  threads. Reads from sound->mappedFile instead of fp when the file is mapped.
+  The decoded samples are allocated and use the WAVE layout. If something goes
+  wrong, sound->error is set.
+  Precondition: fp's file pointer is directly after the "SNDZ" specifier
+*/
+void sndzRead(FILE* fp, sound_t* sound);
+
+/**
+  Reads only the header of the SNDZ file fp into sound, leaving rawData NULL.
+  If something goes wrong, sound->error is set.
+  Precondition: fp's file pointer is directly after the "SNDZ" specifier
+  Postcondition: fp's file pointer is at the first block
+*/
+void sndzProbe(FILE* fp, sound_t* sound);
+
+/**
+  Reads the header of the SNDZ file fp into sound like sndzProbe and returns a
+  reader positioned at the first block for sndzReadBlock. Returns NULL and sets
+  sound->error on error.
+  Precondition: fp's file pointer is directly after the "SNDZ" specifier
+*/
+sndzReader_t* sndzOpenStream(FILE* fp, sound_t* sound);
+
+/**
+  Decodes the next numSamples samples from reader into block->rawData, which
+  must have room for them, in the WAVE layout. Reads as many blocks as needed
+  at once and decodes them on several threads, keeping any samples past
+  numSamples for the next call.
+*/
+readError_t sndzReadBlock(sndzReader_t* reader, sound_t* block, unsigned long numSamples);
+
+/**
+  Frees reader. Does not close its file.
+*/
+void destroySndzReader(sndzReader_t* reader);
+
+/**
+  Writes sound to fp as a SNDZ file. sound may be in the CS229 or WAVE layout.
+*/
+writeError_t writeSndzFile(sound_t* sound, FILE* fp);
+
+/**
+  Writes the "SNDZ" specifier and header of sound to fp. The dataSize comes
+  from sound->dataSize, so for a sound that is written in blocks it must hold
+  the size of all of them.
+*/
+writeError_t writeSndzHeader(sound_t* sound, FILE* fp);
+
+/**
+  Compresses the samples of sound, in the CS229 or WAVE layout, on several
+  threads and writes them to fp as blocks. Used on its own to write a sound
+  one block at a time after writeSndzHeader.
+*/
+writeError_t writeSndzSamples(sound_t* sound, FILE* fp);
+
+/**
+  Ends a SNDZ file started by writeSndzHeader(sound, fp) after dataSizeWritten
+  bytes of samples. If that is not the size the header promised, fp is seeked
+  back to correct it, which fails with WRITE_ERROR_SEEKING when fp is a pipe.
+*/
+writeError_t finishSndzFile(sound_t* sound, FILE* fp, uint64_t dataSizeWritten);
+
+#endif
@@ -4,6 +4,32 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+
+/* bytes discarded per read when skipping through input that cannot seek */
+#define WAV_SKIP_BLOCK_SIZE 65536
+
+/* bytes of the ds64 chunk before its table, which is not used */
+#define WAV_DS64_SIZE 28
+
+/* bytes after "RIFF####" up to the samples: "WAVE", fmt chunk, data header */
+#define WAV_HEADER_SIZE 36
+
+/* bytes a ds64 chunk adds to the header of an RF64 file */
+#define WAV_DS64_CHUNK_SIZE (8 + WAV_DS64_SIZE)
+
+/* offset of the ds64 chunk in the RF64 files we write */
+#define WAV_DS64_OFFSET 12
+
+/* bytes float files add to the header: the fmt extension size, which is 0, 
+  and a fact chunk holding the number of samples */
+#define WAV_FLOAT_HEADER_EXTRA (2 + 12)
+
+/* bytes of the fmt chunk of an extensible file up to the end of the audio 
+  format at the start of its sub format */
+#define WAV_EXTENSIBLE_FMT_SIZE 26
+
 /** 
   Read the whole format chunk, and put the data into wd. Sets wd->error and
   returns when error occurs. 
@@ -20,6 +46,52 @@ void wavReadFmtChunk(FILE* fp, wavData_t* wd);
 */ 
 void wavReadDataChunk(FILE* fp, wavData_t* wd);
 
+/**
+  Reads the 64-bit sizes of an RF64 file from its ds64 chunk into 
+  wd->ds64DataSize and skips the rest of the chunk. Sets wd->error and returns
+  when an error occurs.
+  Precondition: file pointer directly after "ds64"
+  Postcondition: file pointer directly after the ds64 chunk
+*/
+void wavReadDs64Chunk(FILE* fp, wavData_t* wd);
+
+/**
+  Sets wd->dataChunkSize from the data chunk size in wd->numBytesInChunk, or 
+  from the ds64 chunk when the data chunk size is WAV_RF64_SIZE.
+*/
+void wavSetDataChunkSize(wavData_t* wd);
+
+/**
+  Returns nonzero if a data chunk of dataSize bytes of the samples of sound is
+  too big for the 32-bit sizes of a RIFF file, so it must be written as RF64.
+*/
+char wavNeedsRf64(sound_t* sound, uint64_t dataSize);
+
+/**
+  Returns the number of bytes after "RIFF####" up to the samples in the WAVE
+  files we write for sound, not counting a ds64 chunk.
+*/
+unsigned int wavHeaderSize(sound_t* sound);
+
+/**
+  Writes the fact chunk of a float file holding dataSize bytes of samples.
+*/
+writeError_t writeFactChunk(sound_t* sound, FILE* fp, uint64_t dataSize);
+
+/**
+  Writes the ds64 chunk of an RF64 file holding dataSize bytes of samples. 
+  Must directly follow the RIFF header, where finishWaveFile expects it.
+*/
+writeError_t writeDs64Chunk(sound_t* sound, FILE* fp, uint64_t dataSize);
+
+/**
+  Points wd->data at the data chunk inside wd->mappedFile instead of reading it.
+  Sets wd->error and returns when the chunk runs past the end of the file.
+  Precondition: file pointer directly after the data chunk size
+  Postcondition: file pointer directly after the data chunk
+*/
+void wavMapDataChunk(FILE* fp, wavData_t* wd);
+
 /** 
   Read through the chunk and ignore the data inside. Sets wd->error and returns
   when an error occurs.
@@ -29,15 +101,23 @@ void wavReadDataChunk(FILE* fp, wavData_t* wd);
 void wavIgnoreChunk(FILE* fp, wavData_t* wd);
 
 /**
-  Ignore num bytes from fp.
+  Ignore num bytes from fp. Seeks past them when fp is seekable and otherwise 
+  reads and discards them in large blocks. Sets wd->error if the file ends or 
+  cannot be read first.
 */
-void wavIgnoreBytes(FILE* fp, size_t num);
+void wavIgnoreBytes(FILE* fp, wavData_t* wd, size_t num);
 
 /**
   Fills in sound_t* with the data from the waveData_t*, including error field
 */
 void wavToSound(wavData_t* wd, sound_t* sound);
 
+/**
+  Reads chunk ids and skips chunks until the given chunkId is found.
+  Postcondition: file pointer directly after the chunk ID of cId
+*/
+void wavFindChunk(FILE* fp, wavData_t* wd, chunkId_t cId);
+
 /**
   Finds the given chunkId in the file and calls its read function. 
   REMEMBER, fmt chunk ALWAYS comes first in wave files.
@@ -58,6 +138,9 @@ void wavRead(FILE* fp, sound_t* sound) {
   }
   wData->error = NO_ERROR;
   wData->dataChunkSize = 0;
+  wData->hasDs64 = 0;
+  wData->mappedFile = (char*)sound->mappedFile;
+  wData->mappedFileSize = sound->mappedFileSize;
 
   wavFindAndReadChunk(fp, wData, CHUNK_FMT);
   if(wData->error != NO_ERROR) {
@@ -73,16 +156,47 @@ void wavRead(FILE* fp, sound_t* sound) {
   free(wData);
 }
 
-void wavFindAndReadChunk(FILE* fp, wavData_t* wd, chunkId_t cId) {
+void wavProbe(FILE* fp, sound_t* sound) {
+  wavData_t* wData = malloc(sizeof(wavData_t));
+  if(!wData) {
+    sound->error = ERROR_MEMORY;
+    return;
+  }
+  wData->error = NO_ERROR;
+  wData->data = NULL;
+  wData->dataChunkSize = 0;
+  wData->hasDs64 = 0;
+
+  wavFindAndReadChunk(fp, wData, CHUNK_FMT);
+  wavFindChunk(fp, wData, CHUNK_DATA);
+  wavReadNumRemainingBytesInChunk(fp, wData);
+  if(wData->error == NO_ERROR) {
+    wavSetDataChunkSize(wData);
+  }
+  wavToSound(wData, sound);
+  free(wData);
+}
+
+void wavFindChunk(FILE* fp, wavData_t* wd, chunkId_t cId) {
   if(wd->error != NO_ERROR) return;
   wavReadChunkId(fp, wd);
   if(wd->error != NO_ERROR) return;
   while(wd->error == NO_ERROR && wd->currentChunkId != cId) {
-    wavIgnoreChunk(fp, wd);
+    if(wd->currentChunkId == CHUNK_DS64) {
+      /* comes first in RF64 files, and gives the sizes of the later chunks */
+      wavReadDs64Chunk(fp, wd);
+    }
+    else {
+      wavIgnoreChunk(fp, wd);
+    }
     if(wd->error != NO_ERROR) return;
     wavReadChunkId(fp, wd);
     if(wd->error != NO_ERROR) return;
   }
+}
+
+void wavFindAndReadChunk(FILE* fp, wavData_t* wd, chunkId_t cId) {
+  wavFindChunk(fp, wd, cId);
   if(wd->error == NO_ERROR) {
     switch(cId) {
       case CHUNK_FMT: 
@@ -104,9 +218,11 @@ void wavToSound(wavData_t* wd, sound_t* sound) {
   sound->dataSize = wd->dataChunkSize;
   sound->error = wd->error;
   sound->rawData = wd->data;
+  sound->sampleFormat = wd->audioFormat == WAV_FORMAT_FLOAT ? FLOAT_SAMPLES : INTEGER_SAMPLES;
 }
 
 void wavReadFmtChunk(FILE* fp, wavData_t* wd) {
+  unsigned int bytesRead;
   if(wd->error != NO_ERROR) return;
   wavReadNumRemainingBytesInChunk(fp, wd);
   if(wd->error != NO_ERROR) return;
@@ -121,57 +237,138 @@ void wavReadFmtChunk(FILE* fp, wavData_t* wd) {
   wavReadBlockAlign(fp, wd);
   if(wd->error != NO_ERROR) return;
   wavReadBitDepth(fp, wd);
-  if(wd->bitDepth != 8 && wd->bitDepth != 16 && wd->bitDepth != 32) {
+  if(wd->error != NO_ERROR) return;
+  if(wd->bitDepth != 8 && wd->bitDepth != 16 && wd->bitDepth != 24 && wd->bitDepth != 32) {
+    wd->error = ERROR_BIT_DEPTH;
+  }
+  bytesRead = 16;
+  if(wd->audioFormat == WAV_FORMAT_EXTENSIBLE 
+      && wd->numBytesInChunk >= WAV_EXTENSIBLE_FMT_SIZE) {
+    /* skip the extension size, valid bits, and channel mask */
+    wavIgnoreBytes(fp, wd, 8);
+    wavReadAudioFormat(fp, wd);
+    bytesRead = WAV_EXTENSIBLE_FMT_SIZE;
+  }
+  if(wd->audioFormat != WAV_FORMAT_PCM && wd->audioFormat != WAV_FORMAT_FLOAT) {
+    /* compressed encodings such as A-law or ADPCM would be misread as PCM */
+    wd->error = ERROR_FILETYPE;
+  }
+  else if(wd->audioFormat == WAV_FORMAT_FLOAT && wd->bitDepth != 32) {
+    /* 64-bit doubles are not supported */
     wd->error = ERROR_BIT_DEPTH;
   }
+  if(wd->error != NO_ERROR) return;
 
-  /* ignore fmt chunk's extra parameters (numBytes - 16 previously read bytes */
-  /* we make sure numBytesInChunk is >16 so we don't try ignoring negative bytes!*/
-  if(wd->numBytesInChunk > 16) wavIgnoreBytes(fp, wd->numBytesInChunk - 16);
+  /* ignore fmt chunk's extra parameters (numBytes - bytesRead previously read bytes */
+  /* we make sure numBytesInChunk is >bytesRead so we don't try ignoring negative bytes!*/
+  if(wd->numBytesInChunk > bytesRead) wavIgnoreBytes(fp, wd, wd->numBytesInChunk - bytesRead);
 }
 
 void wavReadDataChunk(FILE* fp, wavData_t* wd) {
   if(wd->error != NO_ERROR) return;
   wavReadNumRemainingBytesInChunk(fp, wd);
   if(wd->error != NO_ERROR) return;
-  if(wd->bitDepth == 8 || wd->bitDepth == 16 || wd->bitDepth == 32) {
-    /* if numBytesInChunk is 0, malloc can give a non-freeable pointer */
-    if(wd->numBytesInChunk > 0) {
-      wd->data = malloc(wd->numBytesInChunk);
+  wavSetDataChunkSize(wd);
+  if(wd->mappedFile) {
+    wavMapDataChunk(fp, wd);
+    return;
+  }
+  if(wd->bitDepth == 8 || wd->bitDepth == 16 || wd->bitDepth == 24 || wd->bitDepth == 32) {
+    /* if dataChunkSize is 0, malloc can give a non-freeable pointer */
+    if(wd->dataChunkSize > 0) {
+      wd->data = malloc(wd->dataChunkSize);
     }
     if(!wd->data) {
       wd->error = ERROR_MEMORY;
       return;
     }
   }
-  wd->dataChunkSize = wd->numBytesInChunk; 
   wavReadSoundData(fp, wd);
 }
 
+void wavMapDataChunk(FILE* fp, wavData_t* wd) {
+  long offset = ftell(fp);
+  if(offset < 0) {
+    wd->error = ERROR_READING;
+    return;
+  }
+  if(wd->dataChunkSize > wd->mappedFileSize - offset) {
+    /* the data chunk claims more bytes than the file holds */
+    wd->error = ERROR_EOF;
+    return;
+  }
+  wd->data = wd->mappedFile + offset;
+  /* keep fp in step with the chunks we used from the mapping */
+  if(fseek(fp, (long)(wd->dataChunkSize + wd->dataChunkSize % 2), SEEK_CUR) != 0) {
+    wd->error = ERROR_READING;
+  }
+}
+
+void wavReadDs64Chunk(FILE* fp, wavData_t* wd) {
+  uint64_t sizes[2];
+  wavReadNumRemainingBytesInChunk(fp, wd);
+  if(wd->error != NO_ERROR) return;
+  if(wd->numBytesInChunk < sizeof(sizes)) {
+    /* too short to hold the RIFF and data sizes */
+    wd->error = ERROR_FILETYPE;
+    return;
+  }
+  /* the RIFF size, then the data size */
+  wd->error = readBytes(sizes, sizeof(sizes), fp);
+  if(wd->error != NO_ERROR) return;
+  wd->ds64DataSize = sizes[1];
+  wd->hasDs64 = 1;
+  /* skip the sample count and the table of other chunk sizes */
+  wavIgnoreBytes(fp, wd, (size_t)wd->numBytesInChunk - sizeof(sizes) + wd->numBytesInChunk % 2);
+}
+
+void wavSetDataChunkSize(wavData_t* wd) {
+  if(wd->numBytesInChunk == WAV_RF64_SIZE && wd->hasDs64) {
+    wd->dataChunkSize = wd->ds64DataSize;
+  }
+  else {
+    wd->dataChunkSize = wd->numBytesInChunk;
+  }
+}
+
 void wavReadSoundData(FILE* fp, wavData_t* wd) {
   if(wd->error != NO_ERROR) return;
   wd->error = readBytes(wd->data, wd->dataChunkSize, fp);
   if(wd->dataChunkSize % 2 != 0) {
     /* ignore padding byte if dataChunk is odd */
-    readBytes(wd->data, 1, fp);
+    char padding;
+    readBytes(&padding, 1, fp);
   }
 }
   
 void wavIgnoreChunk(FILE* fp, wavData_t* wd) {
-  size_t chunkSize;
+  uint32_t chunkSize;
   if(wd->error != NO_ERROR) return;
   /* read chunk size from the first 4 bytes */
   wd->error = readBytes(&chunkSize, 4, fp);
   if(wd->error != NO_ERROR) return;
-  wavIgnoreBytes(fp, chunkSize);
-  if(chunkSize % 2 != 0) {
-    wavIgnoreBytes(fp, 1);
-  }
+  /* chunks are padded to an even number of bytes */
+  wavIgnoreBytes(fp, wd, (size_t)chunkSize + chunkSize % 2);
 }
 
-void wavIgnoreBytes(FILE* fp, size_t num) {
-  char ignoredChar;
-  while(num-- && readBytes(&ignoredChar, 1, fp) == NO_ERROR); 
+void wavIgnoreBytes(FILE* fp, wavData_t* wd, size_t num) {
+  char* ignoredBytes;
+  if(num == 0) return;
+  if(num <= LONG_MAX && fseek(fp, (long)num, SEEK_CUR) == 0) {
+    return;
+  }
+  /* not seekable (a pipe or terminal), so read through the bytes instead */
+  ignoredBytes = malloc(WAV_SKIP_BLOCK_SIZE);
+  if(!ignoredBytes) {
+    wd->error = ERROR_MEMORY;
+    return;
+  }
+  while(num && wd->error == NO_ERROR) {
+    size_t blockSize = num < WAV_SKIP_BLOCK_SIZE ? num : WAV_SKIP_BLOCK_SIZE;
+    wd->error = readBytes(ignoredBytes, blockSize, fp);
+    num -= blockSize;
+  }
+  free(ignoredBytes);
 }
 
 void wavReadChunkId(FILE* fp, wavData_t* wd) {
@@ -185,6 +382,9 @@ void wavReadChunkId(FILE* fp, wavData_t* wd) {
   else if(strncmp(chunkStr, "data", 4) == 0) {
     wd->currentChunkId = CHUNK_DATA;
   }
+  else if(strncmp(chunkStr, "ds64", 4) == 0) {
+    wd->currentChunkId = CHUNK_DS64;
+  }
   else {
     wd->currentChunkId = CHUNK_UNKNOWN;
   }
@@ -225,11 +425,27 @@ void wavReadBitDepth(FILE* fp, wavData_t* wd) {
   wd->error = readBytes(&wd->bitDepth, 2, fp);
 }
 
+char wavNeedsRf64(sound_t* sound, uint64_t dataSize) {
+  return dataSize > WAV_RF64_SIZE - wavHeaderSize(sound);
+}
+
+unsigned int wavHeaderSize(sound_t* sound) {
+  if(sound->sampleFormat == FLOAT_SAMPLES) {
+    return WAV_HEADER_SIZE + WAV_FLOAT_HEADER_EXTRA;
+  }
+  return WAV_HEADER_SIZE;
+}
+
 writeError_t writeHeader(sound_t* sound, FILE* fp) {
-  /* header size plus the data chunk id minus 8 for "RIFF####" = 36 */
+  /* header size plus the data chunk id minus 8 for "RIFF####" */
   char riffHead[] = {'R', 'I', 'F', 'F'};
-  unsigned long fileSize = {sound->dataSize + 36};
+  uint32_t fileSize = sound->dataSize + wavHeaderSize(sound);
   char waveHead[] = {'W', 'A', 'V', 'E'};
+  if(wavNeedsRf64(sound, sound->dataSize)) {
+    /* the real size is in the ds64 chunk written next */
+    memcpy(riffHead, "RF64", 4);
+    fileSize = WAV_RF64_SIZE;
+  }
   if(fwrite(riffHead, 1, 4, fp) != 4) {
     return WRITE_ERROR_TOO_FEW_CHARS;
   }
@@ -242,15 +458,45 @@ writeError_t writeHeader(sound_t* sound, FILE* fp) {
   return WRITE_SUCCESS;
 }
 
+writeError_t writeDs64Chunk(sound_t* sound, FILE* fp, uint64_t dataSize) {
+  char ds64Head[] = {'d', 's', '6', '4'};
+  uint32_t ds64Size = WAV_DS64_SIZE;
+  /* the RIFF size, the data size, and the number of samples */
+  uint64_t sizes[3];
+  uint32_t tableLength = 0;
+  sizes[0] = dataSize + wavHeaderSize(sound) + WAV_DS64_CHUNK_SIZE;
+  sizes[1] = dataSize;
+  sizes[2] = dataSize / (sound->numChannels * sound->bitDepth / 8);
+  if(fwrite(ds64Head, 1, 4, fp) != 4) {
+    return WRITE_ERROR_TOO_FEW_CHARS;
+  }
+  if(fwrite(&ds64Size, 4, 1, fp) != 1) {
+    return WRITE_ERROR_TOO_FEW_CHARS;
+  }
+  if(fwrite(sizes, 8, 3, fp) != 3) {
+    return WRITE_ERROR_TOO_FEW_CHARS;
+  }
+  if(fwrite(&tableLength, 4, 1, fp) != 1) {
+    return WRITE_ERROR_TOO_FEW_CHARS;
+  }
+  return WRITE_SUCCESS;
+}
+
 writeError_t writeFmtChunk(sound_t* sound, FILE* fp) {
   char fmtHead[4] = {'f', 'm', 't', ' '};
   unsigned long fmtSize = 16;
-  unsigned short audioFormat = 1;
+  unsigned short audioFormat = WAV_FORMAT_PCM;
+  /* the size of the fmt extension, which float files must have */
+  unsigned short extensionSize = 0;
   unsigned short numChannels = sound->numChannels;
   unsigned long sampleRate = sound->sampleRate;
   unsigned long byteRate = sound->sampleRate * sound->numChannels * sound->bitDepth / 8;
   unsigned short blockAlign = sound->numChannels * sound->bitDepth / 8;
   unsigned short bitDepth = sound->bitDepth;
+  if(sound->sampleFormat == FLOAT_SAMPLES) {
+    fmtSize += 2;
+    audioFormat = WAV_FORMAT_FLOAT;
+  }
   if(fwrite(fmtHead, 1, 4, fp) != 4) {
     return WRITE_ERROR_TOO_FEW_CHARS;
   }
@@ -275,44 +521,127 @@ writeError_t writeFmtChunk(sound_t* sound, FILE* fp) {
   if(fwrite(&bitDepth, 2, 1, fp) != 1) {
     return WRITE_ERROR_TOO_FEW_CHARS;
   }
+  if(fmtSize > 16 && fwrite(&extensionSize, 2, 1, fp) != 1) {
+    return WRITE_ERROR_TOO_FEW_CHARS;
+  }
   return WRITE_SUCCESS;
 }
 
-writeError_t writeDataChunk(sound_t* sound, FILE* fp) {
-  char dataHead[] = {'d', 'a', 't', 'a'};
-  unsigned long dataSize = sound->dataSize;
-  char* charData = sound->rawData;
-  if(!charData) {
-    return WRITE_ERROR_MEMORY;
+writeError_t writeFactChunk(sound_t* sound, FILE* fp, uint64_t dataSize) {
+  char factHead[] = {'f', 'a', 'c', 't'};
+  uint32_t factSize = 4;
+  /* RF64 files keep the real number of samples in their ds64 chunk */
+  uint32_t numSamples = WAV_RF64_SIZE;
+  if(!wavNeedsRf64(sound, dataSize)) {
+    numSamples = dataSize / (sound->numChannels * sound->bitDepth / 8);
+  }
+  if(fwrite(factHead, 1, 4, fp) != 4) {
+    return WRITE_ERROR_TOO_FEW_CHARS;
+  }
+  if(fwrite(&factSize, 4, 1, fp) != 1) {
+    return WRITE_ERROR_TOO_FEW_CHARS;
   }
+  if(fwrite(&numSamples, 4, 1, fp) != 1) {
+    return WRITE_ERROR_TOO_FEW_CHARS;
+  }
+  return WRITE_SUCCESS;
+}
+
+writeError_t writeDataChunkHeader(sound_t* sound, FILE* fp) {
+  char dataHead[] = {'d', 'a', 't', 'a'};
+  uint32_t dataSize = wavNeedsRf64(sound, sound->dataSize) ? WAV_RF64_SIZE : sound->dataSize;
   if(fwrite(dataHead, 1, 4, fp) != 4) {
     return WRITE_ERROR_TOO_FEW_CHARS;
   }
   if(fwrite(&dataSize, 4, 1, fp) != 1) {
     return WRITE_ERROR_TOO_FEW_CHARS;
   }
-  if(fwrite(charData, 1, sound->dataSize, fp) != sound->dataSize) {
+  return WRITE_SUCCESS;
+}
+
+writeError_t writeWaveHeader(sound_t* sound, FILE* fp) {
+  writeError_t error = WRITE_SUCCESS;
+  error = writeHeader(sound, fp);
+  if(error == WRITE_SUCCESS && wavNeedsRf64(sound, sound->dataSize)) {
+    error = writeDs64Chunk(sound, fp, sound->dataSize);
+  }
+  if(error == WRITE_SUCCESS) {
+    error = writeFmtChunk(sound, fp);
+  }
+  if(error == WRITE_SUCCESS && sound->sampleFormat == FLOAT_SAMPLES) {
+    error = writeFactChunk(sound, fp, sound->dataSize);
+  }
+  if(error == WRITE_SUCCESS) {
+    error = writeDataChunkHeader(sound, fp);
+  }
+  return error;
+}
+
+writeError_t writeWaveSamples(sound_t* sound, FILE* fp) {
+  if(fwrite(sound->rawData, 1, sound->dataSize, fp) != sound->dataSize) {
     return WRITE_ERROR_TOO_FEW_CHARS;
   }
-  
-  if(sound->dataSize % 2 != 0) {
+  return WRITE_SUCCESS;
+}
+
+writeError_t finishWaveFile(sound_t* sound, FILE* fp, uint64_t dataSizeWritten) {
+  unsigned int headerSize = wavHeaderSize(sound);
+  uint32_t fileSize = dataSizeWritten + headerSize;
+  uint32_t dataSize = dataSizeWritten;
+  if(dataSizeWritten % 2 != 0) {
     char data = 0;
     /* write an extra padding byte */
     if(fwrite(&data, 1, 1, fp) != 1) {
       return WRITE_ERROR_TOO_FEW_CHARS;
     }
   }
+  if(dataSizeWritten == sound->dataSize) {
+    return WRITE_SUCCESS;
+  }
+  /* the header promised a different size, go back and fix both sizes */
+  if(wavNeedsRf64(sound, sound->dataSize)) {
+    /* an RF64 header leaves the RIFF sizes alone and fixes the ds64 chunk */
+    if(fseek(fp, WAV_DS64_OFFSET, SEEK_SET) != 0 
+        || writeDs64Chunk(sound, fp, dataSizeWritten) != WRITE_SUCCESS) {
+      return WRITE_ERROR_SEEKING;
+    }
+    if(fseek(fp, 0, SEEK_END) != 0) {
+      return WRITE_ERROR_SEEKING;
+    }
+    return WRITE_SUCCESS;
+  }
+  if(wavNeedsRf64(sound, dataSizeWritten)) {
+    /* there is no room for a ds64 chunk before the samples */
+    return WRITE_ERROR_TOO_LARGE;
+  }
+  if(fseek(fp, 4, SEEK_SET) != 0 || fwrite(&fileSize, 4, 1, fp) != 1) {
+    return WRITE_ERROR_SEEKING;
+  }
+  /* the fact chunk ends right before the data chunk */
+  if(sound->sampleFormat == FLOAT_SAMPLES && (fseek(fp, headerSize - 12, SEEK_SET) != 0 
+      || writeFactChunk(sound, fp, dataSizeWritten) != WRITE_SUCCESS)) {
+    return WRITE_ERROR_SEEKING;
+  }
+  if(fseek(fp, headerSize + 4, SEEK_SET) != 0 || fwrite(&dataSize, 4, 1, fp) != 1) {
+    return WRITE_ERROR_SEEKING;
+  }
+  if(fseek(fp, 0, SEEK_END) != 0) {
+    return WRITE_ERROR_SEEKING;
+  }
   return WRITE_SUCCESS;
 }
 
 writeError_t writeWaveFile(sound_t* sound, FILE* fp) {
   writeError_t error = WRITE_SUCCESS;
-  error = writeHeader(sound, fp);
+  if(!sound->rawData) {
+    return WRITE_ERROR_MEMORY;
+  }
+  error = writeWaveHeader(sound, fp);
   if(error == WRITE_SUCCESS) {
-    error = writeFmtChunk(sound, fp);
+    error = writeWaveSamples(sound, fp);
   }
   if(error == WRITE_SUCCESS) {
-    error = writeDataChunk(sound, fp);
+    error = finishWaveFile(sound, fp, sound->dataSize);
   }
   return error;
 }
@@ -3,6 +3,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include "errorPrinter.h"
 #include "fileTypes.h"
 
@@ -14,13 +15,29 @@
   coupled methods with sound_t parameters.
 */
 
+/**
+  The RIFF and data chunk sizes of an RF64 file, which say to use the sizes in
+  its ds64 chunk instead.
+*/
+#define WAV_RF64_SIZE 0xFFFFFFFF
+
+/**
+  Audio formats of the fmt chunk. Extensible fmt chunks give the real format
+  at the start of their sub format.
+*/
+#define WAV_FORMAT_PCM 1
+#define WAV_FORMAT_FLOAT 3
+#define WAV_FORMAT_EXTENSIBLE 0xFFFE
+
 /**
   Used to tell what chunk we are currently reading 
 */
 typedef enum {
   CHUNK_UNKNOWN,
   CHUNK_FMT,
-  CHUNK_DATA
+  CHUNK_DATA,
+  /* the 64-bit sizes of an RF64 file */
+  CHUNK_DS64
 } chunkId_t;
 
 typedef struct {
@@ -28,15 +45,24 @@ typedef struct {
     data can point to the types: 
       (1) unsigned 8-bit integer if bitDepth == 8
       (2) signed 16-bit integer if bitDepth == 16
-      (3) signed 32-bit integer if bitDepth == 32
+      (3) signed 24-bit integer packed in 3 bytes if bitDepth == 24
+      (4) signed 32-bit integer if bitDepth == 32
+      (5) 32-bit IEEE float if audioFormat == WAV_FORMAT_FLOAT
   */
   void* data;
+  /* the mapped file when the data chunk can be used in place, or NULL */
+  char* mappedFile;
+  size_t mappedFileSize;
   chunkId_t currentChunkId;
   readError_t error;
   unsigned int numBytesInChunk;
   unsigned int sampleRate;
   unsigned int byteRate;
-  unsigned int dataChunkSize;
+  uint64_t dataChunkSize;
+  /* the data chunk size given by the ds64 chunk of an RF64 file, which is 
+    used when the data chunk itself gives WAV_RF64_SIZE */
+  uint64_t ds64DataSize;
+  char hasDs64;
   unsigned short audioFormat;
   unsigned short numChannels;
   unsigned short blockAlign;
@@ -44,13 +70,24 @@ typedef struct {
 } wavData_t;
 
 /** 
-  Reads the wav file entirely into sound. If something goes wrong, error 
-  message is printed and sound->error is set.
+  Reads the wav file entirely into sound. If sound->mappedFile is set, the
+  sample data is not copied and sound->rawData points into the mapping. RF64
+  files are read the same way, with the data size taken from their ds64 chunk.
+  If something goes wrong, error message is printed and sound->error is set.
   Precondition: fp's file pointer is directly after the header
   Postcondition: fp has been completely read
 */
 void wavRead(FILE* fp, sound_t* sound);
 
+/**
+  Reads the fmt chunk and the size of the data chunk into sound without reading
+  any sample data, so sound->rawData is left NULL. If something goes wrong, 
+  sound->error is set.
+  Precondition: fp's file pointer is directly after the header
+  Postcondition: fp's file pointer is directly after the data chunk size
+*/
+void wavProbe(FILE* fp, sound_t* sound);
+
 /**
   Reads the chunk id (ex. "fmt " or "data") and returns the corresponding 
   chunkId_t. If memory error occurs, error message is printed and 
@@ -69,9 +106,9 @@ void wavReadChunkId(FILE* fp, wavData_t* wd);
 void wavReadNumRemainingBytesInChunk(FILE* fp, wavData_t* wd);
 
 /** 
-  Reads the audio format. If audio format is not 1 (for PCM), then error message
-  is printed, and sound->error is set because other audio formats indicate 
-  compression and we don't handle them.
+  Reads the audio format. WAV_FORMAT_FLOAT samples are read as floats and 
+  WAV_FORMAT_PCM samples as integers. wavReadFmtChunk rejects every other 
+  format, after looking inside WAV_FORMAT_EXTENSIBLE, with ERROR_FILETYPE.
   Precondition: fp's file pointer is directly after num bytes in chunk speciier
   Postcondition: fp's file pointer is directly after audio format.
 */
@@ -123,4 +160,28 @@ void wavReadBitDepth(FILE* fp, wavData_t* wd);
 */
 writeError_t writeWaveFile(sound_t* sound, FILE* fp);
 
+/**
+  Writes the RIFF header, the fmt chunk, and the start of the data chunk for 
+  sound to fp. The sizes come from sound->dataSize, so for a sound that is
+  written in blocks it must hold the size of all of them. When that is too 
+  big for the 32-bit RIFF sizes, an RF64 header with a ds64 chunk is written
+  instead. Float samples are written as WAV_FORMAT_FLOAT with a fact chunk.
+*/
+writeError_t writeWaveHeader(sound_t* sound, FILE* fp);
+
+/**
+  Writes the sample data of sound to fp. Used on its own to write a sound one 
+  block at a time after writeWaveHeader.
+*/
+writeError_t writeWaveSamples(sound_t* sound, FILE* fp);
+
+/**
+  Ends the data chunk started by writeWaveHeader(sound, fp) after 
+  dataSizeWritten bytes of samples. If that is not the size the header 
+  promised, fp is seeked back to correct the RIFF and data sizes, which fails 
+  with WRITE_ERROR_SEEKING when fp is a pipe. A plain RIFF header cannot be 
+  corrected to a size that needs RF64, which fails with WRITE_ERROR_TOO_LARGE.
+*/
+writeError_t finishWaveFile(sound_t* sound, FILE* fp, uint64_t dataSizeWritten);
+
 #endif
@@ -0,0 +1,69 @@
+#include "workerThreads.h"
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+
+typedef struct {
+  workerFunction_t function;
+  unsigned int index;
+  unsigned int numWorkers;
+  void* arg;
+} worker_t;
+
+/**
+  pthread entry point which runs one worker_t.
+*/
+void* runWorker(void* worker);
+
+unsigned int getNumWorkerThreads() {
+  long numWorkers = 0;
+  char* setting = getenv("SOUNDUTILS_THREADS");
+  if(setting) {
+    numWorkers = strtol(setting, NULL, 10);
+  }
+  if(numWorkers < 1) {
+    numWorkers = sysconf(_SC_NPROCESSORS_ONLN);
+  }
+  if(numWorkers < 1) {
+    numWorkers = 1;
+  }
+  if(numWorkers > MAX_WORKER_THREADS) {
+    numWorkers = MAX_WORKER_THREADS;
+  }
+  return numWorkers;
+}
+
+void runWorkers(unsigned int numWorkers, workerFunction_t function, void* arg) {
+  worker_t workers[MAX_WORKER_THREADS];
+  pthread_t threads[MAX_WORKER_THREADS];
+  char started[MAX_WORKER_THREADS];
+  unsigned int i;
+  if(numWorkers > MAX_WORKER_THREADS) {
+    numWorkers = MAX_WORKER_THREADS;
+  }
+  for(i = 0; i < numWorkers; i++) {
+    workers[i].function = function;
+    workers[i].index = i;
+    workers[i].numWorkers = numWorkers;
+    workers[i].arg = arg;
+    started[i] = 0;
+  }
+  for(i = 1; i < numWorkers; i++) {
+    started[i] = pthread_create(&threads[i], NULL, runWorker, &workers[i]) == 0;
+  }
+  runWorker(&workers[0]);
+  for(i = 1; i < numWorkers; i++) {
+    if(started[i]) {
+      pthread_join(threads[i], NULL);
+    }
+    else {
+      runWorker(&workers[i]);
+    }
+  }
+}
+
+void* runWorker(void* worker) {
+  worker_t* w = (worker_t*)worker;
+  w->function(w->index, w->numWorkers, w->arg);
+  return NULL;
+}
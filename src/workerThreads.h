@@ -0,0 +1,30 @@
+#ifndef WORKER_THREADS_H
+#define WORKER_THREADS_H
+
+/**
+  Largest number of workers getNumWorkerThreads will return.
+*/
+#define MAX_WORKER_THREADS 64
+
+/**
+  Work done by each worker. index numbers the worker from 0 to numWorkers - 1,
+  and arg is shared by all of them.
+*/
+typedef void (*workerFunction_t)(unsigned int index, unsigned int numWorkers, void* arg);
+
+/**
+  Returns how many workers to split work between: the SOUNDUTILS_THREADS 
+  environment variable if it is set to a positive number, otherwise the number
+  of online processors. Never returns less than 1 or more than 
+  MAX_WORKER_THREADS.
+*/
+unsigned int getNumWorkerThreads();
+
+/**
+  Runs function once for each of numWorkers workers at the same time and 
+  returns when all of them are done. Worker 0 runs on the calling thread. If a
+  thread cannot be started, its work is done on the calling thread instead.
+*/
+void runWorkers(unsigned int numWorkers, workerFunction_t function, void* arg);
+
+#endif
@@ -5,7 +5,10 @@ typedef enum {
   WRITE_SUCCESS,
   WRITE_ERROR_OPENING,
   WRITE_ERROR_MEMORY,
-  WRITE_ERROR_TOO_FEW_CHARS
+  WRITE_ERROR_TOO_FEW_CHARS,
+  WRITE_ERROR_SEEKING,
+  /* more samples were written than the header can be corrected to hold */
+  WRITE_ERROR_TOO_LARGE
 } writeError_t;
 
 #endif